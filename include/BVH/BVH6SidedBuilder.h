@@ -1,13 +1,19 @@
 #pragma once
 
-#include "BVH.h"
+#include "ShaderProgram.h"
+#include "Utils.h"
 
+// Six direction-dependent miss links and near-child flags per node, one set per ray major axis and sign
 class BVH6SidedBuilder
 {
-	inline static std::vector<std::vector<Link>> links6Sided = std::vector<std::vector<Link>>(6);
+	static constexpr int SHADER_GROUP_SIZE = 32;
 
-	static void buildTree6Sided(const std::vector<Triangle*>& triangles);
-	static Link buildAxis(int axis, bool positive, std::vector<Link>& vector, const BVHNode* node, int nextRightNode = -1, int depth = 0);
+	inline static UPtr<ComputeShaderProgram> _bvhLinks6;
 
-	friend class BufferController;
+	static void init();
+
+public:
+	static void buildLinks(int nodeOffset, int nodeCount);
+
+	friend class BVHMortonBuilder;
 };
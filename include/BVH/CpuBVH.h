@@ -0,0 +1,107 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <glm/mat3x3.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+class Model;
+
+struct BVHHit
+{
+	float t;
+	glm::vec3 pos;
+	glm::vec3 normal;
+	glm::vec2 uv;
+	int objIndex = -1;
+	int triIndex = -1;
+};
+
+// Two-level BVH on the CPU, a binned SAH tree per model and one over the instances.
+// Queries run on an immutable snapshot and may be called from any thread.
+class CpuBVH
+{
+	static constexpr int BIN_COUNT = 12;
+	static constexpr int MAX_LEAF_SIZE = 4;
+	static constexpr int STACK_RESERVE = 64; // binned SAH gives no depth bound, traversal stacks grow past it
+
+	struct Node
+	{
+		glm::vec3 min;
+		int start; // first primitive for leaves, left child otherwise (right is left + 1)
+		glm::vec3 max;
+		int count; // 0 for inner nodes
+	};
+
+	struct Tree
+	{
+		std::vector<Node> nodes;
+		std::vector<int> indices;
+	};
+
+	struct BlasTriangle
+	{
+		std::array<glm::vec3, 3> pos;
+		std::array<glm::vec3, 3> normal;
+		std::array<glm::vec2, 3> uv;
+	};
+
+	struct Blas
+	{
+		Tree tree;
+		std::vector<BlasTriangle> triangles;
+		int triStartIndex;
+	};
+
+	struct Instance
+	{
+		int objIndex;
+		int objType;
+		glm::mat4 toLocal;
+		glm::mat3 normalToWorld;
+		glm::vec3 pos;
+		float radius;
+		glm::vec3 min, max;
+		std::shared_ptr<const Blas> blas;
+	};
+
+	struct Snapshot
+	{
+		std::unordered_map<int, std::shared_ptr<const Blas>> blases; // keyed by Model::id
+		std::vector<Instance> instances;
+		std::vector<int> unboundedInstances;
+		Tree tlas;
+	};
+
+	inline static std::shared_ptr<const Snapshot> _snapshot = std::make_shared<Snapshot>();
+	inline static std::mutex _snapshotMutex;
+
+	static std::shared_ptr<const Snapshot> snapshot();
+
+	static Tree buildTree(const std::vector<glm::vec3>& mins, const std::vector<glm::vec3>& maxs);
+	static std::shared_ptr<const Blas> buildBlas(const Model* model);
+	static void buildSnapshot(bool rebuildBlases);
+
+	static bool intersectBlas(const Blas& blas, const glm::vec3& pos, const glm::vec3& dir, float& t, glm::vec2& uv, int& triIndex, bool anyHit);
+	static bool intersectInstance(const Instance& instance, const glm::vec3& pos, const glm::vec3& dir, BVHHit& hit, bool anyHit);
+	static bool traverse(const Snapshot& snapshot, const glm::vec3& pos, const glm::vec3& dir, BVHHit& hit, bool anyHit);
+
+public:
+	static void rebuild();
+	static void rebuildTopLevel();
+
+	static bool raycast(const glm::vec3& pos, const glm::vec3& dir, float maxDis, BVHHit& hit);
+	static bool anyHit(const glm::vec3& pos, const glm::vec3& dir, float maxDis);
+	static std::vector<int> overlapBox(const glm::vec3& min, const glm::vec3& max);
+	static std::vector<int> overlapFrustum(const std::array<glm::vec4, 6>& planes);
+
+	static bool intersectBox(const glm::vec3& min, const glm::vec3& max, const glm::vec3& pos, const glm::vec3& invDir, float tMax, float& tEntry);
+	static bool intersectTriangle(const std::array<glm::vec3, 3>& tri, const glm::vec3& pos, const glm::vec3& dir, float& t, glm::vec2& uv);
+	static bool intersectSphere(const glm::vec3& center, float radius, const glm::vec3& pos, const glm::vec3& dir, float& t);
+};
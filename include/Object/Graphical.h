@@ -51,6 +51,7 @@ class Mesh : public Graphical
 {
 protected:
 	Model* _model;
+	bool _useModelMaterials = false;
 
 	Mesh() = default;
 
@@ -61,8 +62,11 @@ public:
 	Mesh(const Mesh& orig);
 
 	Model* model() const { return _model; }
+	bool useModelMaterials() const { return _useModelMaterials; }
+	bool usesModelMaterials() const;
 
 	void setModel(Model* model);
+	void setUseModelMaterials(bool useModelMaterials);
 
 	constexpr static auto properties();
 
@@ -196,7 +200,8 @@ constexpr auto Mesh::properties()
 	return std::tuple_cat(
 		Graphical::properties(),
 		std::make_tuple(
-			JsonUtility::property(&Mesh::_model, "model")
+			JsonUtility::property(&Mesh::_model, "model"),
+			JsonUtility::property(&Mesh::_useModelMaterials, "useModelMaterials")
 		)
 	);
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <filesystem>
 #include <vector>
 
@@ -10,23 +11,44 @@
 
 class GLTexture2D;
 
+enum class TextureState
+{
+	Pending,
+	Decoding,
+	Decoded,
+	Ready,
+	Failed,
+};
+
 class Texture
 {
 	inline static int _nextAvailableId = 0;
+	static constexpr int MIP_CACHE_VERSION = 1;
+	inline static const std::filesystem::path MIP_CACHE_DIR = "cache/textures";
 
 	int _id;
 	std::string _path;
 	std::string _name;
 
-	float* _data;
+	bool _isHdr = false;
+	bool _isLinear = false; // LDR data that is not sRGB encoded, like opacity
+	std::vector<std::vector<unsigned char>> _mips;
 	int _width = 0, _height = 0;
+	GLint _wrapMode = GL_REPEAT;
+	std::atomic<TextureState> _state = TextureState::Pending;
 
 	UPtr<GLTexture2D> _glTex;
 
-	bool readImage(std::vector<float>& data_v, const std::filesystem::path& path);
-	bool readImageExr(std::vector<float>& data_v, const std::filesystem::path& path);
+	bool readImage(const std::filesystem::path& path);
+	bool readImageExr(const std::filesystem::path& path);
+
+	void generateMips();
+	bool readMipCache(const std::filesystem::path& cachePath);
+	void writeMipCache(const std::filesystem::path& cachePath) const;
+	static std::filesystem::path getMipCachePath(const std::filesystem::path& path);
 
-	void initData(const std::vector<float>& image);
+	bool load(const std::filesystem::path& path);
+	size_t byteSize() const;
 
 	Texture(const std::filesystem::path& path);
 	Texture(const Texture& other);
@@ -41,20 +63,29 @@ public:
 	int id() const { return _id; }
 	std::string path() const { return _path; }
 	std::string name() const { return _name; }
-	float* data() const { return _data; }
+	bool isHdr() const { return _isHdr; }
+	bool isLinear() const { return _isLinear; }
 	int width() const { return _width; }
 	int height() const { return _height; }
+	int mipCount() const { return (int)_mips.size(); }
+	bool isLoaded() const { return _state == TextureState::Ready; }
 	UPtr<GLTexture2D>& glTex() { return _glTex; }
 
+	uint64_t handle() const;
+	void waitUntilLoaded();
+
 	void setName(const std::string& name) { _name = name; }
-	void setWrapMode(GLint wrapMode) const;
+	void setWrapMode(GLint wrapMode);
+	void setLinear(bool isLinear) { _isLinear = isLinear; }
 
+	// Linear like the GPU samples it, alpha is never sRGB encoded
 	Color colorAt(int x, int y) const;
 
 	constexpr static auto properties();
 
 	friend class Assets;
 	friend class JsonUtility;
+	friend class TextureStreamer;
 };
 
 class WindyTexture : public Texture
@@ -76,7 +107,12 @@ class Material
 {
 	inline static int _nextAvailableId = 0;
 
+	// Dense GPU slots, freed slots are reused so live materials keep their index
+	inline static std::vector<Material*> _slots;
+	inline static std::vector<int> _freeSlots;
+
 	int _id;
+	int _slot;
 	bool _lit;
 	Color _color;
 	Color _specColor = Color::clear();
@@ -100,6 +136,7 @@ public:
 	~Material();
 
 	int id() const { return _id; }
+	int slot() const { return _slot; }
 	bool lit() const { return _lit; }
 	Color color() const { return _color; }
 	Color specColor() const { return _specColor; }
@@ -121,6 +158,8 @@ public:
 	void setRoughness(float roughness);
 	void setEmission(const Color& emission);
 
+	static const std::vector<Material*>& slots() { return _slots; }
+
 	constexpr static auto properties();
 };
 
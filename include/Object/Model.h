@@ -2,19 +2,43 @@
 
 #include <vector>
 
+#include "Color.h"
 #include "JsonUtility.h"
 #include "Triangle.h"
 
+class Material;
 class Triangle;
 
 class Model
 {
+	inline static int _nextAvailableId = 0;
+
+	int _id = _nextAvailableId++; // never reused, unlike the address of a destroyed model
 	std::string _path;
 	std::vector<BaseTriangle*> _baseTriangles;
+	std::vector<BaseTriangle> _triangleStorage;
+
+	// Entries of the OBJ material library, referenced per triangle. Their Materials and textures
+	// are only created once a mesh uses the model materials
+	struct LibraryMaterial
+	{
+		Color color;
+		Color specColor;
+		Color emission;
+		float roughness;
+		float opacity;
+		std::filesystem::path texturePath;
+		std::filesystem::path opacityTexturePath;
+	};
+	std::vector<LibraryMaterial> _library;
+	std::vector<Material*> _materials;
 
 	int _triStartIndex = -1;
 	int _bvhRootNode = -1;
 
+	glm::vec3 _boundsMin = glm::vec3(0);
+	glm::vec3 _boundsMax = glm::vec3(0);
+
 	Model(const std::filesystem::path& path);
 	void parse(const std::filesystem::path& path);
 	void parseRapidobj(const std::filesystem::path& path);
@@ -29,10 +53,17 @@ public:
 
 	~Model();
 
-	std::vector<BaseTriangle*> baseTriangles() const { return _baseTriangles; }
+	int id() const { return _id; }
+	const std::vector<BaseTriangle*>& baseTriangles() const { return _baseTriangles; }
+	const std::vector<Material*>& materials() const { return _materials; }
+	bool hasMaterialLibrary() const { return !_library.empty(); }
+	bool hasEmissiveMaterial() const;
 	int bvhRootNode() const { return _bvhRootNode; }
+	glm::vec3 boundsMin() const { return _boundsMin; }
+	glm::vec3 boundsMax() const { return _boundsMax; }
 
 	void setBvhRootNode(int bvhRootNode);
+	void loadMaterials();
 
 	int triStartIndex() const { return _triStartIndex;  }
 
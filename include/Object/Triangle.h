@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <vector>
 
 #include "BVH.h"
@@ -17,15 +18,21 @@ struct Vertex
 
 class BaseTriangle
 {
-	std::vector<Vertex> _vertices;
+	std::array<Vertex, 3> _vertices;
 	glm::vec3 _localNormal;
+	int _materialIndex = -1; // index into the model materials
 
 public:
-	BaseTriangle(Vertex v1, Vertex v2, Vertex v3);
+	BaseTriangle() = default;
+	BaseTriangle(const Vertex& v1, const Vertex& v2, const Vertex& v3);
 
-	std::vector<Vertex>& vertices() { return _vertices; }
+	std::array<Vertex, 3>& vertices() { return _vertices; }
+	int materialIndex() const { return _materialIndex; }
+
+	void setMaterialIndex(int materialIndex) { _materialIndex = materialIndex; }
 
 	void setUVs(glm::vec2 uv1, glm::vec2 uv2, glm::vec2 uv3);
+	void updateNormals();
 };
 
 class Triangle
@@ -43,7 +50,7 @@ public:
 	Triangle(BaseTriangle* baseTri, Mesh* mesh);
 
 	BaseTriangle* baseTriangle() const { return _baseTriangle; }
-	std::vector<Vertex>& vertices() const { return _baseTriangle->vertices(); }
+	std::array<Vertex, 3>& vertices() const { return _baseTriangle->vertices(); }
 	Mesh* mesh() const { return _mesh; }
 
 	//std::vector<glm::vec3>& globalVertPositions() { return _globalVertPositions; }
@@ -1,12 +1,19 @@
 // ReSharper disable CppInconsistentNaming
 #pragma once
 
+#include <unordered_map>
+
 #include "Utils.h"
 #include "glm/mat4x4.hpp"
 #include "glm/vec2.hpp"
 #include "glm/vec3.hpp"
 #include "glm/vec4.hpp"
 #include "GLObject.h"
+#include "ShaderProgram.h"
+#include "TrackedBuffer.h"
+
+class Material;
+class Texture;
 
 enum class BufferType
 {
@@ -18,32 +25,68 @@ enum class BufferType
 	Triangles = 16,
 };
 
+// Sections of the scene tables buffer, in the order of the SCENE_TABLE_ defines in common.glsl
+enum class SceneTable
+{
+	LightAliases = 0,
+	ObjectLightIndices = 1,
+	TriangleAlphaFlags = 2,
+	AlphaMasks = 3,
+	BVHLinks6 = 4,
+	EnvMapDistribution = 5,
+	Count = 6,
+};
+
 class BufferController
 {
 	static constexpr int TEXTURE_ALIGN = 4;
 	static constexpr int LIGHT_ALIGN = 12;
 	static constexpr int MATERIAL_ALIGN = 20;
-	static constexpr int OBJECT_ALIGN = 28;
+	static constexpr int OBJECT_ALIGN = 48;
 	static constexpr int TRIANGLE_ALIGN = 28;
+	static constexpr int TRIANGLE_RECORD_ALIGN = 12;
 	static constexpr int BVH_NODE_ALIGN = 16;
+	static constexpr int BVH_LINKS6_ALIGN = 8;
 	static constexpr int PRIM_OBJ_INDICES_ALIGN = 1;
 
+	static constexpr int ENV_MAP_DISTRIBUTION_MAX_WIDTH = 1024;
+	static constexpr int ENV_MAP_DISTRIBUTION_MAX_HEIGHT = 512;
+	static constexpr int ALPHA_MASK_MAX_SIZE = 1024;
+	static constexpr float ALPHA_MASK_THRESHOLD = 0.5f;
+
 	static constexpr int UBO_TEXTURES_SIZE = 5000;
-	static constexpr int UBO_LIGHTS_SIZE = 5000;
+	static constexpr size_t STAGING_FRAME_SIZE = 4 << 20;
+
+	static constexpr float PLANE_BOUNDS_EXTENT = 1e30f;
+	static constexpr int SHADER_GROUP_SIZE = 64;
 
 	inline static UPtr<UBO> _uboTextures;
 	inline static UPtr<SSBO> _uboMaterials;
-	inline static UPtr<UBO> _uboLights;
+	inline static UPtr<SSBO> _ssboLights;
 	inline static UPtr<SSBO> _ssboObjects;
 	inline static UPtr<SSBO> _ssboTriangles;
+	inline static UPtr<SSBO> _ssboTriangleRecords;
 	inline static UPtr<SSBO> _ssboBVHNodes;
 	inline static UPtr<SSBO> _ssboPrimObjIndices;
+	inline static UPtr<SectionedSSBO> _ssboSceneTables;
+
+	inline static UPtr<ComputeShaderProgram> _triangleRecordsProgram;
+
+	inline static UPtr<StagingBuffer> _staging;
+	inline static size_t _uploadedBytes = 0;
+	inline static size_t _lastFrameUploadedBytes = 0;
 
 	inline static BufferType _buffersForUpdate;
 	inline static int _lastPrimObjCount;
+	inline static int _sceneLightCount = 0;
 
 	inline static int _bvhRootNode;
 
+	// Masks are appended once per opacity texture, keyed by texture id
+	inline static std::vector<uint32_t> _alphaMaskData;
+	inline static std::unordered_map<int, int> _alphaMaskOffsets;
+	inline static std::vector<bool> _alphaMaterials;
+
 	static void init();
 
 	static void checkIfBufferUpdateRequired();
@@ -56,19 +99,28 @@ public:
 
 	static UPtr<UBO>& uboTexInfos() { return _uboTextures; }
 	static UPtr<SSBO>& uboMaterials() { return _uboMaterials; }
-	static UPtr<UBO>& uboLights() { return _uboLights; }
+	static UPtr<SSBO>& ssboLights() { return _ssboLights; }
 	static UPtr<SSBO>& ssboObjects() { return _ssboObjects; }
 	static UPtr<SSBO>& ssboTriangles() { return _ssboTriangles; }
+	static UPtr<SSBO>& ssboTriangleRecords() { return _ssboTriangleRecords; }
 	static UPtr<SSBO>& ssboBVHNodes() { return _ssboBVHNodes; }
 	static UPtr<SSBO>& ssboPrimObjIndices() { return _ssboPrimObjIndices; }
+	static UPtr<SectionedSSBO>& ssboSceneTables() { return _ssboSceneTables; }
 
 	static float lastPrimObjCount() { return _lastPrimObjCount; }
+	// Scene::lights as of the last upload, they come first in the lights buffer
+	static int sceneLightCount() { return _sceneLightCount; }
+	static size_t lastFrameUploadedBytes() { return _lastFrameUploadedBytes; }
 
 	static void updateTextures();
 	static void updateMaterials();
 	static void updateLights();
 	static void updateObjects();
 	static void updateTriangles();
+	static void updateTriangleRecords();
+	static void updateTriangleAlphaFlags();
+	static bool updateAlphaMasks();
+	static void updateEnvMapDistribution();
 
 	static void setBVHRootNode(int bvhRootNode);
 	static int bvhRootNode() { return _bvhRootNode; }
@@ -99,9 +151,14 @@ private:
 		float opacity;
 		float windyScale = -1;
 		float windyStrength = -1;
-		glm::vec2 _pad;
+		int alphaMaskOffset = -1;
+		float _pad;
 	};
 
+	static MaterialStruct toMaterialStruct(const Material* mat);
+	static bool hasAlpha(const Material* mat);
+	static void appendAlphaMask(const Texture* tex);
+
 	struct LightStruct
 	{
 		glm::vec3 pos;
@@ -110,14 +167,28 @@ private:
 		glm::vec4 properties1;
 	};
 
-	struct ObjectStruct
+	struct LightAliasStruct
+	{
+		float prob;
+		int alias;
+		float pdf;
+		float _pad;
+	};
+
+	static std::vector<LightAliasStruct> buildLightAliasTable(const std::vector<float>& weights);
+
+	// Three cache lines, matrices are stored as rows of a 3x4 affine transform
+	struct alignas(64) ObjectStruct
 	{
 		int objType;
 		int materialId;
-		glm::vec2 _pad;
-		glm::vec4 pos;
-		glm::mat4x4 transform;
+		float radius;
+		int alphaTriangles;
 		glm::vec4 properties;
+		glm::vec4 toWorld[3];
+		glm::vec4 toLocal[3];
+		glm::vec4 normalToWorld[3]; // w: world AABB min
+		glm::vec4 boundsMax;
 	};
 
 	struct TriangleStruct
@@ -139,6 +210,16 @@ private:
 		glm::ivec4 values;
 		glm::ivec4 links;
 	};
+
+	inline static UPtr<TrackedBuffer<TextureStruct>> _textures;
+	inline static UPtr<TrackedBuffer<MaterialStruct>> _materials;
+	inline static UPtr<TrackedBuffer<LightStruct>> _lights;
+	inline static UPtr<TrackedBuffer<LightAliasStruct>> _lightAliases;
+	inline static UPtr<TrackedBuffer<float>> _objectLightIndices;
+	inline static UPtr<TrackedBuffer<ObjectStruct>> _objects;
+	inline static UPtr<TrackedBuffer<TriangleStruct>> _triangles;
+	inline static UPtr<TrackedBuffer<float>> _primObjIndices;
+	inline static UPtr<TrackedBuffer<uint32_t>> _triangleAlphaFlags;
 };
 
 inline BufferType operator|(BufferType a, BufferType b)
@@ -31,10 +31,11 @@ public:
 
 class GLBuffer : public GLObject
 {
+protected:
 	int _currBase = -1;
 
-protected:
 	GLBuffer();
+	~GLBuffer() override;
 
 	virtual void bind(int index) = 0;
 	void setDefaultBind(int index);
@@ -46,11 +47,11 @@ public:
 
 class GLBufferObject : public GLBuffer
 {
+protected:
 	GLenum _type;
 	int _align = -1;
 	int _capacity = -1;
 
-protected:
 	GLBufferObject(GLenum type, int align, int baseIndex = -1);
 
 public:
@@ -61,8 +62,13 @@ public:
 
 	void setDataCapacity(int capacity, GLenum type = GL_STATIC_DRAW);
 	void ensureDataCapacity(int capacity, GLenum type = GL_STATIC_DRAW);
+	void growDataCapacity(int capacity, GLenum type = GL_DYNAMIC_DRAW);
+	int capacity() const { return _capacity; }
+	int align() const { return _align; }
+
+	void clear(const void* data = nullptr, int offset = 0, int count = -1) const;
 
-	void clear(const void* data = nullptr) const;
+	void* mapStorage(GLbitfield access) const;
 
 	template <typename T>
 	std::vector<T> readData(int count) const;
@@ -83,6 +89,27 @@ public:
 };
 
 
+// Several tables in one SSBO, so together they take up a single shader storage block. It starts with the
+// offset of each section in uints, sections grow on their own and are moved on the GPU when the layout changes.
+class SectionedSSBO : public SSBO
+{
+	static constexpr int SECTION_ALIGN = 4;
+
+	std::vector<int> _offsets;
+	std::vector<int> _capacities;
+
+	int layout();
+
+public:
+	SectionedSSBO(int sectionCount, int baseIndex);
+
+	int offset(int section) const { return _offsets[section]; }
+
+	void ensureSectionCapacity(int section, int count);
+	void setSectionData(int section, const void* data, int count, int offset = 0) const;
+};
+
+
 class AtomicCounterBuffer : public GLBuffer
 {
 public:
@@ -92,6 +119,77 @@ public:
 };
 
 
+class PixelUnpackBuffer : public GLObject
+{
+	size_t _capacity = 0;
+
+public:
+	PixelUnpackBuffer();
+	~PixelUnpackBuffer() override;
+
+	void* map(size_t size);
+	void unmap() const;
+
+	void bind() const;
+	static void unbind();
+};
+
+
+// Fences of a ring of FRAME_COUNT slots in a persistently mapped buffer, a slot is written again once its fence signals
+class FencedRing
+{
+public:
+	static constexpr int FRAME_COUNT = 3;
+
+private:
+	GLsync _fences[FRAME_COUNT] {};
+	int _frame = 0;
+
+public:
+	FencedRing() = default;
+	FencedRing(const FencedRing&) = delete;
+	FencedRing& operator=(const FencedRing&) = delete;
+	~FencedRing();
+
+	int frame() const { return _frame; }
+	bool isPending(int slot) const { return _fences[slot] != nullptr; }
+
+	void submit();
+	bool complete(int slot, bool wait);
+
+	// Oldest first, so the newest finished slot is handled last
+	template <typename F>
+	void completeSlots(bool wait, F onComplete)
+	{
+		for (int i = 0; i < FRAME_COUNT; i++)
+		{
+			int slot = (_frame + i) % FRAME_COUNT;
+			if (complete(slot, wait))
+				onComplete(slot);
+		}
+	}
+};
+
+
+// Persistently mapped ring of FRAME_COUNT segments, a segment is reused once its fence signals
+class StagingBuffer : public GLObject
+{
+	static constexpr size_t COPY_ALIGN = 16;
+
+	size_t _frameSize;
+	char* _mapped = nullptr;
+	FencedRing _ring;
+	size_t _frameOffset = 0;
+
+public:
+	StagingBuffer(size_t frameSize);
+	~StagingBuffer() override;
+
+	bool copy(const GLBufferObject& dst, size_t dstOffset, const void* data, size_t size);
+	void nextFrame();
+};
+
+
 class GLTexture : public GLObject
 {
 public:
@@ -107,12 +205,19 @@ class GLTexture2D : public GLTexture
 
 public:
 	GLTexture2D(int width, int height, const void* data, GLenum format = GL_RGBA, GLenum internalFormat = GL_RGBA, GLenum filter = GL_LINEAR, GLenum type = GL_UNSIGNED_BYTE);
+	GLTexture2D(int width, int height, int levels, GLenum internalFormat);
+
+	int width() const { return _width; }
+	int height() const { return _height; }
 
 	template <typename T>
 	std::vector<T> readData() const;
 
 	uint64_t getHandle() const;
 	void setWrapMode(GLint wrapMode) const;
+	void setLevelData(int level, const void* data, GLenum format, GLenum type) const;
+	void bindImage(int unit, GLenum access, GLenum internalFormat) const;
+	void copyTo(const GLTexture2D& dst) const;
 };
 
 
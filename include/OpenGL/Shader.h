@@ -23,6 +23,7 @@ public:
 
 	void setBool(const std::string& name, bool value) const;
 	void setInt(const std::string& name, int value) const;
+	void setInt2(const std::string& name, glm::ivec2 value) const;
 	void setFloat(const std::string& name, float value) const;
 	void setFloat2(const std::string& name, glm::vec2 value) const;
 	void setFloat3(const std::string& name, glm::vec3 value) const;
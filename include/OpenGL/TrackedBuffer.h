@@ -0,0 +1,132 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "GLObject.h"
+
+// CPU mirror of a GL buffer or a section of one, elements are compared on write and only changed ranges are uploaded
+template <typename T>
+class TrackedBuffer
+{
+	static constexpr int WORD_BITS = 64;
+	static constexpr int MERGE_GAP = 8; // clean elements bridged to keep the copy count low
+
+	static_assert(sizeof(T) % sizeof(uint32_t) == 0);
+	static constexpr int SECTION_WORDS = sizeof(T) / sizeof(uint32_t);
+
+	GLBufferObject* _buffer;
+	SectionedSSBO* _sections = nullptr;
+	int _section = -1;
+	std::vector<T> _data;
+	std::vector<uint64_t> _dirty;
+
+public:
+	TrackedBuffer(GLBufferObject* buffer) : _buffer(buffer) {}
+	TrackedBuffer(SectionedSSBO* buffer, int section) : _buffer(buffer), _sections(buffer), _section(section) {}
+
+	int size() const { return _data.size(); }
+	const T& operator[](int index) const { return _data[index]; }
+
+	void resize(int count);
+	void set(int index, const T& value);
+	void assign(const std::vector<T>& values);
+	void markAllDirty();
+
+	size_t upload(StagingBuffer* staging);
+
+private:
+	bool isDirty(int index) const { return _dirty[index / WORD_BITS] >> (index % WORD_BITS) & 1; }
+};
+
+template <typename T> void TrackedBuffer<T>::resize(int count)
+{
+	int oldCount = _data.size();
+	_data.resize(count);
+	_dirty.resize((count + WORD_BITS - 1) / WORD_BITS);
+	if (_sections != nullptr)
+		_sections->ensureSectionCapacity(_section, count * SECTION_WORDS);
+	else
+		_buffer->growDataCapacity(count);
+
+	for (int i = oldCount; i < count; i++)
+		_dirty[i / WORD_BITS] |= 1ull << (i % WORD_BITS);
+}
+
+template <typename T> void TrackedBuffer<T>::set(int index, const T& value)
+{
+	if (memcmp(&_data[index], &value, sizeof(T)) == 0) return;
+
+	_data[index] = value;
+	_dirty[index / WORD_BITS] |= 1ull << (index % WORD_BITS);
+}
+
+template <typename T> void TrackedBuffer<T>::assign(const std::vector<T>& values)
+{
+	resize(values.size());
+
+	// Each iteration owns one dirty word, so the bitset needs no synchronization
+	int wordCount = _dirty.size();
+	#pragma omp parallel for
+	for (int w = 0; w < wordCount; w++)
+	{
+		uint64_t word = _dirty[w];
+		int end = std::min((w + 1) * WORD_BITS, (int)values.size());
+		for (int i = w * WORD_BITS; i < end; i++)
+		{
+			if (memcmp(&_data[i], &values[i], sizeof(T)) == 0) continue;
+
+			_data[i] = values[i];
+			word |= 1ull << (i % WORD_BITS);
+		}
+		_dirty[w] = word;
+	}
+}
+
+template <typename T> void TrackedBuffer<T>::markAllDirty()
+{
+	for (int i = 0; i < _data.size(); i++)
+		_dirty[i / WORD_BITS] |= 1ull << (i % WORD_BITS);
+}
+
+template <typename T> size_t TrackedBuffer<T>::upload(StagingBuffer* staging)
+{
+	size_t uploadedBytes = 0;
+	size_t baseOffset = _sections != nullptr ? _sections->offset(_section) * sizeof(uint32_t) : 0;
+	size_t unit = _buffer->align() * sizeof(float);
+	int count = _data.size();
+	int i = 0;
+	while (i < count)
+	{
+		// Skip clean words at once
+		if (_dirty[i / WORD_BITS] == 0)
+		{
+			i = (i / WORD_BITS + 1) * WORD_BITS;
+			continue;
+		}
+		if (!isDirty(i))
+		{
+			i++;
+			continue;
+		}
+
+		int start = i;
+		int end = i + 1;
+		for (int j = end; j < count && j <= end + MERGE_GAP; j++)
+		{
+			if (isDirty(j)) end = j + 1;
+		}
+
+		size_t bytes = (end - start) * sizeof(T);
+		size_t offset = baseOffset + start * sizeof(T);
+		if (staging == nullptr || !staging->copy(*_buffer, offset, &_data[start], bytes))
+			_buffer->setSubData((const float*)&_data[start], bytes / unit, offset / unit);
+		uploadedBytes += bytes;
+
+		i = end;
+	}
+
+	std::fill(_dirty.begin(), _dirty.end(), 0);
+	return uploadedBytes;
+}
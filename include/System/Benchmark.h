@@ -0,0 +1,87 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+#include <glm/vec3.hpp>
+
+#include "Renderer.h"
+
+// Renders through a list of configurations and logs a line per run. Timed runs average the GPU and CPU frame
+// time after a warm-up. Error runs trace a sample or GPU time budget and report the MSE against a reference
+// traced with many more samples, they need the accumulation of the normal build.
+class Benchmark
+{
+	static constexpr int WARMUP_FRAMES = 30;
+	static constexpr int MEASURED_FRAMES = 300;
+	static constexpr int TIMING_BOUNCES = 2;
+	static constexpr int BATCH_SPP = 16;
+
+	static constexpr int ERROR_SAMPLES = 64;
+	static constexpr int REFERENCE_SPP = 64;
+	static constexpr int REFERENCE_SAMPLES = 4096;
+	static constexpr float EQUAL_TIME_MS = 2000;
+
+	struct Settings
+	{
+		int spp;
+		int samplesPerInvocation;
+		int bounces;
+		BVHTraversalMode traversalMode;
+		bool triangleRecords;
+		bool occluderCache;
+		bool primaryCache;
+		bool rasterPrimary;
+		SamplerType samplerType;
+		bool restir;
+		bool radianceCache;
+		bool pathGuiding;
+		bool denoiser;
+		bool readStats; // reduces and reads back the image stats every frame, like the stats overlay does at its rate
+
+		static Settings current();
+		void apply() const;
+	};
+
+	struct Run
+	{
+		std::string name;
+		std::function<void(Settings&)> change;
+		int samples = 0; // traced until this many samples and compared to the reference
+		float time = 0; // traced for this much GPU time in ms and compared to the reference, timed when both are 0
+	};
+
+	inline static std::vector<Run> _runs;
+	inline static Settings _baseSettings;
+	inline static Settings _userSettings;
+	inline static Settings _runSettings;
+	inline static bool _quitWhenDone = false;
+
+	inline static int _runIndex = -1;
+	inline static int _frame = 0;
+	inline static float _frameTimeSum = 0;
+	inline static float _samplesPerSecondSum = 0;
+	inline static float _cpuFrameTimeSum = 0;
+	inline static std::chrono::steady_clock::time_point _lastUpdate;
+	inline static std::vector<glm::vec3> _reference;
+
+	static void update();
+
+	static void start(std::vector<Run> runs, const Settings& baseSettings, bool quitWhenDone);
+	static void startRun(int index);
+	static std::vector<glm::vec3> readMean();
+
+public:
+	static bool isRunning() { return _runIndex >= 0; }
+
+	// Traversal, intersection, caching, sampling and batching options against the defaults, then quits
+	static void runTimings();
+	// Equal sample error of each sampler in the current view, the camera has to stay still
+	static void compareSamplers();
+	// Equal time error of ReSTIR, the radiance cache and path guiding, and the cost of the denoiser
+	// and of reading back the image stats, in the current view
+	static void compareFeatures();
+
+	friend class Program;
+};
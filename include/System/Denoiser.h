@@ -0,0 +1,129 @@
+#pragma once
+
+#include <vector>
+#include <glm/mat4x4.hpp>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+#include "ShaderProgram.h"
+#include "Utils.h"
+
+class GLTexture2D;
+
+struct DenoiserCamera
+{
+	glm::vec3 pos;
+	glm::mat4 rot;
+	glm::vec2 viewSize;
+	float focalDistance;
+
+	static DenoiserCamera current();
+
+	bool operator==(const DenoiserCamera& other) const = default;
+};
+
+// Outputs of pathtracer.frag the filter is guided by, the mean and albedo are accumulated since the last reset.
+// The mean carries the second moment of luminance in alpha.
+struct DenoiserInputs
+{
+	GLTexture2D* mean;
+	GLTexture2D* albedo;
+	GLTexture2D* normalDepth;
+};
+
+// SVGF style denoiser, lighting is integrated over time through reprojection and then a-trous filtered.
+// History only changes when samples are reset, the accumulated mean takes over once the camera stops.
+// Inputs may only fill the lower left corner of the targets, the output covers the same region.
+class Denoiser
+{
+	static constexpr int SHADER_GROUP_SIZE = 16;
+	static constexpr int PASS_REPROJECT = 0;
+	static constexpr int PASS_COMBINE = 1;
+
+	static constexpr int ATROUS_ITERATIONS = 5;
+	static constexpr int MAX_HISTORY_SAMPLES = 32;
+	static constexpr int MIN_MOMENT_SAMPLES = 4;
+	static constexpr float DEPTH_TOLERANCE = 0.1f;
+	static constexpr float NORMAL_TOLERANCE = 0.9f;
+	static constexpr float SIGMA_NORMAL = 128;
+	static constexpr float SIGMA_DEPTH = 1;
+	static constexpr float SIGMA_LUMINANCE = 4;
+	static constexpr float ALBEDO_EPSILON = 0.001f;
+
+	inline static UPtr<ComputeShaderProgram> _temporalProgram;
+	inline static UPtr<ComputeShaderProgram> _atrousProgram;
+
+	inline static UPtr<GLTexture2D> _priorTex;
+	inline static UPtr<GLTexture2D> _historyTex;
+	inline static UPtr<GLTexture2D> _prevNormalDepthTex;
+	inline static UPtr<GLTexture2D> _filterTex[2];
+	inline static UPtr<GLTexture2D> _outputTex;
+
+	inline static glm::ivec2 _size;
+	inline static glm::ivec2 _prevSize;
+	inline static DenoiserCamera _prevCamera;
+	inline static bool _hasHistory = false;
+
+	static void init();
+	static void resize(glm::ivec2 size);
+	static void denoise(const DenoiserInputs& inputs, glm::ivec2 size, const DenoiserCamera& camera, int sampleCount, bool samplesReset);
+
+public:
+	static GLTexture2D* outputTexture() { return _outputTex.get(); }
+	static void resetHistory() { _hasHistory = false; }
+
+	friend class CpuDenoiser;
+	friend class Renderer;
+};
+
+struct DenoiserFrame
+{
+	glm::ivec2 size;
+	std::vector<glm::vec3> mean;
+	std::vector<float> lumSqr;
+	std::vector<glm::vec3> albedo;
+	std::vector<glm::vec4> normalDepth;
+	DenoiserCamera camera;
+	int sampleCount;
+	bool samplesReset;
+};
+
+// Reference of the compute passes on plain arrays, so the filter can be checked without a GL context
+class CpuDenoiser
+{
+	static constexpr glm::ivec2 CHECK_SIZE = {64, 48};
+	static constexpr float CHECK_TOLERANCE = 2.0f / 255;
+
+	glm::ivec2 _size = {0, 0};
+	glm::ivec2 _prevSize = {0, 0};
+	std::vector<glm::vec4> _prior;
+	std::vector<glm::vec4> _history;
+	std::vector<glm::vec4> _prevNormalDepth;
+	DenoiserCamera _prevCamera;
+	bool _hasHistory = false;
+
+	glm::vec4 reprojectHistory(const DenoiserFrame& frame, glm::ivec2 p) const;
+	std::vector<glm::vec4> combine(const DenoiserFrame& frame);
+	float getSampleVariance(const DenoiserFrame& frame, glm::ivec2 p, float weight) const;
+	std::vector<glm::vec4> filter(const DenoiserFrame& frame, const std::vector<glm::vec4>& input, int stepSize) const;
+
+	bool isInsideView(glm::ivec2 p) const { return isInside(p, _size); }
+	int pixelIndex(glm::ivec2 p) const { return p.y * _size.x + p.x; }
+
+	static bool isInside(glm::ivec2 p, glm::ivec2 size) { return p.x >= 0 && p.y >= 0 && p.x < size.x && p.y < size.y; }
+
+	static glm::vec3 demodulate(const glm::vec3& color, const glm::vec3& albedo);
+	static glm::vec3 remodulate(const glm::vec3& illumination, const glm::vec3& albedo);
+	static glm::vec3 getCameraRayDir(glm::vec2 pixelPos, glm::ivec2 size, const DenoiserCamera& camera);
+	static bool projectToPixel(const glm::vec3& dir, glm::ivec2 size, const DenoiserCamera& camera, glm::vec2& pixelPos);
+
+	static DenoiserFrame makeCheckFrame(const DenoiserCamera& camera, int sampleCount, bool samplesReset, int seed);
+
+public:
+	// Returns linear color, the GPU output is gamma corrected for display
+	std::vector<glm::vec3> denoise(const DenoiserFrame& frame);
+
+	// Runs a few synthetic frames through both the compute passes and this reference, and logs how far they differ
+	static void checkAgainstGpu();
+};
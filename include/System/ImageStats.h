@@ -0,0 +1,61 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <glm/vec2.hpp>
+
+#include "GLObject.h"
+#include "ShaderProgram.h"
+#include "Utils.h"
+
+class SSBO;
+
+struct ImageStatsResult
+{
+	static constexpr int HISTOGRAM_BINS = 64;
+
+	bool valid = false;
+	float meanVariance = 0;
+	float minLuminance = 0;
+	float maxLuminance = 0;
+	std::array<uint32_t, HISTOGRAM_BINS> histogram{};
+	glm::ivec2 tileCount = {0, 0};
+	std::vector<float> tileVariance;
+};
+
+// Reduces the accumulated moments on the GPU, results are read from a persistently mapped
+// buffer once their fence has passed, so asking for stats never flushes the pipeline
+class ImageStats
+{
+	static constexpr int GROUP_SIZE = 256;
+	static constexpr int FRAME_COUNT = FencedRing::FRAME_COUNT;
+	static constexpr int PASS_CLEAR = 0;
+	static constexpr int PASS_TILES = 1;
+	static constexpr int PASS_TOTAL = 2;
+
+	static constexpr int TILE_SIZE = 32;
+	static constexpr int MAX_TILES = 8192;
+	static constexpr float HISTOGRAM_MIN_LOG2 = -12;
+	static constexpr float HISTOGRAM_MAX_LOG2 = 4;
+
+	static constexpr int STATS_HEADER_SIZE = 4 + ImageStatsResult::HISTOGRAM_BINS;
+	static constexpr int SLOT_SIZE = STATS_HEADER_SIZE + MAX_TILES;
+
+	inline static UPtr<ComputeShaderProgram> _statsProgram;
+	inline static UPtr<SSBO> _statsSSBO;
+	inline static const uint32_t* _mappedStats;
+
+	inline static FencedRing _ring;
+	inline static glm::ivec2 _tileCounts[FRAME_COUNT];
+	inline static ImageStatsResult _latest;
+
+	static void init();
+	static void reduce(GLTexture2D* mean, glm::ivec2 size);
+	static void readSlot(int slot);
+
+public:
+	static void update();
+	static const ImageStatsResult& latest() { return _latest; }
+
+	friend class Renderer;
+};
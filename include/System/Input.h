@@ -23,6 +23,7 @@ class Input
 	inline static bool _mouseRightState = false;
 
 	inline static Sint8 _mouseWheelChange = 0;
+	inline static bool _cameraMoved = false;
 
 	static void update();
 	static void updateInputState();
@@ -41,6 +42,7 @@ public:
 
 	static glm::vec2 getSceneMousePos();
 	static float getMouseWheelChange();
+	static bool cameraMoved() { return _cameraMoved; }
 
 	friend class WindowDrawer;
 	friend class Program;
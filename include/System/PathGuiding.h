@@ -0,0 +1,91 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+#include "GLObject.h"
+#include "Utils.h"
+
+struct GuidingRecord
+{
+	glm::vec4 posWeight; // w: incident luminance over the pdf it was sampled with
+	glm::vec4 dir;
+};
+
+// Learns where incident radiance comes from, per cell of a grid over the region paths were recorded in,
+// as a histogram over an equal area mapping of the sphere. Records of sparse training paths are read back
+// once their fence has passed, binned on a worker thread and uploaded as cdfs whenever a new set is built.
+class PathGuiding
+{
+	static constexpr int FRAME_COUNT = FencedRing::FRAME_COUNT;
+	static constexpr int RECORD_CAPACITY = 1 << 16;
+	static constexpr int RECORD_RATIO = 8;
+	static constexpr int GRID_RESOLUTION = 16;
+	static constexpr int DIRECTION_RESOLUTION = 8;
+	static constexpr int BINS = DIRECTION_RESOLUTION * DIRECTION_RESOLUTION;
+	static constexpr float GRID_PADDING = 0.1f;
+	static constexpr int REBUILD_RECORDS = 1 << 18;
+	static constexpr float MIN_CELL_RECORDS = 32;
+	static constexpr float UNIFORM_FRACTION = 0.1f;
+	static constexpr float HISTORY_DECAY = 0.5f;
+	static constexpr float GUIDING_FRACTION = 0.5f;
+
+	// A count per frame slot in the first vec4, then two vec4s per record of each slot
+	static constexpr int RECORDS_SIZE = 1 + FRAME_COUNT * RECORD_CAPACITY * 2;
+	static constexpr GLbitfield RECORD_MAP_FLAGS = GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+	struct Distribution
+	{
+		glm::vec3 gridMin;
+		glm::vec3 gridSize;
+		std::vector<float> cdf;
+	};
+
+	inline static uint32_t* _mappedCounts = nullptr;
+	inline static const GuidingRecord* _mappedRecords;
+	inline static UPtr<SSBO> _distributionSSBO;
+	inline static FencedRing _ring;
+	inline static bool _recording = false;
+
+	inline static std::jthread _worker;
+	inline static std::mutex _mutex;
+	inline static std::condition_variable_any _recordsCondition;
+	inline static std::deque<std::vector<GuidingRecord>> _recordQueue;
+	inline static UPtr<Distribution> _builtDistribution;
+	inline static bool _resetRequested = false;
+
+	// Only touched by the worker
+	inline static std::vector<float> _histograms;
+	inline static std::vector<float> _cellRecords;
+	inline static glm::vec3 _gridMin = {0, 0, 0};
+	inline static glm::vec3 _gridSize = {0, 0, 0};
+	inline static glm::vec3 _recordMin, _recordMax;
+	inline static int _recordsSinceBuild = 0;
+
+	static void init();
+	static void quit();
+	static void update();
+	static void reset();
+
+	static void mapRecords(const SSBO* buffer);
+	static void beginFrame(bool record);
+	static void endFrame();
+	static void readSlot(int slot);
+
+	static void workerLoop(const std::stop_token& stopToken);
+	static void train(const std::vector<GuidingRecord>& records);
+	static void fitGrid();
+	static UPtr<Distribution> build();
+	static void upload(const Distribution& distribution);
+
+	static int getCellIndex(const glm::vec3& pos);
+	static int getBinIndex(const glm::vec3& dir);
+
+	friend class Program;
+	friend class Renderer;
+};
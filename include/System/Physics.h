@@ -1,5 +1,9 @@
 #pragma once
 
+#include <deque>
+#include <functional>
+
+#include "GLObject.h"
 #include "ShaderProgram.h"
 #include "Utils.h"
 
@@ -18,29 +22,81 @@ struct RaycastHit
 	bool hitLight;
 };
 
+struct RaycastQuery
+{
+	glm::vec3 pos;
+	glm::vec3 dir;
+	float maxDis = std::numeric_limits<float>::max();
+};
+
+using RaycastCallback = std::function<void(const std::vector<RaycastHit>& hits)>;
+
 class Physics
 {
+	static constexpr int MAX_BATCH_RAYS = 1 << 16;
+	static constexpr int FRAME_COUNT = FencedRing::FRAME_COUNT;
+	static constexpr int WORK_GROUP_SIZE = 64;
+	static constexpr float LIGHT_ICON_RADIUS = 1;
+
+	static constexpr int CHECK_GRID_SIZE = 128;
+	static constexpr int CHECK_LOGGED_MISMATCHES = 8;
+	static constexpr float CHECK_DISTANCE_TOLERANCE = 0.001f;
+
+	struct PendingRequest
+	{
+		std::vector<RaycastQuery> queries;
+		RaycastCallback callback;
+	};
+
+	struct SubmittedRequest
+	{
+		int first;
+		int count;
+		RaycastCallback callback;
+	};
+
 	inline static UPtr<ComputeShaderProgram> _raycastProgram;
+	inline static UPtr<SSBO> _querySSBO;
 	inline static UPtr<SSBO> _resultSSBO;
 
+	inline static void* _mappedQueries;
+	inline static const void* _mappedResults;
+
+	inline static std::deque<PendingRequest> _pendingRequests;
+	inline static FencedRing _ring;
+	inline static std::vector<SubmittedRequest> _submittedRequests[FRAME_COUNT];
+
 	static void init();
+	static void update();
+
+	static void dispatchPending();
+	static void readSlot(int slot);
+	static bool hitsAgree(const RaycastHit& a, const RaycastHit& b, const glm::vec3& origin);
 
 public:
 	static RaycastHit raycast(glm::vec3 pos, glm::vec3 dir, float maxDis = std::numeric_limits<float>::max());
+	static void raycastAsync(std::vector<RaycastQuery> queries, RaycastCallback callback);
+	static void flushRaycasts();
+
+	// Casts a grid of camera rays through raycast.comp and the CPU BVH, and logs where they disagree
+	static void checkCpuBVH();
 
 	friend class BufferController;
 	friend class Program;
 
 private:
+	struct RaycastQueryStruct
+	{
+		glm::vec4 posMaxDis;
+		glm::vec4 dir;
+	};
+
 	struct RaycastHitStruct
 	{
-		glm::vec3 pos;
-		float _pad1;
-		glm::vec3 normal;
-		float _pad2;
+		glm::vec4 posT;
+		glm::vec4 normalHitLight;
 		glm::vec2 uv;
 		int objIndex;
 		int triIndex;
-		bool hitLight;
 	};
 };
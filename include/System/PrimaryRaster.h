@@ -0,0 +1,33 @@
+#pragma once
+
+#include <glm/mat4x4.hpp>
+#include <glm/vec2.hpp>
+
+#include "ShaderProgram.h"
+#include "Utils.h"
+
+class GLTexture2D;
+class VAO;
+
+// Rasterizes the meshes into object and triangle ids per pixel, so primary rays of the
+// path tracer only intersect the triangle they already know instead of traversing the BVH
+class PrimaryRaster
+{
+	static constexpr float NEAR_PLANE = 0.01f;
+
+	inline static UPtr<DefaultShaderProgram<>> _rasterProgram;
+	inline static UPtr<VAO> _vao;
+	inline static UPtr<GLTexture2D> _hitTex;
+	inline static UPtr<GLTexture2D> _depthTex;
+	inline static GLuint _fbo = 0;
+
+	static void init();
+	static void resize(glm::ivec2 size);
+	static void draw(glm::ivec2 renderSize, glm::vec2 jitter);
+	static glm::mat4 getViewProjection(glm::ivec2 renderSize, glm::vec2 jitter);
+
+public:
+	static GLTexture2D* hitTexture() { return _hitTex.get(); }
+
+	friend class Renderer;
+};
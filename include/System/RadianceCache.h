@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+#include "ShaderProgram.h"
+#include "Utils.h"
+
+class SSBO;
+
+// Camera terms the level of detail of a cell follows
+struct RadianceCacheView
+{
+	glm::vec3 cameraPos;
+	float footprintScale; // cell size in pixels times the pixel footprint at unit distance
+
+	static RadianceCacheView current(glm::vec2 pixelSize);
+};
+
+struct RadianceCacheKey
+{
+	uint32_t hash;
+	uint32_t checksum;
+	float cellSize;
+
+	// Same key as getRadianceCacheHash in radiance_cache.glsl
+	static RadianceCacheKey get(const glm::vec3& pos, const glm::vec3& normal, const RadianceCacheView& view);
+};
+
+// World space hash grid of outgoing radiance at secondary bounces. Cells are trained by a sparse set
+// of full length paths during the frame and resolved into a running mean once the frame is traced.
+class RadianceCache
+{
+	static constexpr int GROUP_SIZE = 256;
+	static constexpr int CELL_ALIGN = 12;
+	static constexpr float MAX_HISTORY = 256;
+	static constexpr int MAX_AGE = 120;
+
+	inline static UPtr<ComputeShaderProgram> _resolveProgram;
+	inline static UPtr<SSBO> _cells;
+
+	static void init();
+	static void clear();
+	static void resolve(int frame);
+
+public:
+	static constexpr int CAPACITY = 1 << 19;
+	static constexpr int MAX_PROBES = 8;
+	static constexpr float MIN_SAMPLES = 4;
+	static constexpr float CELL_PIXELS = 8;
+	static constexpr float FIXED_SCALE = 1024;
+	static constexpr float MAX_RADIANCE = 64;
+
+	friend class CpuRadianceCache;
+	friend class Renderer;
+};
+
+// Reference of the cache on plain arrays, so it can be trained and queried without a GL context
+class CpuRadianceCache
+{
+	static constexpr int CHECK_GROUP_SIZE = 64;
+	static constexpr int CHECK_CELLS = 2048;
+	static constexpr int CHECK_SAMPLES_PER_CELL = 6;
+	static constexpr float CHECK_FOOTPRINT_SCALE = 0.01f;
+	static constexpr float CHECK_TOLERANCE = 1e-4f;
+	static constexpr int CHECK_LOGGED_MISMATCHES = 8;
+
+	struct Cell
+	{
+		uint32_t checksum = 0;
+		uint32_t lastFrame = 0;
+		glm::uvec3 accum = {0, 0, 0};
+		uint32_t accumCount = 0;
+		glm::vec3 radiance = {0, 0, 0};
+		float count = 0;
+	};
+
+	// Layout of a cell in the SSBO and of a sample of radiance_cache_train.comp
+	struct GpuCell
+	{
+		glm::uvec4 meta;
+		glm::uvec4 accum;
+		glm::vec4 radiance;
+	};
+	struct TrainingSample
+	{
+		glm::vec4 pos;
+		glm::vec4 normal;
+		glm::vec4 radiance;
+	};
+
+	std::vector<Cell> _cells;
+
+	int findCell(const RadianceCacheKey& key, bool insert);
+	int findCell(const RadianceCacheKey& key) const;
+
+	static std::vector<TrainingSample> makeCheckSamples(int seed);
+
+public:
+	CpuRadianceCache(int capacity = RadianceCache::CAPACITY);
+
+	void train(const glm::vec3& pos, const glm::vec3& normal, const RadianceCacheView& view, const glm::vec3& radiance);
+	bool lookup(const glm::vec3& pos, const glm::vec3& normal, const RadianceCacheView& view, glm::vec3& radiance, float& cellSize) const;
+	void resolve(int frame);
+	void clear();
+
+	// Trains the same points into both caches over a few frames and logs the cells they disagree on
+	static void checkAgainstGpu();
+};
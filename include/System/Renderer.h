@@ -1,17 +1,35 @@
 #pragma once
 
 #include "Color.h"
+#include "glm/mat4x4.hpp"
 #include "glm/vec2.hpp"
 #include "RaytraceShader.h"
 #include "ShaderProgram.h"
 #include "Utils.h"
 
 class GLFrameBuffer;
+class SSBO;
+class Texture;
+
+enum class BVHTraversalMode
+{
+	Links = 0,
+	Stack = 1,
+	SixSided = 2,
+};
+
+enum class SamplerType
+{
+	Random = 0,
+	Sobol = 1,
+	BlueNoise = 2,
+};
 
 class Renderer
 {
 	inline static bool _renderOneByOne = false;
 	inline static int _samplesPerPixel = 1;
+	inline static int _samplesPerInvocation = 1;
 	inline static bool _limitSamples = false;
 	inline static int _maxAccumSamples = 1000000;
 	inline static int _maxRayBounces = 6;
@@ -20,22 +38,54 @@ class Renderer
 
 	inline static bool _misSampleBrdf = true;
 	inline static bool _misSampleLight = true;
+	inline static BVHTraversalMode _bvhTraversalMode = BVHTraversalMode::Stack;
+	inline static bool _useTriangleRecords = true;
+	inline static bool _useOccluderCache = false;
+	inline static bool _usePrimaryCache = false;
+	inline static bool _useRasterPrimary = false;
+	inline static bool _useRestir = false;
+	inline static bool _useRadianceCache = false;
+	inline static bool _usePathGuiding = false;
+	inline static SamplerType _samplerType = SamplerType::Sobol;
+	inline static bool _useDenoiser = true;
+	inline static bool _dynamicResolution = true;
+	inline static int _previewBounces = 2;
+
+	inline static Texture* _envMap = nullptr;
 
 	inline static UPtr<DefaultShaderProgram<RaytraceShader>> _renderProgram;
 	inline static UPtr<GLFrameBuffer> _viewFBO;
 	inline static UPtr<GLTexture2D> _accumMeanTex;
-	inline static UPtr<GLTexture2D> _accumSqrTex;
-	inline static UPtr<GLTexture2D> _varianceTex;
+	inline static UPtr<GLTexture2D> _accumAlbedoTex;
+	inline static UPtr<GLTexture2D> _normalDepthTex;
+	inline static UPtr<SSBO> _occluderCache;
+	inline static UPtr<SSBO> _primaryCache;
+	inline static int _primaryCacheEpoch = 0;
+	inline static UPtr<SSBO> _frameRecords;
+	inline static bool _reservoirFlip = false;
 
 	inline static int _frame = 0;
 	inline static int _sampleFrame = 0;
 	inline static int _totalSamples = 0;
 	inline static float _renderTime = -1;
+	inline static float _samplesPerSecond = 0;
+	inline static glm::ivec2 _viewSize = {0, 0};
+
+	// Reduced resolution and bounces while the camera moves, the scale follows the frame time
+	inline static bool _isPreviewing = false;
+	inline static float _previewScale = 1;
+	inline static float _lastMotionTime = -1;
+	inline static glm::ivec2 _renderSize = {0, 0};
 
 	static void init();
 
 	static void render();
 	static void updateCameraUniforms();
+	static void rasterizePrimaryHits();
+	static void swapReservoirs();
+	static void updatePreview();
+	static void updatePreviewScale();
+	static void applyRenderSize();
 
 	static void resizeTextures(glm::ivec2 size);
 
@@ -43,40 +93,89 @@ public:
 	static bool renderOneByOne() { return _renderOneByOne; }
 	static bool limitSamples() { return _limitSamples; }
 	static int samplesPerPixel() { return _samplesPerPixel; }
+	static int samplesPerInvocation() { return _samplesPerInvocation; }
 	static int maxAccumSamples() { return _maxAccumSamples; }
 	static int maxRayBounces() { return _maxRayBounces; }
 	static float fogIntensity() { return _fogIntensity; }
 	static Color fogColor() { return _fogColor; }
 	static bool misSampleBrdf() { return _misSampleBrdf; }
 	static bool misSampleLight() { return _misSampleLight; }
+	static BVHTraversalMode bvhTraversalMode() { return _bvhTraversalMode; }
+	static bool useTriangleRecords() { return _useTriangleRecords; }
+	static bool useOccluderCache() { return _useOccluderCache; }
+	static bool usePrimaryCache() { return _usePrimaryCache; }
+	static bool useRasterPrimary() { return _useRasterPrimary; }
+	static bool useRestir() { return _useRestir; }
+	static bool useRadianceCache() { return _useRadianceCache; }
+	static bool usePathGuiding() { return _usePathGuiding; }
+	static SamplerType samplerType() { return _samplerType; }
+	static bool useDenoiser() { return _useDenoiser; }
+	static bool dynamicResolution() { return _dynamicResolution; }
+	static int previewBounces() { return _previewBounces; }
+	static bool isPreviewing() { return _isPreviewing; }
+	static glm::vec2 outputUvScale() { return glm::vec2(_renderSize) / glm::vec2(_viewSize); }
 	static int totalSamples() { return _totalSamples; }
+	static Texture* envMap() { return _envMap; }
 	static DefaultShaderProgram<RaytraceShader>* renderProgram() { return _renderProgram.get(); }
 	static GLFrameBuffer* sceneViewFBO() { return _viewFBO.get(); }
+	static GLTexture2D* outputTexture();
 
 	static float renderTime() { return _renderTime; }
+	static float samplesPerSecond() { return _samplesPerSecond; }
 
 	static void setLimitSamples(bool limit);
 	static void setSPP(int samples);
+	static void setSamplesPerInvocation(int samples);
 	static void setMaxAccumSamples(int maxAccumSamples);
 	static void setMaxRayBounces(int bounces);
 	static void setFogIntensity(float intensity);
 	static void setFogColor(Color color);
 	static void setMisSampleBrdf(bool doSample);
 	static void setMisSampleLight(bool doSample);
+	static void setBVHTraversalMode(BVHTraversalMode mode);
+	static void setUseTriangleRecords(bool useRecords);
+	static void setUseOccluderCache(bool useCache);
+	static void setUsePrimaryCache(bool useCache);
+	static void setUseRasterPrimary(bool useRaster);
+	static void setUseRestir(bool useRestir);
+	static void setUseRadianceCache(bool useCache);
+	static void setUsePathGuiding(bool useGuiding);
+	static void setSamplerType(SamplerType type);
+	static void setUseDenoiser(bool useDenoiser);
+	static void setDynamicResolution(bool dynamicResolution);
+	static void setPreviewBounces(int bounces);
+	static void setEnvMap(Texture* envMap, const glm::mat4& envMapToWorld);
 
 	static void resizeView(glm::ivec2 size);
 	static void resetSamples();
+	static void resetScene();
 
 	static float computeSampleVariance();
 
+	friend class Benchmark;
 	friend class Program;
 	friend class SDLHandler;
 
 private:
-	static constexpr GLenum DRAW_BUFFERS[] = {
-		GL_COLOR_ATTACHMENT0,
-		GL_COLOR_ATTACHMENT1,
-		GL_COLOR_ATTACHMENT2,
-		GL_COLOR_ATTACHMENT3
-	};
+	static constexpr int OCCLUDER_CACHE_ALIGN = 2;
+	static constexpr int PRIMARY_CACHE_ALIGN = 2;
+	static constexpr int PRIMARY_CACHE_POSITIONS = 8;
+	static constexpr int PRIMARY_CACHE_MAX_EPOCH = 255;
+
+	// Blocks of pathtracer.frag with its includes, Textures is a uniform block
+	static constexpr int FRAGMENT_STORAGE_BLOCKS = 14;
+
+	static constexpr int FRAME_RECORD_ALIGN = 4;
+	static constexpr int RESERVOIR_SIZE = 3;
+	static constexpr int RESTIR_CANDIDATES = 8;
+	static constexpr int RESTIR_SPATIAL_SAMPLES = 3;
+	static constexpr float RESTIR_SPATIAL_RADIUS = 16;
+	static constexpr float RESTIR_MAX_HISTORY = 20;
+
+	static constexpr int RADIANCE_CACHE_TRAINING_RATIO = 16;
+
+	static constexpr float PREVIEW_TARGET_FRAME_TIME = 1000.0f / 30;
+	static constexpr float PREVIEW_MIN_SCALE = 0.25f;
+	static constexpr float PREVIEW_MAX_SCALE_STEP = 1.25f;
+	static constexpr float PREVIEW_STILL_DELAY = 0.2f;
 };
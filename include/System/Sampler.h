@@ -0,0 +1,34 @@
+#pragma once
+
+#include <vector>
+
+#include "Utils.h"
+
+class GLTexture2D;
+class SSBO;
+
+// Tables for the low-discrepancy samplers in sampler.glsl, generated and uploaded once
+class Sampler
+{
+	static constexpr int SOBOL_DIMENSIONS = 2;
+	static constexpr int SOBOL_BITS = 32;
+
+	static constexpr int BLUE_NOISE_SIZE = 64;
+	static constexpr float BLUE_NOISE_SIGMA = 1.5f;
+	static constexpr float BLUE_NOISE_INITIAL_DENSITY = 0.1f;
+	static constexpr int BLUE_NOISE_SEED = 1234;
+
+	inline static UPtr<SSBO> _sobolDirections;
+	inline static UPtr<GLTexture2D> _blueNoiseTexture;
+
+	static void init();
+
+	static std::vector<uint32_t> generateSobolDirections();
+	static std::vector<float> generateBlueNoise();
+
+public:
+	static SSBO* sobolDirections() { return _sobolDirections.get(); }
+	static GLTexture2D* blueNoiseTexture() { return _blueNoiseTexture.get(); }
+
+	friend class Renderer;
+};
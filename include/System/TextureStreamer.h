@@ -0,0 +1,44 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "GLObject.h"
+#include "Utils.h"
+
+class Texture;
+
+class TextureStreamer
+{
+	static constexpr size_t UPLOAD_BUDGET_BYTES = 32 * 1024 * 1024;
+
+	inline static std::vector<std::jthread> _workers;
+	inline static std::mutex _mutex;
+	inline static std::condition_variable_any _decodeCondition;
+	inline static std::condition_variable _decodedCondition;
+	inline static std::deque<Texture*> _decodeQueue;
+	inline static std::deque<Texture*> _uploadQueue;
+
+	inline static UPtr<GLTexture2D> _placeholderTex;
+	inline static UPtr<PixelUnpackBuffer> _pbo;
+
+	static void init();
+	static void quit();
+	static void update();
+
+	static void workerLoop(const std::stop_token& stopToken);
+	static void upload(const std::vector<Texture*>& textures);
+
+public:
+	static void request(Texture* tex);
+	static void finish(Texture* tex);
+	static void cancel(Texture* tex);
+
+	static uint64_t placeholderHandle();
+	static int pendingCount();
+
+	friend class Program;
+};
@@ -102,4 +102,5 @@ namespace ImGui
 	bool LabeledSliderInt(const char* label, int& value, int min, int max, int flags = 0, const char* format = "%d");
 	bool LabeledSliderFloat(const char* label, float& value, float min, float max, int flags = 0, const char* format = "%.3f");
 	bool LabeledCheckbox(const char* label, bool& value, int flags = 0);
+	bool LabeledCombo(const char* label, int& value, const char* items, int flags = 0);
 }
@@ -2,6 +2,7 @@
 
 #include <string>
 
+#include "glm/mat4x4.hpp"
 #include "glm/vec2.hpp"
 #include "glm/vec3.hpp"
 #include "glm/gtx/dual_quaternion.hpp"
@@ -52,6 +53,8 @@ public:
 	static float det(const glm::vec3& v1, const glm::vec3& v2, const glm::vec3& v3);
 	static bool solveQuadratic(float a, float b, float c, float& x0, float& x1);
 	static float getLengthSquared(glm::vec3 v);
+	static float luminance(const glm::vec3& color);
+	static void transformBounds(const glm::mat4& transform, const glm::vec3& localMin, const glm::vec3& localMax, glm::vec3& min, glm::vec3& max);
 
 	static float random(float min, float max);
 
@@ -82,16 +82,20 @@ struct Material
     float opacity;
     float windyScale;
     float windyStrength;
+    int alphaMaskOffset; // -1 without an opacity texture mask
 };
 
 struct Object
 {
     int objType;
     int materialIndex;
-    vec2 _pad;
-    vec4 pos;
-    mat4x4 transform;
-    vec4 properties;
+    float radius; // world space radius of spheres and disks
+    int alphaTriangles; // mesh has model material triangles that need alpha testing
+    vec4 properties; // mesh: triStart, triCount, bvhRoot, useTriMaterials
+    vec4 toWorld[3]; // rows of the object to world 3x4 matrix
+    vec4 toLocal[3]; // rows of the world to object 3x4 matrix
+    vec4 normalToWorld[3]; // rows of the normal matrix, w is the world AABB min
+    vec4 boundsMax; // world AABB max
 };
 
 struct Vertex
@@ -103,7 +107,13 @@ struct Vertex
 struct Triangle
 {
     Vertex vertices[3];
-    vec4 info; // materialIndex, meshIndex, interpolateNormals
+    vec4 info; // materialIndex (-1 for the object material), meshIndex, interpolateNormals
+};
+
+// Affine map into the unit triangle space, rows give u, v and the plane distance
+struct TriangleRecord
+{
+    vec4 rows[3];
 };
 
 struct BVHNode
@@ -114,6 +124,10 @@ struct BVHNode
     ivec4 links; // hit, miss, boxCalculated
 };
 
+// Per node: six miss links by ray direction (axis * 2 + positive), then near child flags
+#define BVH_LINKS6_STRIDE 8
+#define BVH_LINKS6_NEAR_FLAGS 6
+
 struct Ray
 {
     vec3 pos, dir;
@@ -139,9 +153,10 @@ layout(std140, binding = 2) /*buffer*/ uniform Materials
 };
 
 uniform int lightCount;
-layout(std140, binding = 3) uniform Lights
+uniform int envLightIndex = -1;
+layout(std140, binding = 3) /*buffer*/ uniform Lights
 {
-    Light lights[1];
+    Light lights[];
 };
 
 uniform int objectCount;
@@ -155,61 +170,83 @@ layout(std140, binding = 5) /*buffer*/ uniform Triangles
 {
     Triangle triangles[];
 };
+// Intersection only copy of the triangles, the full records are read for the final hit
+uniform bool useTriangleRecords = true;
+layout(std430, binding = 17) /*buffer*/ uniform TriangleRecords
+{
+    TriangleRecord triangleRecords[];
+};
 
-Material findMaterial(int id)
+// Small tables share one buffer, so the pathtracer stays within the storage block limit of the fragment
+// stage. It starts with the offset of each section, sections are:
+// - light aliases: prob, alias, pdf and padding per light, power weighted light selection
+// - object light indices: first light index of an emissive object as a float, -1 otherwise
+// - triangle alpha flags: one bit per triangle whose own material needs alpha testing
+// - alpha masks: per opacity texture width, height, then one bit per texel, rows packed
+// - BVH links6: BVH_LINKS6_STRIDE ints per node
+// - env map distribution: marginal cdf, conditional cdfs, pdf over uv as floats
+#define SCENE_TABLE_LIGHT_ALIASES 0
+#define SCENE_TABLE_OBJECT_LIGHT_INDICES 1
+#define SCENE_TABLE_TRIANGLE_ALPHA_FLAGS 2
+#define SCENE_TABLE_ALPHA_MASKS 3
+#define SCENE_TABLE_BVH_LINKS6 4
+#define SCENE_TABLE_ENV_MAP_DISTRIBUTION 5
+layout(std430, binding = 12) /*buffer*/ uniform SceneTables
 {
-    int left = 0;
-    int right = materialCount - 1;
+    uint sceneTables[];
+};
 
-    while (left <= right)
+uint getSceneTable(int section, int index)
+{
+    return sceneTables[int(sceneTables[section]) + index];
+}
+
+// Triangles of meshes using their model materials carry a material slot
+Material getObjMaterial(Object obj, int triIndex)
+{
+    if (triIndex != -1 && obj.properties.w != 0)
     {
-        int split = (left + right) / 2;
-        int splitVal = materials[split].id;
-
-        if (splitVal < id)
-            left = split + 1;
-        else if (splitVal > id)
-            right = split - 1;
-        else
-            return materials[split];
+        int triMaterial = int(triangles[triIndex].info.x);
+        if (triMaterial != -1) return materials[triMaterial];
     }
-    return materials[0];
+    return materials[obj.materialIndex];
 }
 
-// Material findMaterial(int id)
-// {
-//     for (int i = 0; i < materialCount; i++)
-//     {
-//         if (materials[i].id == id)
-//             return materials[i];
-//     }
-//     return materials[0];
-// }
-
 vec3 localToGlobal(vec3 pos, Object obj)
 {
-    return (obj.transform * vec4(pos, 1.0f)).xyz;
+    vec4 p = vec4(pos, 1.0f);
+    return vec3(dot(obj.toWorld[0], p), dot(obj.toWorld[1], p), dot(obj.toWorld[2], p));
 }
 vec3 globalToLocal(vec3 pos, Object obj)
 {
-    return (inverse(obj.transform) * vec4(pos, 1.0f)).xyz;
+    vec4 p = vec4(pos, 1.0f);
+    return vec3(dot(obj.toLocal[0], p), dot(obj.toLocal[1], p), dot(obj.toLocal[2], p));
 }
 
 vec3 localToGlobalDir(vec3 dir, Object obj)
 {
-    return normalize((obj.transform * vec4(dir, 0.0f)).xyz);
+    return normalize(vec3(dot(obj.toWorld[0].xyz, dir), dot(obj.toWorld[1].xyz, dir), dot(obj.toWorld[2].xyz, dir)));
 }
 vec3 globalToLocalDir(vec3 dir, Object obj)
 {
-    return normalize((inverse(obj.transform) * vec4(dir, 0.0f)).xyz);
+    return normalize(vec3(dot(obj.toLocal[0].xyz, dir), dot(obj.toLocal[1].xyz, dir), dot(obj.toLocal[2].xyz, dir)));
+}
+vec3 localToGlobalNormal(vec3 normal, Object obj)
+{
+    return normalize(vec3(dot(obj.normalToWorld[0].xyz, normal), dot(obj.normalToWorld[1].xyz, normal), dot(obj.normalToWorld[2].xyz, normal)));
 }
 
-vec3 getTransformScale(mat4x4 mat)
+vec3 getObjPos(Object obj)
 {
-    vec3 scale;
-    for (int i = 0; i < 3; i++)
-        scale[i] = sqrt(mat[i][0] * mat[i][0] + mat[i][1] * mat[i][1] + mat[i][2] * mat[i][2]);
-    return scale;
+    return vec3(obj.toWorld[0].w, obj.toWorld[1].w, obj.toWorld[2].w);
+}
+vec3 getObjBoundsMin(Object obj)
+{
+    return vec3(obj.normalToWorld[0].w, obj.normalToWorld[1].w, obj.normalToWorld[2].w);
+}
+vec3 getObjBoundsMax(Object obj)
+{
+    return obj.boundsMax.xyz;
 }
 
 mat4x4 getTransformRotation(mat4x4 mat)
@@ -228,12 +265,9 @@ void calcGlobalTriVertices(Triangle tri, Object obj, out vec3 p0, out vec3 p1, o
     p2 = localToGlobal(tri.vertices[2].posU.xyz, obj);
 }
 
-Light findTriLight(int triIndex)
+int getObjLightIndex(int objIndex, int triIndex)
 {
-    for (int i = 0; i < lightCount; i++)
-    {
-        if (lights[i].lightType == LIGHT_TYPE_TRIANGLE && int(lights[i].properties1.x) == triIndex)
-            return lights[i];
-    }
-    return lights[0];
+    int lightIndex = int(uintBitsToFloat(getSceneTable(SCENE_TABLE_OBJECT_LIGHT_INDICES, objIndex)));
+    if (lightIndex == -1 || triIndex == -1) return lightIndex;
+    return lightIndex + triIndex - int(objects[objIndex].properties.x);
 }
@@ -0,0 +1,46 @@
+// --- Denoiser ---
+// Lighting is filtered demodulated by the first bounce albedo, so textures stay sharp
+
+#define DENOISE_GROUP_SIZE 16
+
+// Size of the active region, previews only fill the lower left corner of the targets
+uniform vec2 pixelSize;
+uniform float albedoEpsilon;
+
+vec3 demodulate(vec3 color, vec3 albedo)
+{
+    return color / max(albedo, vec3(albedoEpsilon));
+}
+vec3 remodulate(vec3 illumination, vec3 albedo)
+{
+    return illumination * max(albedo, vec3(albedoEpsilon));
+}
+
+bool isInside(ivec2 p, vec2 size)
+{
+    return all(greaterThanEqual(p, ivec2(0))) && all(lessThan(p, ivec2(size)));
+}
+bool isInsideView(ivec2 p)
+{
+    return isInside(p, pixelSize);
+}
+
+// Camera ray through a pixel position, as traced in pathtracer.frag
+vec3 getCameraRayDir(vec2 pixelPos, mat3 rot, vec2 viewSize, float focalDistance)
+{
+    vec3 lb = focalDistance * rot[2] - 0.5 * viewSize.x * rot[0] - 0.5 * viewSize.y * rot[1];
+    vec2 pos = pixelPos / pixelSize * viewSize;
+    return normalize(lb + pos.x * rot[0] + pos.y * rot[1]);
+}
+// Inverse of getCameraRayDir, fails behind the camera
+bool projectToPixel(vec3 dir, mat3 rot, vec2 viewSize, float focalDistance, vec2 size, out vec2 pixelPos)
+{
+    float z = dot(dir, rot[2]);
+    pixelPos = vec2(0);
+    if (z <= 0) return false;
+
+    vec2 pos = vec2(dot(dir, rot[0]), dot(dir, rot[1])) * focalDistance / z + 0.5 * viewSize;
+    pixelPos = pos / viewSize * size;
+    return true;
+}
+// --- Denoiser ---
@@ -0,0 +1,76 @@
+// --- Radiance cache ---
+// World space hash grid of outgoing radiance. Training paths add their radiance as fixed point,
+// so it can be summed with atomics, and the resolve pass folds each frame into a running mean.
+
+#define RADIANCE_CACHE_FIXED_SCALE 1024.0
+#define RADIANCE_CACHE_MAX_RADIANCE 64.0
+#define RADIANCE_CACHE_MAX_PROBES 8
+#define RADIANCE_CACHE_MIN_SAMPLES 4
+
+uniform int radianceCacheCapacity;
+
+struct RadianceCell
+{
+    uvec4 meta;     // x: checksum, 0 when empty, y: last trained frame
+    uvec4 accum;    // rgb: radiance trained this frame, w: samples
+    vec4 radiance;  // rgb: mean radiance, w: samples it holds
+};
+layout(std430, binding = 25) /*buffer*/ uniform RadianceCache
+{
+    RadianceCell radianceCells[];
+};
+
+// Largest axis of the normal with its sign
+uint getNormalBucket(vec3 N)
+{
+    vec3 a = abs(N);
+    uint axis = a.x > a.y && a.x > a.z ? 0u : a.y > a.z ? 1u : 2u;
+    return axis * 2u + (N[axis] < 0 ? 1u : 0u);
+}
+// The level of detail follows the footprint of the cell pixels at P, footprintScale is that footprint at unit distance
+uint getRadianceCacheHash(vec3 P, vec3 N, vec3 viewPos, float footprintScale, out uint checksum, out float cellSize)
+{
+    float footprint = footprintScale * distance(viewPos, P);
+    int lod = int(ceil(log2(max(footprint, 1e-6))));
+    cellSize = exp2(float(lod));
+    ivec3 cell = ivec3(floor(P / cellSize));
+
+    uint hash = hashUint(uint(cell.x));
+    hash = hashCombine(hash, hashUint(uint(cell.y)));
+    hash = hashCombine(hash, hashUint(uint(cell.z)));
+    hash = hashCombine(hash, hashUint(uint(lod) << 3 | getNormalBucket(N)));
+    checksum = max(hashUint(hash ^ 0x9e3779b9u), 1u);
+    return hash;
+}
+
+// Lookups probe the whole range, evicted cells leave holes in it
+int findRadianceCell(uint hash, uint checksum, bool insert)
+{
+    for (int i = 0; i < RADIANCE_CACHE_MAX_PROBES; i++)
+    {
+        int index = int((hash + uint(i)) % uint(radianceCacheCapacity));
+        uint stored = radianceCells[index].meta.x;
+        if (stored == checksum) return index;
+        if (stored != 0 || !insert) continue;
+
+        stored = atomicCompSwap(radianceCells[index].meta.x, 0u, checksum);
+        if (stored == 0 || stored == checksum) return index;
+    }
+    return -1;
+}
+
+bool lookupRadianceCache(int cellIndex, out vec3 radiance)
+{
+    vec4 cached = radianceCells[cellIndex].radiance;
+    radiance = cached.rgb;
+    return cached.w >= RADIANCE_CACHE_MIN_SAMPLES;
+}
+void trainRadianceCache(int cellIndex, vec3 radiance)
+{
+    uvec3 fixedRadiance = uvec3(clamp(radiance, 0, RADIANCE_CACHE_MAX_RADIANCE) * RADIANCE_CACHE_FIXED_SCALE);
+    atomicAdd(radianceCells[cellIndex].accum.r, fixedRadiance.r);
+    atomicAdd(radianceCells[cellIndex].accum.g, fixedRadiance.g);
+    atomicAdd(radianceCells[cellIndex].accum.b, fixedRadiance.b);
+    atomicAdd(radianceCells[cellIndex].accum.w, 1u);
+}
+// --- Radiance cache ---
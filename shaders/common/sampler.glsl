@@ -0,0 +1,114 @@
+// --- Sampler ---
+// Every random decision owns a dimension, (bounce + 1) * SAMPLE_DECISION_COUNT + decision,
+// and receives its own padded 2D point, so decisions never share a sequence.
+// Decisions repeated within a bounce, like ReSTIR candidates, keep the repetition in the upper bits.
+
+#define SAMPLER_RANDOM 0
+#define SAMPLER_SOBOL 1
+#define SAMPLER_BLUE_NOISE 2
+
+#define SAMPLE_CAMERA 0
+#define SAMPLE_LIGHT_SELECT 0
+#define SAMPLE_LIGHT_POS 1
+#define SAMPLE_BSDF_LOBE 2
+#define SAMPLE_BSDF_DIR 3
+#define SAMPLE_RUSSIAN_ROULETTE 4
+#define SAMPLE_RESTIR_LIGHT_SELECT 5
+#define SAMPLE_RESTIR_LIGHT_POS 6
+#define SAMPLE_RESTIR_RESAMPLE 7
+#define SAMPLE_RESTIR_SPATIAL 8
+#define SAMPLE_DECISION_COUNT 9
+#define SAMPLE_REPEAT_SHIFT 16
+
+#define SOBOL_BITS 32
+#define BLUE_NOISE_SIZE 64
+
+uniform int samplerType = SAMPLER_SOBOL;
+uniform sampler2D blueNoiseTexture;
+
+layout(std430, binding = 16) /*buffer*/ uniform SobolDirections
+{
+    uint sobolDirections[];
+};
+
+uint samplerPixelSeed;
+uint samplerIndex;
+
+void InitSampler(ivec2 pixel, int sampleIndex)
+{
+    samplerPixelSeed = hashUint(uint(pixel.x) | uint(pixel.y) << 16);
+    samplerIndex = uint(sampleIndex);
+}
+
+uint sobol(uint index, int dim)
+{
+    uint x = 0;
+    for (int bit = 0; index != 0; bit++, index >>= 1)
+    {
+        if ((index & 1u) != 0)
+            x ^= sobolDirections[dim * SOBOL_BITS + bit];
+    }
+    return x;
+}
+
+// Hash-based Owen scrambling (Burley 2020)
+uint laineKarrasPermutation(uint x, uint seed)
+{
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+uint nestedUniformScramble(uint x, uint seed)
+{
+    x = bitfieldReverse(x);
+    x = laineKarrasPermutation(x, seed);
+    return bitfieldReverse(x);
+}
+
+vec2 sampleSobol2D(uint dim)
+{
+    // The index is shuffled per dimension, which decorrelates the padded pairs
+    uint seed = hashCombine(samplerPixelSeed, hashUint(dim));
+    uint index = nestedUniformScramble(samplerIndex, hashCombine(seed, 0u));
+    uint x = nestedUniformScramble(sobol(index, 0), hashCombine(seed, 1u));
+    uint y = nestedUniformScramble(sobol(index, 1), hashCombine(seed, 2u));
+    return vec2(x >> 8, y >> 8) / float(1 << 24);
+}
+
+// R2 rank-1 lattice over samples, rotated per pixel by the blue noise mask
+vec2 sampleBlueNoise2D(uint dim)
+{
+    uint offset = hashUint(dim);
+    ivec2 texelX = (pixel + ivec2(offset & 63u, offset >> 8 & 63u)) % BLUE_NOISE_SIZE;
+    ivec2 texelY = (pixel + ivec2(offset >> 16 & 63u, offset >> 24 & 63u)) % BLUE_NOISE_SIZE;
+    vec2 mask = vec2(texelFetch(blueNoiseTexture, texelX, 0).r, texelFetch(blueNoiseTexture, texelY, 0).r);
+    return fract(mask + float(samplerIndex) * vec2(0.7548776662, 0.5698402910));
+}
+
+vec2 sample2D(int bounce, int decision, int repeat)
+{
+    uint dim = uint((bounce + 1) * SAMPLE_DECISION_COUNT + decision) | uint(repeat) << SAMPLE_REPEAT_SHIFT;
+    if (samplerType == SAMPLER_SOBOL)
+        return sampleSobol2D(dim);
+    if (samplerType == SAMPLER_BLUE_NOISE)
+        return sampleBlueNoise2D(dim);
+    return vec2(rand(), rand());
+}
+vec2 sample2D(int bounce, int decision)
+{
+    return sample2D(bounce, decision, 0);
+}
+float sample1D(int bounce, int decision, int repeat)
+{
+    if (samplerType == SAMPLER_RANDOM)
+        return rand();
+    return sample2D(bounce, decision, repeat).x;
+}
+float sample1D(int bounce, int decision)
+{
+    return sample1D(bounce, decision, 0);
+}
+// --- Sampler ---
@@ -30,6 +30,20 @@ void pcg4d(inout uvec4 v)
     v.w += v.y * v.z;
 }
 
+uint hashUint(uint x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+uint hashCombine(uint seed, uint v)
+{
+    return seed ^ (v + (seed << 6) + (seed >> 2));
+}
+
 float rand()
 {
     pcg4d(seed);
@@ -0,0 +1,86 @@
+// ----------- PATH GUIDING -----------
+// Incident radiance per cell of a grid over the trained region, as a histogram over an equal area
+// mapping of the sphere. Learned on the CPU from recorded path vertices, see PathGuiding.
+
+#define GUIDING_DIRECTION_RES 8
+#define GUIDING_BINS (GUIDING_DIRECTION_RES * GUIDING_DIRECTION_RES)
+#define GUIDING_TRAIN_VERTICES 4
+#define GUIDING_MIN_ROUGHNESS 0.1
+
+uniform bool usePathGuiding = false;
+uniform float guidingFraction;
+uniform int guidingGridRes = 0; // 0 until a distribution was uploaded
+uniform vec3 guidingGridMin;
+uniform vec3 guidingGridSize;
+
+// Records of the current frame slot, -1 when the slot is still being read back.
+// A record is two entries of frameRecords, the position with the incident luminance over the pdf it
+// was sampled with, then the direction.
+uniform int guidingSlot = -1;
+uniform int guidingRecordCapacity;
+uniform int guidingRecordRatio;
+layout(std430, binding = 27) /*buffer*/ uniform GuidingDistribution
+{
+    float guidingCdf[]; // per cell, empty cells end with 0
+};
+
+bool isGuidingTrainingPath()
+{
+    return guidingSlot != -1 && hashUint(samplerPixelSeed ^ hashUint(samplerIndex ^ 0x68bc21ebu)) % uint(guidingRecordRatio) == 0;
+}
+void addGuidingRecord(vec3 P, vec3 dir, float weight)
+{
+    uint index = atomicAdd(guidingRecordCounts[guidingSlot], 1u);
+    if (index >= uint(guidingRecordCapacity)) return;
+    int offset = (guidingSlot * guidingRecordCapacity + int(index)) * 2;
+    frameRecords[offset] = vec4(P, weight);
+    frameRecords[offset + 1] = vec4(dir, 0);
+}
+
+// Returns -1 where nothing was learned yet
+int getGuidingCell(vec3 P)
+{
+    if (guidingGridRes == 0) return -1;
+    ivec3 c = clamp(ivec3((P - guidingGridMin) / guidingGridSize * float(guidingGridRes)), ivec3(0), ivec3(guidingGridRes - 1));
+    int cell = (c.z * guidingGridRes + c.y) * guidingGridRes + c.x;
+    return guidingCdf[cell * GUIDING_BINS + GUIDING_BINS - 1] > 0 ? cell : -1;
+}
+int getGuidingBin(vec3 dir)
+{
+    vec2 uv = vec2(dir.z * 0.5 + 0.5, atan(dir.y, dir.x) / TWO_PI + 0.5);
+    ivec2 bin = clamp(ivec2(uv * GUIDING_DIRECTION_RES), ivec2(0), ivec2(GUIDING_DIRECTION_RES - 1));
+    return bin.y * GUIDING_DIRECTION_RES + bin.x;
+}
+
+float getGuidingPdf(int cell, vec3 dir)
+{
+    int offset = cell * GUIDING_BINS;
+    int bin = getGuidingBin(dir);
+    float binProb = guidingCdf[offset + bin] - (bin > 0 ? guidingCdf[offset + bin - 1] : 0);
+    return binProb * GUIDING_BINS / (4 * PI);
+}
+vec3 sampleGuiding(int cell, vec2 r)
+{
+    int offset = cell * GUIDING_BINS;
+    int left = 0;
+    int right = GUIDING_BINS - 1;
+    while (left < right)
+    {
+        int mid = (left + right) / 2;
+        if (guidingCdf[offset + mid] > r.x)
+            right = mid;
+        else
+            left = mid + 1;
+    }
+
+    // The position inside the bin reuses what is left of r.x
+    float binStart = left > 0 ? guidingCdf[offset + left - 1] : 0;
+    float u = clamp01((r.x - binStart) / max(guidingCdf[offset + left] - binStart, EPSILON));
+    vec2 uv = (vec2(left % GUIDING_DIRECTION_RES, left / GUIDING_DIRECTION_RES) + vec2(u, r.y)) / GUIDING_DIRECTION_RES;
+
+    float z = uv.x * 2 - 1;
+    float phi = (uv.y - 0.5) * TWO_PI;
+    float sinTheta = sqrt(clamp0(1 - z * z));
+    return vec3(sinTheta * cos(phi), sinTheta * sin(phi), z);
+}
+// ----------- PATH GUIDING -----------
@@ -1,4 +1,23 @@
-bool intersectTriangle(inout Ray ray, int triIndex)
+bool intersectTriangleRecord(inout Ray ray, int triIndex)
+{
+    TriangleRecord record = triangleRecords[triIndex];
+
+    // NaN for rays parallel to the plane, which fails the range test
+    float t = -(dot(record.rows[2].xyz, ray.pos) + record.rows[2].w) / dot(record.rows[2].xyz, ray.dir);
+    if (!(t >= -0.00001 && t < ray.t)) return false;
+
+    vec3 hitPoint = ray.pos + ray.dir * t;
+    float u = dot(record.rows[0].xyz, hitPoint) + record.rows[0].w;
+    float v = dot(record.rows[1].xyz, hitPoint) + record.rows[1].w;
+    if (u < -0.00001 || v < -0.00001 || u + v > 1.00001) return false;
+
+    ray.t = t;
+    ray.uv = vec2(u, v);
+    ray.hitPoint = hitPoint;
+    return true;
+}
+
+bool intersectTriangleVertices(inout Ray ray, int triIndex)
 {
     Triangle tri = triangles[triIndex];
 
@@ -33,6 +52,86 @@ bool intersectTriangle(inout Ray ray, int triIndex)
     return false;
 }
 
+// ----------- ALPHA TESTING -----------
+// Transparent hits are rejected during traversal, so a cutout costs no extra traversal.
+// Set per mesh before its triangles are tested, opaque meshes never read more than this.
+int alphaObjMaterial = -1;
+bool alphaTriangles = false;
+
+bool materialNeedsAlphaTest(int matIndex)
+{
+    return materials[matIndex].opacity < 1 || materials[matIndex].alphaMaskOffset != -1;
+}
+
+void beginMeshAlphaTest(Object obj)
+{
+    alphaObjMaterial = materialNeedsAlphaTest(obj.materialIndex) ? obj.materialIndex : -1;
+    alphaTriangles = obj.alphaTriangles != 0;
+}
+
+int getAlphaTestMaterial(int triIndex)
+{
+    bool flagged = alphaTriangles && (getSceneTable(SCENE_TABLE_TRIANGLE_ALPHA_FLAGS, triIndex >> 5) >> (triIndex & 31) & 1u) != 0;
+    if (alphaObjMaterial == -1 && !flagged) return -1;
+
+    int triMaterial = alphaTriangles ? int(triangles[triIndex].info.x) : -1;
+    if (triMaterial == -1) return alphaObjMaterial;
+    return flagged ? triMaterial : -1;
+}
+
+float sampleAlphaMask(int offset, vec2 uv)
+{
+    ivec2 size = ivec2(getSceneTable(SCENE_TABLE_ALPHA_MASKS, offset), getSceneTable(SCENE_TABLE_ALPHA_MASKS, offset + 1));
+    ivec2 texel = clamp(ivec2(fract(uv) * vec2(size)), ivec2(0), size - 1);
+    int bit = texel.y * size.x + texel.x;
+    return float(getSceneTable(SCENE_TABLE_ALPHA_MASKS, offset + 2 + (bit >> 5)) >> (bit & 31) & 1u);
+}
+
+// Set once a test was decided by chance, such a hit is only one realization of the surface
+bool stochasticOpacityTested = false;
+
+// Stochastic for partial opacity, white noise since the number of tests per path varies
+bool passesOpacity(float opacity)
+{
+    if (opacity >= 1) return true;
+    if (opacity > 0) stochasticOpacityTested = true;
+    return rand() < opacity;
+}
+
+bool passesAlphaTest(int triIndex, vec2 barycentric)
+{
+    int matIndex = getAlphaTestMaterial(triIndex);
+    if (matIndex == -1) return true;
+
+    float opacity = materials[matIndex].opacity;
+    int maskOffset = materials[matIndex].alphaMaskOffset;
+    if (maskOffset != -1)
+    {
+        Triangle tri = triangles[triIndex];
+        vec2 uv0 = vec2(tri.vertices[0].posU.w, tri.vertices[0].normalV.w);
+        vec2 uv1 = vec2(tri.vertices[1].posU.w, tri.vertices[1].normalV.w);
+        vec2 uv2 = vec2(tri.vertices[2].posU.w, tri.vertices[2].normalV.w);
+        vec2 uv = uv0 + barycentric.x * (uv1 - uv0) + barycentric.y * (uv2 - uv0);
+        opacity *= sampleAlphaMask(maskOffset, vec2(uv.x, 1.0 - uv.y));
+    }
+    return passesOpacity(opacity);
+}
+
+bool intersectTriangle(inout Ray ray, int triIndex)
+{
+    float t = ray.t;
+    vec2 uv = ray.uv;
+    vec3 hitPoint = ray.hitPoint;
+
+    bool hit = useTriangleRecords ? intersectTriangleRecord(ray, triIndex) : intersectTriangleVertices(ray, triIndex);
+    if (!hit || passesAlphaTest(triIndex, ray.uv)) return hit;
+
+    ray.t = t;
+    ray.uv = uv;
+    ray.hitPoint = hitPoint;
+    return false;
+}
+
 vec3 getTriangleNormalAt(Triangle tri, float u, float v)
 {
     vec3 norm1 = tri.vertices[0].normalV.xyz;
@@ -50,7 +149,7 @@ void calcTriIntersectionValues(inout Ray ray)
     vec3 e2 = localToGlobal(tri.vertices[2].posU.xyz, obj) - p0;
     vec3 geomNorm = cross(e1, e2);
 
-    vec3 norm = localToGlobalDir(getTriangleNormalAt(tri, ray.uv.x, ray.uv.y), obj);
+    vec3 norm = localToGlobalNormal(getTriangleNormalAt(tri, ray.uv.x, ray.uv.y), obj);
     geomNorm = dot(geomNorm, norm) < 0 ? -geomNorm : geomNorm;
     ray.surfaceNormal = dot(geomNorm, ray.dir) <= 0 ? norm : -norm;
 
@@ -60,6 +159,22 @@ void calcTriIntersectionValues(inout Ray ray)
     ray.uv = uv0 + ray.uv.x * (uv1 - uv0) + ray.uv.y * (uv2 - uv0);
 }
 
+float getTriTextureLodBase(int triIndex, Object obj)
+{
+    Triangle tri = triangles[triIndex];
+
+    vec3 p0, p1, p2;
+    calcGlobalTriVertices(tri, obj, p0, p1, p2);
+    float worldArea = length(cross(p1 - p0, p2 - p0));
+
+    vec2 uv0 = vec2(tri.vertices[0].posU.w, tri.vertices[0].normalV.w);
+    vec2 uv1 = vec2(tri.vertices[1].posU.w, tri.vertices[1].normalV.w);
+    vec2 uv2 = vec2(tri.vertices[2].posU.w, tri.vertices[2].normalV.w);
+    float uvArea = abs((uv1.x - uv0.x) * (uv2.y - uv0.y) - (uv2.x - uv0.x) * (uv1.y - uv0.y));
+
+    return 0.5 * log2(max(uvArea, EPSILON) / max(worldArea, EPSILON));
+}
+
 bool intersectBVHBottom(int rootNode, inout Ray ray, bool castingShadows);
 
 bool intersectMesh(inout Ray ray, Object obj, bool castingShadows)
@@ -74,6 +189,7 @@ bool intersectMesh(inout Ray ray, Object obj, bool castingShadows)
     vec3 tVec = rayPos + rayDir * ray.t;
     vec3 tVecLocal = globalToLocal(tVec, obj);
     ray.t = length(tVecLocal - ray.pos);
+    beginMeshAlphaTest(obj);
 
     bool hit = false;
     int rootNode = int(obj.properties.z);
@@ -109,22 +225,36 @@ bool intersectMesh(inout Ray ray, Object obj, bool castingShadows)
     return hit;
 }
 
+// A single known triangle of a mesh, without alpha testing since the hit was already accepted
+bool intersectMeshTriangle(inout Ray ray, Object obj, int triIndex)
+{
+    Ray localRay = Ray(globalToLocal(ray.pos, obj), globalToLocalDir(ray.dir, obj), RAY_DEFAULT_ARGS);
+    bool hit = useTriangleRecords ? intersectTriangleRecord(localRay, triIndex) : intersectTriangleVertices(localRay, triIndex);
+    if (!hit) return false;
+
+    ray.hitPoint = localToGlobal(localRay.hitPoint, obj);
+    ray.t = length(ray.hitPoint - ray.pos);
+    ray.uv = localRay.uv;
+    ray.hitTriIndex = triIndex;
+    return true;
+}
+
 bool intersectSphere(inout Ray ray, Object sphere)
 {
     float x0, x1;
     vec3 dir = ray.dir;
-    vec3 inter = (ray.pos - sphere.pos.xyz);
+    vec3 center = getObjPos(sphere);
+    vec3 inter = (ray.pos - center);
     float a = dot(dir, dir);
     float b = dot(dir + dir, inter);
-    vec3 objScale = getTransformScale(sphere.transform);
-    float c = abs(dot(inter, inter)) - sphere.properties.x * sphere.properties.x * objScale.x * objScale.x;
+    float c = abs(dot(inter, inter)) - sphere.radius * sphere.radius;
 
     if (!solveQuadratic(a, b, c, x0, x1)) return false;
     if (x0 <= 0 || x0 >= ray.t) return false;
 
     ray.t = x0;
     ray.hitPoint = ray.pos + x0 * dir;
-    ray.surfaceNormal = normalize(ray.hitPoint - sphere.pos.xyz);
+    ray.surfaceNormal = normalize(ray.hitPoint - center);
 
     vec3 uvN = globalToLocalDir(ray.surfaceNormal, sphere);
     float u = atan(uvN.z, uvN.x) / (2.0 * PI) + 0.5;
@@ -136,19 +266,19 @@ bool intersectSphere(inout Ray ray, Object sphere)
 
 bool intersectDisk(inout Ray ray, Object disk)
 {
-    vec3 normal = localToGlobalDir(vec3(0, 1, 0), disk);
+    vec3 normal = localToGlobalNormal(vec3(0, 1, 0), disk);
     float denom = -dot(normal, ray.dir);
     if (denom == 0) return false;
 
-    vec3 dir = disk.pos.xyz - ray.pos;
+    vec3 center = getObjPos(disk);
+    vec3 dir = center - ray.pos;
     float t = -dot(normal, dir) / denom;
     if (t >= ray.t || t <= 0) return false;
 
     vec3 hitPoint = ray.pos + t * ray.dir;
-    vec3 inter = hitPoint - disk.pos.xyz;
+    vec3 inter = hitPoint - center;
     float dist2 = dot(inter, inter);
-    vec3 objScale = getTransformScale(disk.transform);
-    float radius2 = disk.properties.x * disk.properties.x * objScale.x * objScale.x;
+    float radius2 = disk.radius * disk.radius;
     if (dist2 > radius2) return false;
 
     ray.t = t;
@@ -180,11 +310,11 @@ bool intersectLight(inout Ray ray, Light light, float radius)
 bool intersectPlane(inout Ray ray, Object plane)
 {
     vec3 normal = plane.properties.xyz;
-    normal = localToGlobalDir(normal, plane);
+    normal = localToGlobalNormal(normal, plane);
     float denom = -dot(normal, ray.dir);
     if (denom == 0) return false;
 
-    vec3 dir = plane.pos.xyz - ray.pos;
+    vec3 dir = getObjPos(plane) - ray.pos;
     float t = -dot(normal, dir) / denom;
     if (t >= ray.t || t <= 0) return false;
 
@@ -265,48 +395,69 @@ bool intersectsAABB(inout Ray ray, vec4 min_, vec4 max_, float tMin, float tMax,
     return true;
 }
 
+// Slab test with a precomputed inverse direction, tEntry orders children front to back
+bool intersectsAABBInv(inout Ray ray, vec3 invDir, vec4 min_, vec4 max_, out float tEntry, bool castingShadows)
+{
+    #ifdef SHOW_BVH_BOXES
+    if (!castingShadows)
+        intersectAABBForGizmo(ray, min_, max_);
+    #endif
+
+    vec3 t0 = (min_.xyz - ray.pos) * invDir;
+    vec3 t1 = (max_.xyz - ray.pos) * invDir;
+    vec3 tNear = min(t0, t1);
+    vec3 tFar = max(t0, t1);
+
+    tEntry = max(max(tNear.x, tNear.y), max(tNear.z, 0));
+    float tExit = min(min(tFar.x, tFar.y), min(tFar.z, ray.t));
+    if (tEntry > tExit) return false;
+
+    #ifdef SHOW_BVH_HEAT
+    COLOR_HEAT.x += pow(1 - COLOR_HEAT.x, 3) * 0.05;
+    #endif
+    return true;
+}
+
+// Primitives have no mask lookup, only the scalar material opacity
+bool passesPrimitiveOpacity(Object obj)
+{
+    return passesOpacity(materials[obj.materialIndex].opacity);
+}
+
+bool intersectPrimitive(inout Ray ray, Object obj)
+{
+    if (obj.objType == OBJ_TYPE_SPHERE)
+        return intersectSphere(ray, obj);
+    if (obj.objType == OBJ_TYPE_PLANE)
+        return intersectPlane(ray, obj);
+    if (obj.objType == OBJ_TYPE_DISK)
+        return intersectDisk(ray, obj);
+    return false;
+}
+
 bool intersectObj(inout Ray ray, Object obj, bool castingShadows)
 {
     if (obj.objType == OBJ_TYPE_MESH)
-    {
-        if (intersectMesh(ray, obj, castingShadows)) return true;
-    }
-    else if (obj.objType == OBJ_TYPE_SPHERE)
-    {
-        if (intersectSphere(ray, obj))
-        {
-            ray.hitTriIndex = -1;
-            return true;
-        }
-    }
-    else if (obj.objType == OBJ_TYPE_PLANE)
-    {
-        if (intersectPlane(ray, obj))
-        {
-            ray.hitTriIndex = -1;
-            return true;
-        }
-    }
-    else if (obj.objType == OBJ_TYPE_DISK)
-    {
-        if (intersectDisk(ray, obj))
-        {
-            ray.hitTriIndex = -1;
-            return true;
-        }
-    }
-    return false;
+        return intersectMesh(ray, obj, castingShadows);
+
+    Ray primRay = ray;
+    if (!intersectPrimitive(primRay, obj) || !passesPrimitiveOpacity(obj)) return false;
+
+    ray = primRay;
+    ray.hitTriIndex = -1;
+    return true;
 }
 
-bool intersectBVHBottom(int rootNode, inout Ray ray, bool castingShadows)
+// Walks the hit/miss links until endNode, a subtree ends at its root's miss link
+bool intersectBVHBottomLinks(int rootNode, int endNode, inout Ray ray, bool castingShadows)
 {
     bool hit = false;
     int curr = rootNode;
     int c = 0;
-    while (curr != -1)
+    while (curr != endNode)
     {
         BVHNode node = nodes[curr];
-        if (intersectsAABB(ray, node.min, node.max, 0, FLT_MAX, castingShadows))
+        if (intersectsAABB(ray, node.min, node.max, 0, ray.t, castingShadows))
         {
             if (node.values.z == 1)
             {
@@ -333,16 +484,15 @@ bool intersectBVHBottom(int rootNode, inout Ray ray, bool castingShadows)
     return hit;
 }
 
-uniform int bvhRootNode;
-bool intersectBVHTop(inout Ray ray, bool castingShadows)
+bool intersectBVHTopLinks(int rootNode, int endNode, inout Ray ray, bool castingShadows)
 {
     bool hit = false;
-    int curr = bvhRootNode;
+    int curr = rootNode;
     int c = 0;
-    while (curr != -1)
+    while (curr != endNode)
     {
         BVHNode node = nodes[curr];
-        if (intersectsAABB(ray, node.min, node.max, 0, FLT_MAX, castingShadows))
+        if (intersectsAABB(ray, node.min, node.max, 0, ray.t, castingShadows))
         {
             if (node.values.z == 1)
             {
@@ -369,6 +519,257 @@ bool intersectBVHTop(inout Ray ray, bool castingShadows)
     return hit;
 }
 
+#define BVH_STACK_SIZE 64
+
+// Nearest child first with a small stack, subtrees starting beyond the closest hit are skipped
+bool intersectBVHBottomStack(int rootNode, inout Ray ray, bool castingShadows)
+{
+    vec3 invDir = 1.0 / ray.dir;
+    float tEntry;
+    if (!intersectsAABBInv(ray, invDir, nodes[rootNode].min, nodes[rootNode].max, tEntry, castingShadows)) return false;
+
+    int stackNodes[BVH_STACK_SIZE];
+    float stackT[BVH_STACK_SIZE];
+    int stackSize = 0;
+
+    bool hit = false;
+    int curr = rootNode;
+    while (true)
+    {
+        BVHNode node = nodes[curr];
+        if (node.values.z == 1)
+        {
+            int index = int(node.min.w);
+            if (intersectTriangle(ray, index))
+            {
+                hit = true;
+                ray.hitTriIndex = index;
+
+                if (castingShadows) return true;
+            }
+        }
+        else
+        {
+            int left = node.values.x;
+            int right = node.values.y;
+            float tLeft, tRight;
+            bool hitLeft = intersectsAABBInv(ray, invDir, nodes[left].min, nodes[left].max, tLeft, castingShadows);
+            bool hitRight = intersectsAABBInv(ray, invDir, nodes[right].min, nodes[right].max, tRight, castingShadows);
+            if (hitLeft && hitRight && stackSize < BVH_STACK_SIZE)
+            {
+                bool leftFirst = tLeft <= tRight;
+                stackNodes[stackSize] = leftFirst ? right : left;
+                stackT[stackSize] = leftFirst ? tRight : tLeft;
+                stackSize++;
+                curr = leftFirst ? left : right;
+                continue;
+            }
+            if (hitLeft && hitRight)
+            {
+                // Deeper than the stack, which chains of equal morton codes can be, the links finish this subtree
+                if (intersectBVHBottomLinks(curr, node.links.y, ray, castingShadows))
+                {
+                    hit = true;
+                    if (castingShadows) return true;
+                }
+            }
+            else if (hitLeft || hitRight)
+            {
+                curr = hitLeft ? left : right;
+                continue;
+            }
+        }
+
+        // Pop the next subtree that can still hold a closer hit
+        curr = -1;
+        while (stackSize > 0)
+        {
+            stackSize--;
+            if (stackT[stackSize] < ray.t)
+            {
+                curr = stackNodes[stackSize];
+                break;
+            }
+        }
+        if (curr == -1) break;
+    }
+    return hit;
+}
+
+bool intersectBVHTopStack(int rootNode, inout Ray ray, bool castingShadows)
+{
+    vec3 invDir = 1.0 / ray.dir;
+    float tEntry;
+    if (!intersectsAABBInv(ray, invDir, nodes[rootNode].min, nodes[rootNode].max, tEntry, castingShadows)) return false;
+
+    int stackNodes[BVH_STACK_SIZE];
+    float stackT[BVH_STACK_SIZE];
+    int stackSize = 0;
+
+    bool hit = false;
+    int curr = rootNode;
+    while (true)
+    {
+        BVHNode node = nodes[curr];
+        if (node.values.z == 1)
+        {
+            int index = int(node.min.w);
+            if (intersectObj(ray, objects[index], castingShadows))
+            {
+                hit = true;
+                ray.hitObjIndex = index;
+
+                if (castingShadows) return true;
+            }
+        }
+        else
+        {
+            int left = node.values.x;
+            int right = node.values.y;
+            float tLeft, tRight;
+            bool hitLeft = intersectsAABBInv(ray, invDir, nodes[left].min, nodes[left].max, tLeft, castingShadows);
+            bool hitRight = intersectsAABBInv(ray, invDir, nodes[right].min, nodes[right].max, tRight, castingShadows);
+            if (hitLeft && hitRight && stackSize < BVH_STACK_SIZE)
+            {
+                bool leftFirst = tLeft <= tRight;
+                stackNodes[stackSize] = leftFirst ? right : left;
+                stackT[stackSize] = leftFirst ? tRight : tLeft;
+                stackSize++;
+                curr = leftFirst ? left : right;
+                continue;
+            }
+            if (hitLeft && hitRight)
+            {
+                // Deeper than the stack, which chains of equal morton codes can be, the links finish this subtree
+                if (intersectBVHTopLinks(curr, node.links.y, ray, castingShadows))
+                {
+                    hit = true;
+                    if (castingShadows) return true;
+                }
+            }
+            else if (hitLeft || hitRight)
+            {
+                curr = hitLeft ? left : right;
+                continue;
+            }
+        }
+
+        // Pop the next subtree that can still hold a closer hit
+        curr = -1;
+        while (stackSize > 0)
+        {
+            stackSize--;
+            if (stackT[stackSize] < ray.t)
+            {
+                curr = stackNodes[stackSize];
+                break;
+            }
+        }
+        if (curr == -1) break;
+    }
+    return hit;
+}
+
+int getLinks6Direction(vec3 dir)
+{
+    vec3 a = abs(dir);
+    int axis = a.x > a.y ? (a.x > a.z ? 0 : 2) : (a.y > a.z ? 1 : 2);
+    return axis * 2 + (dir[axis] > 0 ? 1 : 0);
+}
+
+// Stackless walk over the link table of the ray's major direction, children are entered near first
+bool intersectBVHBottomSixSided(int rootNode, inout Ray ray, bool castingShadows)
+{
+    int d = getLinks6Direction(ray.dir);
+    int linksOffset = int(sceneTables[SCENE_TABLE_BVH_LINKS6]);
+
+    bool hit = false;
+    int curr = rootNode;
+    while (curr != -1)
+    {
+        BVHNode node = nodes[curr];
+        int links = linksOffset + curr * BVH_LINKS6_STRIDE;
+        if (intersectsAABB(ray, node.min, node.max, 0, ray.t, castingShadows))
+        {
+            if (node.values.z == 1)
+            {
+                int triInd = int(node.min.w);
+                if (intersectTriangle(ray, triInd))
+                {
+                    hit = true;
+                    ray.hitTriIndex = triInd;
+
+                    if (castingShadows) return true;
+                }
+                curr = int(sceneTables[links + d]);
+            }
+            else
+                curr = (sceneTables[links + BVH_LINKS6_NEAR_FLAGS] >> d & 1u) != 0 ? node.values.y : node.values.x;
+        }
+        else
+            curr = int(sceneTables[links + d]);
+    }
+    return hit;
+}
+
+bool intersectBVHTopSixSided(int rootNode, inout Ray ray, bool castingShadows)
+{
+    int d = getLinks6Direction(ray.dir);
+    int linksOffset = int(sceneTables[SCENE_TABLE_BVH_LINKS6]);
+
+    bool hit = false;
+    int curr = rootNode;
+    while (curr != -1)
+    {
+        BVHNode node = nodes[curr];
+        int links = linksOffset + curr * BVH_LINKS6_STRIDE;
+        if (intersectsAABB(ray, node.min, node.max, 0, ray.t, castingShadows))
+        {
+            if (node.values.z == 1)
+            {
+                int objInd = int(node.min.w);
+                if (intersectObj(ray, objects[objInd], castingShadows))
+                {
+                    hit = true;
+                    ray.hitObjIndex = objInd;
+
+                    if (castingShadows) return true;
+                }
+                curr = int(sceneTables[links + d]);
+            }
+            else
+                curr = (sceneTables[links + BVH_LINKS6_NEAR_FLAGS] >> d & 1u) != 0 ? node.values.y : node.values.x;
+        }
+        else
+            curr = int(sceneTables[links + d]);
+    }
+    return hit;
+}
+
+#define BVH_TRAVERSAL_LINKS 0
+#define BVH_TRAVERSAL_STACK 1
+#define BVH_TRAVERSAL_SIX_SIDED 2
+uniform int bvhTraversalMode = BVH_TRAVERSAL_STACK;
+
+bool intersectBVHBottom(int rootNode, inout Ray ray, bool castingShadows)
+{
+    if (bvhTraversalMode == BVH_TRAVERSAL_STACK)
+        return intersectBVHBottomStack(rootNode, ray, castingShadows);
+    if (bvhTraversalMode == BVH_TRAVERSAL_SIX_SIDED)
+        return intersectBVHBottomSixSided(rootNode, ray, castingShadows);
+    return intersectBVHBottomLinks(rootNode, -1, ray, castingShadows);
+}
+
+uniform int bvhRootNode;
+bool intersectBVHTop(inout Ray ray, bool castingShadows)
+{
+    if (bvhTraversalMode == BVH_TRAVERSAL_STACK)
+        return intersectBVHTopStack(bvhRootNode, ray, castingShadows);
+    if (bvhTraversalMode == BVH_TRAVERSAL_SIX_SIDED)
+        return intersectBVHTopSixSided(bvhRootNode, ray, castingShadows);
+    return intersectBVHTopLinks(bvhRootNode, -1, ray, castingShadows);
+}
+
 bool intersectWorld(inout Ray ray, bool castingShadows)
 {
     // bool hit = false;
@@ -385,3 +786,382 @@ bool intersectWorld(inout Ray ray, bool castingShadows)
     // return hit;
     return intersectBVHTop(ray, castingShadows);
 }
+
+// ----------- OCCLUSION -----------
+// Shadow rays only need a yes/no answer, so these skip hit points, normals and uvs
+// and keep directions unnormalized in local space, which leaves t in world units
+
+bool occludesTriangleRecord(vec3 pos, vec3 dir, float tMax, int triIndex, out vec2 barycentric)
+{
+    TriangleRecord record = triangleRecords[triIndex];
+
+    barycentric = vec2(0);
+    float t = -(dot(record.rows[2].xyz, pos) + record.rows[2].w) / dot(record.rows[2].xyz, dir);
+    if (!(t > 0 && t < tMax)) return false;
+
+    vec3 hitPoint = pos + dir * t;
+    barycentric.x = dot(record.rows[0].xyz, hitPoint) + record.rows[0].w;
+    barycentric.y = dot(record.rows[1].xyz, hitPoint) + record.rows[1].w;
+    return barycentric.x >= -0.00001 && barycentric.y >= -0.00001 && barycentric.x + barycentric.y <= 1.00001;
+}
+
+bool occludesTriangleVertices(vec3 pos, vec3 dir, float tMax, int triIndex, out vec2 barycentric)
+{
+    barycentric = vec2(0);
+    vec3 v0 = triangles[triIndex].vertices[0].posU.xyz;
+    vec3 e1 = triangles[triIndex].vertices[1].posU.xyz - v0;
+    vec3 e2 = triangles[triIndex].vertices[2].posU.xyz - v0;
+
+    vec3 pv = cross(dir, e2);
+    float det = dot(e1, pv);
+    if (det == 0) return false;
+
+    float invDet = 1.0 / det;
+    vec3 tv = pos - v0;
+    float u = dot(tv, pv) * invDet;
+    if (u < -0.00001 || u > 1.00001) return false;
+
+    vec3 qv = cross(tv, e1);
+    float v = dot(dir, qv) * invDet;
+    if (v < -0.00001 || u + v > 1.00001) return false;
+
+    float t = dot(e2, qv) * invDet;
+    barycentric = vec2(u, v);
+    return t > 0 && t < tMax;
+}
+
+bool occludesTriangle(vec3 pos, vec3 dir, float tMax, int triIndex)
+{
+    vec2 barycentric;
+    bool hit = useTriangleRecords ? occludesTriangleRecord(pos, dir, tMax, triIndex, barycentric) : occludesTriangleVertices(pos, dir, tMax, triIndex, barycentric);
+    return hit && passesAlphaTest(triIndex, barycentric);
+}
+
+bool occludesAABB(vec3 pos, vec3 invDir, vec4 min_, vec4 max_, float tMax)
+{
+    vec3 t0 = (min_.xyz - pos) * invDir;
+    vec3 t1 = (max_.xyz - pos) * invDir;
+    vec3 tNear = min(t0, t1);
+    vec3 tFar = max(t0, t1);
+
+    float tEntry = max(max(tNear.x, tNear.y), max(tNear.z, 0));
+    float tExit = min(min(tFar.x, tFar.y), min(tFar.z, tMax));
+    return tEntry <= tExit;
+}
+
+// Any hit ends the walk, so the traversals below only differ in the order and cost of visiting nodes
+bool occludesBVHBottomLinks(int rootNode, int endNode, vec3 pos, vec3 dir, vec3 invDir, float tMax, out int occluderTri)
+{
+    int curr = rootNode;
+    while (curr != endNode)
+    {
+        BVHNode node = nodes[curr];
+        if (occludesAABB(pos, invDir, node.min, node.max, tMax))
+        {
+            if (node.values.z == 1)
+            {
+                int triInd = int(node.min.w);
+                if (occludesTriangle(pos, dir, tMax, triInd))
+                {
+                    occluderTri = triInd;
+                    return true;
+                }
+            }
+            curr = node.links.x;
+        }
+        else
+            curr = node.links.y;
+    }
+    return false;
+}
+
+// Both children are tested from their parent, there is no closest hit to sort them by
+bool occludesBVHBottomStack(int rootNode, vec3 pos, vec3 dir, vec3 invDir, float tMax, out int occluderTri)
+{
+    if (!occludesAABB(pos, invDir, nodes[rootNode].min, nodes[rootNode].max, tMax)) return false;
+
+    int stackNodes[BVH_STACK_SIZE];
+    int stackSize = 0;
+
+    int curr = rootNode;
+    while (true)
+    {
+        BVHNode node = nodes[curr];
+        if (node.values.z == 1)
+        {
+            int triInd = int(node.min.w);
+            if (occludesTriangle(pos, dir, tMax, triInd))
+            {
+                occluderTri = triInd;
+                return true;
+            }
+        }
+        else
+        {
+            int left = node.values.x;
+            int right = node.values.y;
+            bool hitLeft = occludesAABB(pos, invDir, nodes[left].min, nodes[left].max, tMax);
+            bool hitRight = occludesAABB(pos, invDir, nodes[right].min, nodes[right].max, tMax);
+            if (hitLeft && hitRight && stackSize < BVH_STACK_SIZE)
+            {
+                stackNodes[stackSize++] = right;
+                curr = left;
+                continue;
+            }
+            if (hitLeft && hitRight)
+            {
+                // Deeper than the stack, the links finish this subtree
+                if (occludesBVHBottomLinks(curr, node.links.y, pos, dir, invDir, tMax, occluderTri)) return true;
+            }
+            else if (hitLeft || hitRight)
+            {
+                curr = hitLeft ? left : right;
+                continue;
+            }
+        }
+
+        if (stackSize == 0) break;
+        curr = stackNodes[--stackSize];
+    }
+    return false;
+}
+
+// Near children first, so occluders close to the shading point end the walk early
+bool occludesBVHBottomSixSided(int rootNode, vec3 pos, vec3 dir, vec3 invDir, float tMax, out int occluderTri)
+{
+    int d = getLinks6Direction(dir);
+    int linksOffset = int(sceneTables[SCENE_TABLE_BVH_LINKS6]);
+
+    int curr = rootNode;
+    while (curr != -1)
+    {
+        BVHNode node = nodes[curr];
+        int links = linksOffset + curr * BVH_LINKS6_STRIDE;
+        if (occludesAABB(pos, invDir, node.min, node.max, tMax))
+        {
+            if (node.values.z == 1)
+            {
+                int triInd = int(node.min.w);
+                if (occludesTriangle(pos, dir, tMax, triInd))
+                {
+                    occluderTri = triInd;
+                    return true;
+                }
+                curr = int(sceneTables[links + d]);
+            }
+            else
+                curr = (sceneTables[links + BVH_LINKS6_NEAR_FLAGS] >> d & 1u) != 0 ? node.values.y : node.values.x;
+        }
+        else
+            curr = int(sceneTables[links + d]);
+    }
+    return false;
+}
+
+bool occludesBVHBottom(int rootNode, vec3 pos, vec3 dir, float tMax, out int occluderTri)
+{
+    vec3 invDir = 1.0 / dir;
+    if (bvhTraversalMode == BVH_TRAVERSAL_STACK)
+        return occludesBVHBottomStack(rootNode, pos, dir, invDir, tMax, occluderTri);
+    if (bvhTraversalMode == BVH_TRAVERSAL_SIX_SIDED)
+        return occludesBVHBottomSixSided(rootNode, pos, dir, invDir, tMax, occluderTri);
+    return occludesBVHBottomLinks(rootNode, -1, pos, dir, invDir, tMax, occluderTri);
+}
+
+bool occludesMesh(vec3 pos, vec3 dir, float tMax, Object obj, out int occluderTri)
+{
+    vec3 localPos = globalToLocal(pos, obj);
+    vec3 localDir = vec3(dot(obj.toLocal[0].xyz, dir), dot(obj.toLocal[1].xyz, dir), dot(obj.toLocal[2].xyz, dir));
+    beginMeshAlphaTest(obj);
+
+    int rootNode = int(obj.properties.z);
+    if (rootNode != -1)
+        return occludesBVHBottom(rootNode, localPos, localDir, tMax, occluderTri);
+
+    for (int i = int(obj.properties.x); i < obj.properties.x + obj.properties.y; i++)
+    {
+        if (occludesTriangle(localPos, localDir, tMax, i))
+        {
+            occluderTri = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool occludesObj(vec3 pos, vec3 dir, float tMax, Object obj, out int occluderTri)
+{
+    occluderTri = -1;
+    if (obj.objType == OBJ_TYPE_MESH)
+        return occludesMesh(pos, dir, tMax, obj, occluderTri);
+
+    if (obj.objType == OBJ_TYPE_SPHERE)
+    {
+        float x0, x1;
+        vec3 inter = pos - getObjPos(obj);
+        if (!solveQuadratic(dot(dir, dir), 2 * dot(dir, inter), dot(inter, inter) - obj.radius * obj.radius, x0, x1)) return false;
+        return x0 > 0 && x0 < tMax && passesPrimitiveOpacity(obj);
+    }
+
+    // Planes and disks
+    vec3 normal = localToGlobalNormal(obj.objType == OBJ_TYPE_PLANE ? obj.properties.xyz : vec3(0, 1, 0), obj);
+    float denom = -dot(normal, dir);
+    if (denom == 0) return false;
+
+    vec3 center = getObjPos(obj);
+    float t = -dot(normal, center - pos) / denom;
+    if (t <= 0 || t >= tMax) return false;
+    if (obj.objType == OBJ_TYPE_PLANE) return passesPrimitiveOpacity(obj);
+
+    vec3 inter = pos + t * dir - center;
+    return dot(inter, inter) <= obj.radius * obj.radius && passesPrimitiveOpacity(obj);
+}
+
+bool occludesBVHTopLinks(int rootNode, int endNode, vec3 pos, vec3 dir, vec3 invDir, float tMax, inout ivec2 occluder)
+{
+    int curr = rootNode;
+    while (curr != endNode)
+    {
+        BVHNode node = nodes[curr];
+        if (occludesAABB(pos, invDir, node.min, node.max, tMax))
+        {
+            if (node.values.z == 1)
+            {
+                int objInd = int(node.min.w);
+                int occluderTri;
+                if (occludesObj(pos, dir, tMax, objects[objInd], occluderTri))
+                {
+                    occluder = ivec2(objInd, occluderTri);
+                    return true;
+                }
+            }
+            curr = node.links.x;
+        }
+        else
+            curr = node.links.y;
+    }
+    return false;
+}
+
+bool occludesBVHTopStack(int rootNode, vec3 pos, vec3 dir, vec3 invDir, float tMax, inout ivec2 occluder)
+{
+    if (!occludesAABB(pos, invDir, nodes[rootNode].min, nodes[rootNode].max, tMax)) return false;
+
+    int stackNodes[BVH_STACK_SIZE];
+    int stackSize = 0;
+
+    int curr = rootNode;
+    while (true)
+    {
+        BVHNode node = nodes[curr];
+        if (node.values.z == 1)
+        {
+            int objInd = int(node.min.w);
+            int occluderTri;
+            if (occludesObj(pos, dir, tMax, objects[objInd], occluderTri))
+            {
+                occluder = ivec2(objInd, occluderTri);
+                return true;
+            }
+        }
+        else
+        {
+            int left = node.values.x;
+            int right = node.values.y;
+            bool hitLeft = occludesAABB(pos, invDir, nodes[left].min, nodes[left].max, tMax);
+            bool hitRight = occludesAABB(pos, invDir, nodes[right].min, nodes[right].max, tMax);
+            if (hitLeft && hitRight && stackSize < BVH_STACK_SIZE)
+            {
+                stackNodes[stackSize++] = right;
+                curr = left;
+                continue;
+            }
+            if (hitLeft && hitRight)
+            {
+                if (occludesBVHTopLinks(curr, node.links.y, pos, dir, invDir, tMax, occluder)) return true;
+            }
+            else if (hitLeft || hitRight)
+            {
+                curr = hitLeft ? left : right;
+                continue;
+            }
+        }
+
+        if (stackSize == 0) break;
+        curr = stackNodes[--stackSize];
+    }
+    return false;
+}
+
+bool occludesBVHTopSixSided(int rootNode, vec3 pos, vec3 dir, vec3 invDir, float tMax, inout ivec2 occluder)
+{
+    int d = getLinks6Direction(dir);
+    int linksOffset = int(sceneTables[SCENE_TABLE_BVH_LINKS6]);
+
+    int curr = rootNode;
+    while (curr != -1)
+    {
+        BVHNode node = nodes[curr];
+        int links = linksOffset + curr * BVH_LINKS6_STRIDE;
+        if (occludesAABB(pos, invDir, node.min, node.max, tMax))
+        {
+            if (node.values.z == 1)
+            {
+                int objInd = int(node.min.w);
+                int occluderTri;
+                if (occludesObj(pos, dir, tMax, objects[objInd], occluderTri))
+                {
+                    occluder = ivec2(objInd, occluderTri);
+                    return true;
+                }
+                curr = int(sceneTables[links + d]);
+            }
+            else
+                curr = (sceneTables[links + BVH_LINKS6_NEAR_FLAGS] >> d & 1u) != 0 ? node.values.y : node.values.x;
+        }
+        else
+            curr = int(sceneTables[links + d]);
+    }
+    return false;
+}
+
+bool occludesBVHTop(vec3 pos, vec3 dir, float tMax, inout ivec2 occluder)
+{
+    vec3 invDir = 1.0 / dir;
+    if (bvhTraversalMode == BVH_TRAVERSAL_STACK)
+        return occludesBVHTopStack(bvhRootNode, pos, dir, invDir, tMax, occluder);
+    if (bvhTraversalMode == BVH_TRAVERSAL_SIX_SIDED)
+        return occludesBVHTopSixSided(bvhRootNode, pos, dir, invDir, tMax, occluder);
+    return occludesBVHTopLinks(bvhRootNode, -1, pos, dir, invDir, tMax, occluder);
+}
+
+// Tests a previously found occluder alone, stale entries from an older scene are rejected
+bool occludesCached(vec3 pos, vec3 dir, float tMax, ivec2 occluder)
+{
+    if (occluder.x < 0 || occluder.x >= objectCount) return false;
+
+    Object obj = objects[occluder.x];
+    if (obj.objType != OBJ_TYPE_MESH)
+    {
+        int occluderTri;
+        return occluder.y == -1 && occludesObj(pos, dir, tMax, obj, occluderTri);
+    }
+    if (occluder.y < obj.properties.x || occluder.y >= obj.properties.x + obj.properties.y) return false;
+
+    vec3 localPos = globalToLocal(pos, obj);
+    vec3 localDir = vec3(dot(obj.toLocal[0].xyz, dir), dot(obj.toLocal[1].xyz, dir), dot(obj.toLocal[2].xyz, dir));
+    beginMeshAlphaTest(obj);
+    return occludesTriangle(localPos, localDir, tMax, occluder.y);
+}
+
+bool occluded(vec3 pos, vec3 dir, float tMax, inout ivec2 occluder)
+{
+    if (occludesCached(pos, dir, tMax, occluder)) return true;
+    return occludesBVHTop(pos, dir, tMax, occluder);
+}
+
+bool occluded(vec3 pos, vec3 dir, float tMax)
+{
+    ivec2 occluder = ivec2(-1);
+    return occludesBVHTop(pos, dir, tMax, occluder);
+}
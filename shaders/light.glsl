@@ -1,37 +1,123 @@
-vec2 genRandoms(int bounce)
+uniform sampler2D envMap;
+uniform bool useEnvMap = false;
+uniform mat4x4 envMapToWorld = mat4(1.0);
+
+uniform ivec2 envMapDistSize = ivec2(0);
+float getEnvMapDist(int index)
+{
+    return uintBitsToFloat(getSceneTable(SCENE_TABLE_ENV_MAP_DISTRIBUTION, index));
+}
+
+vec2 envMapDirToUV(vec3 dir)
 {
-    float r1, r2;
-    if (bounce == 0) // apply stratified sampling if first bounce
+    dir = normalize((envMapToWorld * vec4(dir, 0)).xyz);
+    float u = atan(dir.z, dir.x) / (2.0 * PI) + 0.5;
+    float v = acos(clamp(dir.y, -1.0, 1.0)) / PI;
+    return vec2(u, v);
+}
+vec3 envMapUVToDir(vec2 uv)
+{
+    float phi = (uv.x - 0.5) * 2.0 * PI;
+    float theta = uv.y * PI;
+    vec3 dir = vec3(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+    return normalize(transpose(mat3(envMapToWorld)) * dir);
+}
+
+vec3 sampleEnvMap(vec3 dir)
+{
+    if (!useEnvMap) return vec3(1);
+    return textureLod(envMap, envMapDirToUV(dir), 0).rgb;
+}
+
+int findCdfInterval(int offset, int count, float r)
+{
+    int left = 0;
+    int right = count - 1;
+    while (left < right)
     {
-        int strata = int(ceil(sqrt(samplesPerPixel)));
-        int j = totalSamples % (strata * strata);
-        r1 = (j % strata + rand()) / strata;
-        r2 = (j / strata + rand()) / strata;
+        int mid = (left + right + 1) / 2;
+        if (getEnvMapDist(offset + mid) <= r)
+            left = mid;
+        else
+            right = mid - 1;
     }
-    else
+    return left;
+}
+
+vec3 sampleEnvMapDir(float r1, float r2, out float pdf)
+{
+    if (!useEnvMap || envMapDistSize.x == 0)
     {
-        r1 = rand();
-        r2 = rand();
+        pdf = 1 / (4 * PI);
+        return sampleSphereUniform(r1, r2);
     }
-    return vec2(r1, r2);
+
+    int w = envMapDistSize.x;
+    int h = envMapDistSize.y;
+
+    int y = findCdfInterval(0, h, r2);
+    float dv = (r2 - getEnvMapDist(y)) / max(getEnvMapDist(y + 1) - getEnvMapDist(y), EPSILON);
+
+    int rowOffset = h + 1 + y * (w + 1);
+    int x = findCdfInterval(rowOffset, w, r1);
+    float du = (r1 - getEnvMapDist(rowOffset + x)) / max(getEnvMapDist(rowOffset + x + 1) - getEnvMapDist(rowOffset + x), EPSILON);
+
+    vec2 uv = vec2((x + clamp01(du)) / w, (y + clamp01(dv)) / h);
+    float sinTheta = sin(uv.y * PI);
+    float pdfUV = getEnvMapDist(h + 1 + h * (w + 1) + y * w + x);
+    pdf = sinTheta > 0 ? pdfUV / (2 * PI * PI * sinTheta) : 0;
+
+    return envMapUVToDir(uv);
 }
+float getEnvMapPdf(vec3 dir)
+{
+    if (!useEnvMap || envMapDistSize.x == 0)
+        return 1 / (4 * PI);
 
-uniform sampler2D envMap;
-uniform bool useEnvMap = false;
-uniform mat4x4 envMapToWorld = mat4(1.0);
-vec3 sampleEnvMap(vec3 dir)
+    int w = envMapDistSize.x;
+    int h = envMapDistSize.y;
+
+    vec2 uv = envMapDirToUV(dir);
+    int x = clamp(int(uv.x * w), 0, w - 1);
+    int y = clamp(int(uv.y * h), 0, h - 1);
+
+    float sinTheta = sin(uv.y * PI);
+    float pdfUV = getEnvMapDist(h + 1 + h * (w + 1) + y * w + x);
+    return sinTheta > 0 ? pdfUV / (2 * PI * PI * sinTheta) : 0;
+}
+
+struct LightAlias
 {
-    if (!useEnvMap) return vec3(1);
+    float prob;
+    int alias;
+    float pdf;
+    float _pad;
+};
+LightAlias getLightAlias(int index)
+{
+    int offset = int(sceneTables[SCENE_TABLE_LIGHT_ALIASES]) + index * 4;
+    return LightAlias(uintBitsToFloat(sceneTables[offset]), int(sceneTables[offset + 1]), uintBitsToFloat(sceneTables[offset + 2]), 0);
+}
 
-    dir = normalize((envMapToWorld * vec4(dir, 0)).xyz);
-    float u = atan(dir.z, dir.x) / (2.0 * PI) + 0.5;
-    float v = acos(clamp(dir.y, -1.0, 1.0)) / PI;
-    return texture(envMap, vec2(u, v)).rgb;
+float getLightSelectPdf(int lightIndex)
+{
+    return lightIndex < 0 ? 0 : getLightAlias(lightIndex).pdf;
+}
+int sampleLightIndex(float r, out float selectPdf)
+{
+    float scaled = r * lightCount;
+    int ind = min(int(scaled), lightCount - 1);
+    LightAlias entry = getLightAlias(ind);
+    if (scaled - ind >= entry.prob)
+        ind = entry.alias;
+
+    selectPdf = getLightSelectPdf(ind);
+    return ind;
 }
 
 float getTriangleLightPdf(Light light, Triangle tri, Object obj, vec3 P, vec3 L, vec3 LP)
 {
-    vec3 LN = localToGlobalDir(tri.vertices[0].normalV.xyz, obj);
+    vec3 LN = localToGlobalNormal(tri.vertices[0].normalV.xyz, obj);
     float LNdotL = clamp0(dot(-L, LN));
 
     float dist = length(LP - P);
@@ -39,12 +125,11 @@ float getTriangleLightPdf(Light light, Triangle tri, Object obj, vec3 P, vec3 L,
 }
 float getDiskLightPdf(Light light, Object obj, vec3 P, vec3 L, vec3 LP)
 {
-    vec3 LN = localToGlobalDir(vec3(0, -1, 0), obj);
+    vec3 LN = localToGlobalNormal(vec3(0, -1, 0), obj);
     float LNdotL = max(dot(-L, LN), 0.0);
 
     float dist = length(LP - P);
-    float radius = obj.properties.x * getTransformScale(obj.transform).x;
-    float area = PI * radius * radius;
+    float area = PI * obj.radius * obj.radius;
     return dist * dist / max(LNdotL * area, EPSILON);
 }
 
@@ -66,7 +151,14 @@ float getLightPdf(Light light, Object obj, vec3 P, vec3 L, vec3 LP)
     return -1;
 }
 
-void sampleLight(int lightIndex, vec3 P, out vec3 L, out vec3 radiance, out float dist, out float pdf)
+float getPointLightFalloff(Light light, float dist)
+{
+    return light.properties1.y == -1 ?
+        1 / (dist * dist) :
+        clamp1(pow(clamp0(1 - dist / light.properties1.y), 2));
+}
+
+void sampleLight(int lightIndex, vec3 P, vec2 r, out vec3 L, out vec3 radiance, out float dist, out float pdf)
 {
     Light light = lights[lightIndex];
     if (light.lightType == LIGHT_TYPE_POINT)
@@ -74,10 +166,7 @@ void sampleLight(int lightIndex, vec3 P, out vec3 L, out vec3 radiance, out floa
         L = normalize(light.pos - P);
         dist = length(light.pos - P);
 
-        float distImpact = light.properties1.y == -1 ?
-            1 / (dist * dist) :
-            clamp1(pow(clamp0(1 - dist / light.properties1.y), 2));
-        radiance = distImpact * light.color * light.properties1.x;
+        radiance = getPointLightFalloff(light, dist) * light.color * light.properties1.x;
         pdf = 1;
     }
     else if (light.lightType == LIGHT_TYPE_DIRECTIONAL)
@@ -95,32 +184,29 @@ void sampleLight(int lightIndex, vec3 P, out vec3 L, out vec3 radiance, out floa
         vec3 v0, v1, v2;
         calcGlobalTriVertices(tri, obj, v0, v1, v2);
 
-        vec3 LP = sampleTriangleUniform(v0, v1, v2, rand(), rand());
+        vec3 LP = sampleTriangleUniform(v0, v1, v2, r.x, r.y);
         L = normalize(LP - P);
         dist = length(LP - P);
 
-        radiance = findMaterial(obj.materialIndex).emission;
+        radiance = getObjMaterial(obj, int(light.properties1.x)).emission;
         pdf = getTriangleLightPdf(light, tri, obj, P, L, LP);
     }
     else if (light.lightType == LIGHT_TYPE_DISK)
     {
         Object obj = objects[int(light.properties1.x)];
-        float radius = obj.properties.x * getTransformScale(obj.transform).x;
-
-        vec3 circlePoint = sampleCircleCosine(rand(), rand());
-        vec3 LP = localToGlobal(circlePoint * radius, obj);
+        vec3 circlePoint = sampleCircleCosine(r.x, r.y);
+        vec3 LP = localToGlobal(circlePoint * obj.properties.x, obj);
         L = normalize(LP - P);
         dist = length(LP - P);
 
-        radiance = findMaterial(obj.materialIndex).emission;
+        radiance = materials[obj.materialIndex].emission;
         pdf = getDiskLightPdf(light, obj, P, L, LP);
     }
     else if (light.lightType == LIGHT_TYPE_ENVIRONMENTAL)
     {
-        L = sampleSphereUniform(rand(), rand());
+        L = sampleEnvMapDir(r.x, r.y, pdf);
         dist = 1e10;
         radiance = sampleEnvMap(L) * light.color;
-        pdf = 1 / (4 * PI);
     }
 }
 
@@ -133,25 +219,39 @@ vec3 getDirectLighting(vec3 N, vec3 V, vec3 P, vec3 diffColor, vec3 specColor, f
     }
 
     vec3 L, radiance;
-    float dist;
-    int ind = randInt(0, lightCount - 1);
-    sampleLight(ind, P, L, radiance, dist, lightPdf);
-    lightPdf /= lightCount;
+    float dist, selectPdf;
+    int ind = sampleLightIndex(sample1D(bounce, SAMPLE_LIGHT_SELECT), selectPdf);
+    sampleLight(ind, P, sample2D(bounce, SAMPLE_LIGHT_POS), L, radiance, dist, lightPdf);
+    lightPdf *= selectPdf;
 
     float NdotL = clamp0(dot(L, N));
-    if (NdotL < 1e-5 || lightPdf > 1e15)
+    if (NdotL < 1e-5 || lightPdf <= 0 || lightPdf > 1e15)
     {
         lightPdf = 0;
         return vec3(0);
     }
 
-    Ray shadowRay = Ray(P, L, dist - 0.001, RAY_DEFAULT_ARGS_WO_DIST);
-    float shadowMult = intersectWorld(shadowRay, true) ? 0.0 : 1.0;
+    // Later bounces scatter too much for a per-pixel occluder to repeat
+    bool isOccluded;
+    if (useOccluderCache && bounce == 0)
+    {
+        int pixel = int(gl_FragCoord.y) * int(pixelSize.x) + int(gl_FragCoord.x);
+        ivec2 occluder = occluders[pixel];
+        ivec2 prevOccluder = occluder;
+        isOccluded = occluded(P, L, dist - 0.001, occluder);
+        if (occluder != prevOccluder)
+            occluders[pixel] = occluder;
+    }
+    else
+        isOccluded = occluded(P, L, dist - 0.001);
+    float shadowMult = isOccluded ? 0.0 : 1.0;
 
     vec3 brdf = ggxBRDF(N, L, V, NdotL, roughness, specColor, diffColor);
     return shadowMult * radiance * brdf * NdotL / lightPdf;
 }
 
+#include "guiding.glsl"
+
 float probToSampleDiffuse(vec3 diffColor, vec3 specColor, float metallic)
 {
     float lumDiff = max(0.01, luminance(diffColor));
@@ -160,11 +260,45 @@ float probToSampleDiffuse(vec3 diffColor, vec3 specColor, float metallic)
     return (1.0 - metallic) * blend;
 }
 
-vec3 scatter(vec3 N, vec3 V, vec3 diffColor, vec3 specColor, float roughness, float metallic, int bounce, inout vec3 throughput, out float pdf)
+// One-sample MIS of the guide and the bsdf lobes, every direction is weighted by the pdf of the whole mixture
+vec3 scatterGuided(int cell, vec3 N, vec3 V, vec3 diffColor, vec3 specColor, float roughness, float probDiff, int bounce, inout vec3 throughput, out float pdf)
+{
+    vec2 r = sample2D(bounce, SAMPLE_BSDF_DIR);
+    float lobe = sample1D(bounce, SAMPLE_BSDF_LOBE);
+    vec3 L;
+    if (lobe < guidingFraction)
+        L = sampleGuiding(cell, r);
+    else if ((lobe - guidingFraction) / (1 - guidingFraction) < probDiff)
+        L = worldToTangent(sampleHemisphereCosine(r.x, r.y), N);
+    else
+        L = normalize(reflect(-V, sampleGGXMicrofacet(N, roughness, r.x, r.y)));
+
+    float NdotL = dot(N, L);
+    pdf = guidingFraction * getGuidingPdf(cell, L);
+    if (NdotL > 0)
+        pdf += (1 - guidingFraction) * (probDiff * NdotL / PI + (1 - probDiff) * ggxSpecPdf(N, L, V, roughness));
+    if (NdotL < 1e-5 || pdf < 0.001)
+    {
+        pdf = 0.001;
+        throughput = vec3(0);
+        return vec3(0);
+    }
+
+    throughput *= ggxBRDF(N, L, V, NdotL, roughness, specColor, diffColor) * NdotL / pdf;
+    return L;
+}
+
+vec3 scatter(vec3 N, vec3 V, vec3 P, vec3 diffColor, vec3 specColor, float roughness, float metallic, int bounce, inout vec3 throughput, out float pdf)
 {
-    vec2 r = genRandoms(bounce);
     float probDiff = probToSampleDiffuse(diffColor, specColor, metallic);
-    if (rand() < probDiff)
+
+    // Near specular lobes already know where to go
+    int guidingCell = usePathGuiding && roughness >= GUIDING_MIN_ROUGHNESS ? getGuidingCell(P) : -1;
+    if (guidingCell != -1)
+        return scatterGuided(guidingCell, N, V, diffColor, specColor, roughness, probDiff, bounce, throughput, pdf);
+
+    vec2 r = sample2D(bounce, SAMPLE_BSDF_DIR);
+    if (sample1D(bounce, SAMPLE_BSDF_LOBE) < probDiff)
     {
         vec3 L_local = sampleHemisphereCosine(r.x, r.y);
         vec3 L = worldToTangent(L_local, N);
@@ -193,13 +327,23 @@ vec3 scatter(vec3 N, vec3 V, vec3 diffColor, vec3 specColor, float roughness, fl
         return L;
     }
 }
+#include "restir.glsl"
+
 vec3 getRadiance(vec3 N, vec3 V, vec3 P, vec3 diffColor, vec3 specColor, float roughness, float metallic, int bounce, inout vec3 throughput, out vec3 bounceDir, out float brdfPdf)
 {
+    // Resampled lighting has no single light pdf, so bsdf hits of lights skip it instead of being weighted
+    if (misSampleLight && isResamplingLights(bounce))
+    {
+        vec3 directLighting = getResampledDirectLighting(ShadingPoint(N, V, P, diffColor, specColor, roughness));
+        bounceDir = scatter(N, V, P, diffColor, specColor, roughness, metallic, bounce, throughput, brdfPdf);
+        return directLighting;
+    }
+
     float lightPdf;
     vec3 directLighting = misSampleLight ? getDirectLighting(N, V, P, diffColor, specColor, roughness, bounce, lightPdf) : vec3(0);
     // directLighting = clampMax(directLighting, 1);
 
-    bounceDir = scatter(N, V, diffColor, specColor, roughness, metallic, bounce, throughput, brdfPdf);
+    bounceDir = scatter(N, V, P, diffColor, specColor, roughness, metallic, bounce, throughput, brdfPdf);
 
     float lightMis = powerHeuristic(lightPdf, misSampleBrdf ? brdfPdf : 0);
     return directLighting * lightMis;
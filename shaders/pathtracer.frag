@@ -7,6 +7,38 @@ layout(std140, binding = 6) /*buffer*/ uniform BVHNodes
     BVHNode nodes[];
 };
 
+// Object and triangle that last blocked the first bounce shadow ray of each pixel
+uniform bool useOccluderCache = false;
+layout(std430, binding = 15) /*buffer*/ uniform OccluderCache
+{
+    ivec2 occluders[];
+};
+
+// First hit of each of a fixed set of sub-pixel positions. Entries of an older epoch,
+// which changes whenever the samples are reset, count as empty.
+#define PRIMARY_CACHE_OBJECT_BITS 24
+uniform bool usePrimaryCache = false;
+uniform int primaryCachePositions;
+uniform int primaryCacheEpoch;
+layout(std430, binding = 23) /*buffer*/ uniform PrimaryCache
+{
+    uvec2 primaryHits[]; // x: epoch, object + 1 in the low bits, y: triangle + 1
+};
+
+// Path guiding records of each frame slot, then the ReSTIR reservoirs, so both take up one storage block.
+// The counts hold the records written to each slot, see addGuidingRecord and loadReservoir.
+layout(std430, binding = 24) /*buffer*/ uniform FrameRecords
+{
+    uvec4 guidingRecordCounts;
+    vec4 frameRecords[];
+};
+
+// Object and triangle seen through each pixel center by the rasterizer, -1 where nothing was drawn.
+// Its projection carries the sample jitter, so it matches the camera ray of the current sample.
+uniform bool useRasterPrimary = false;
+uniform isampler2D rasterHits;
+uniform vec2 rasterJitter;
+
 uniform int primObjCount = 0;
 layout(std430, binding = 7) /*buffer*/ uniform PrimitiveObjectsIndices
 {
@@ -39,30 +71,80 @@ uniform int frame;
 uniform int sampleFrame;
 uniform int totalSamples;
 
+#include "sampler.glsl"
+#include "radiance_cache.glsl"
 #include "intersection.glsl"
 #include "shading.glsl"
 #include "light.glsl"
 
-vec3 castRay(Ray ray)
+float getTextureLod(sampler2D tex, float lodBase, float coneWidth, vec3 dir, vec3 normal)
+{
+    vec2 size = vec2(textureSize(tex, 0));
+    return lodBase + 0.5 * log2(size.x * size.y) + log2(coneWidth / max(abs(dot(dir, normal)), 0.05));
+}
+
+// ----------- RADIANCE CACHE -----------
+// Paths stop at the cache once their footprint covers a cell, a sparse set of training paths
+// runs to full depth and feeds the cells it passes. Cells are keyed on position, normal and
+// a level of detail that follows the pixel footprint at the cell.
+#define RADIANCE_CACHE_TRAIN_VERTICES 4
+
+uniform bool useRadianceCache = false;
+uniform int radianceCacheTrainingRatio;
+uniform float radianceCacheCellPixels;
+
+bool isRadianceCacheTrainingPath()
+{
+    return hashUint(samplerPixelSeed ^ hashUint(samplerIndex)) % uint(radianceCacheTrainingRatio) == 0;
+}
+
+// First bounce surface, guides the denoiser
+vec3 gbufferAlbedo = vec3(1);
+vec3 gbufferNormal = vec3(0);
+float gbufferDepth = 0;
+
+// The first intersection is done by the caller, so it can come from the primary cache
+vec3 castRay(Ray ray, bool primaryHit)
 {
     vec3 color = vec3(0);
     vec3 throughput = vec3(1);
 
+    // Ray cone used for texture LOD selection
+    float coneWidth = 0;
+    float coneSpread = viewSize.y / pixelSize.y / focalDistance;
+
+    // Path color and throughput at the vertices a training path passes, their radiance is known at the end
+    bool trainsCache = useRadianceCache && isRadianceCacheTrainingPath();
+    int trainCells[RADIANCE_CACHE_TRAIN_VERTICES];
+    vec3 trainColors[RADIANCE_CACHE_TRAIN_VERTICES];
+    vec3 trainThroughputs[RADIANCE_CACHE_TRAIN_VERTICES];
+    int trainCount = 0;
+
+    // Vertices a guiding training path scattered from, recorded with the radiance that came back along the bounce
+    bool trainsGuiding = usePathGuiding && isGuidingTrainingPath();
+    vec3 guidingPositions[GUIDING_TRAIN_VERTICES];
+    vec3 guidingDirs[GUIDING_TRAIN_VERTICES];
+    vec3 guidingColors[GUIDING_TRAIN_VERTICES];
+    vec3 guidingThroughputs[GUIDING_TRAIN_VERTICES];
+    float guidingPdfs[GUIDING_TRAIN_VERTICES];
+    int guidingCount = 0;
+
     float lastBrdfPdf = 1;
     for (int bounce = 0; bounce <= maxRayBounces; bounce++)
     {
-        if (!intersectWorld(ray, false))
+        bool hit = bounce == 0 ? primaryHit : intersectWorld(ray, false);
+        if (!hit)
         {
-            bool isSamplingEnvLight = lightCount > 0 && lights[0].lightType == LIGHT_TYPE_ENVIRONMENTAL;
+            bool isSamplingEnvLight = envLightIndex != -1;
             if (!isSamplingEnvLight || bounce == 0)
             {
                 color += throughput * bgColor * sampleEnvMap(ray.dir);
                 color = clamp(color, 0, 1);
             }
-            else if (misSampleBrdf)
+            else if (misSampleBrdf && !isResamplingLights(bounce - 1))
             {
                 vec3 envColor = sampleEnvMap(ray.dir);
-                float envPdf = 1 / (4 * PI);
+                float envPdf = misSampleLight ? getEnvMapPdf(ray.dir) * getLightSelectPdf(envLightIndex) : 0;
                 float brdfMis = powerHeuristic(lastBrdfPdf, envPdf);
 
                 color += throughput * bgColor * envColor * brdfMis;
@@ -71,10 +153,15 @@ vec3 castRay(Ray ray)
             break;
         }
 
+        coneWidth += coneSpread * ray.t;
+        float texLodBase = -FLT_MAX;
         if (ray.hitTriIndex != -1)
+        {
             calcTriIntersectionValues(ray);
+            texLodBase = getTriTextureLodBase(ray.hitTriIndex, objects[ray.hitObjIndex]);
+        }
 
-        Material mat = findMaterial(objects[ray.hitObjIndex].materialIndex);
+        Material mat = getObjMaterial(objects[ray.hitObjIndex], ray.hitTriIndex);
         vec2 uv = vec2(ray.uv.x, 1.0 - ray.uv.y);
 
         // Bump mapping
@@ -85,18 +172,11 @@ vec3 castRay(Ray ray)
         float fogFactor = 1.0 - exp(-fogIntensity * ray.t);
         color += throughput * fogColor * fogFactor;
 
-        // Opacity
-        float opacity = mat.opacity;
-        if (mat.opacityTexIndex != -1)
-            opacity *= average(texture(textures[mat.opacityTexIndex], uv).xyz);
-
-        if (opacity < 1 && rand() > opacity)
+        if (bounce == 0)
         {
-            ray = Ray(ray.hitPoint + ray.dir * 0.001, ray.dir, RAY_DEFAULT_ARGS);
-            bounce--;
-            continue;
+            gbufferNormal = ray.surfaceNormal;
+            gbufferDepth = distance(cameraPos, ray.hitPoint);
         }
-
         ray.hitPoint += ray.surfaceNormal * 0.001;
 
         // Emissive material hit
@@ -108,13 +188,15 @@ vec3 castRay(Ray ray)
                 color = clamp(color, 0, 1);
                 break;
             }
-            else if (misSampleBrdf)
+            else if (misSampleBrdf && !isResamplingLights(bounce - 1))
             {
-                Light light = findTriLight(ray.hitTriIndex);
+                int lightIndex = getObjLightIndex(ray.hitObjIndex, ray.hitTriIndex);
                 Object obj = objects[ray.hitObjIndex];
 
                 vec3 L = normalize(ray.hitPoint - ray.pos);
-                float lightPdf = misSampleLight ? getLightPdf(light, obj, ray.pos, L, ray.hitPoint) : 0;
+                float lightPdf = 0;
+                if (misSampleLight && lightIndex != -1)
+                    lightPdf = getLightPdf(lights[lightIndex], obj, ray.pos, L, ray.hitPoint) * getLightSelectPdf(lightIndex);
                 float brdfMis = powerHeuristic(lastBrdfPdf, lightPdf);
 
                 color += throughput * mat.emission * brdfMis;
@@ -128,8 +210,39 @@ vec3 castRay(Ray ray)
         if (bounce > 2 && roughness < 0.05)
             roughness = mix(roughness, 0.2, float(bounce - 2) * 0.3);
 
+        if (useRadianceCache && bounce > 0)
+        {
+            uint checksum;
+            float cellSize;
+            float footprintScale = radianceCacheCellPixels * viewSize.y / (pixelSize.y * focalDistance);
+            uint hash = getRadianceCacheHash(ray.hitPoint, ray.surfaceNormal, cameraPos, footprintScale, checksum, cellSize);
+            if (trainsCache)
+            {
+                int cellIndex = trainCount < RADIANCE_CACHE_TRAIN_VERTICES ? findRadianceCell(hash, checksum, true) : -1;
+                if (cellIndex != -1)
+                {
+                    trainCells[trainCount] = cellIndex;
+                    trainColors[trainCount] = color;
+                    trainThroughputs[trainCount] = throughput;
+                    trainCount++;
+                }
+            }
+            else if (coneWidth > cellSize)
+            {
+                vec3 cachedRadiance;
+                int cellIndex = findRadianceCell(hash, checksum, false);
+                if (cellIndex != -1 && lookupRadianceCache(cellIndex, cachedRadiance))
+                {
+                    color += throughput * cachedRadiance;
+                    break;
+                }
+            }
+        }
+
         vec3 bounceDir;
-        vec3 albedo = texture(textures[int(mat.texIndex)], uv).xyz * mat.color;
+        float albedoLod = getTextureLod(textures[int(mat.texIndex)], texLodBase, coneWidth, ray.dir, ray.surfaceNormal);
+        vec3 albedo = textureLod(textures[int(mat.texIndex)], uv, albedoLod).xyz * mat.color;
+        if (bounce == 0) gbufferAlbedo = albedo;
 
         // Shade
         vec3 oldThroughput = throughput;
@@ -141,21 +254,100 @@ vec3 castRay(Ray ray)
         else
             color += oldThroughput * radiance;
 
+        if (trainsGuiding && guidingCount < GUIDING_TRAIN_VERTICES && lastBrdfPdf > 0.001)
+        {
+            guidingPositions[guidingCount] = ray.hitPoint;
+            guidingDirs[guidingCount] = bounceDir;
+            guidingColors[guidingCount] = color;
+            guidingThroughputs[guidingCount] = throughput;
+            guidingPdfs[guidingCount] = lastBrdfPdf;
+            guidingCount++;
+        }
+
         if (length(throughput) < 0.01) break;
         ray = Ray(ray.hitPoint, bounceDir, RAY_DEFAULT_ARGS);
+        coneSpread += roughness * roughness;
 
         // Russian roulette
         if (bounce > 3)
         {
             float p = clamp(maxv3(throughput), 0.05, 1.0);
-            if (rand() > p) break;
+            if (sample1D(bounce, SAMPLE_RUSSIAN_ROULETTE) > p) break;
             throughput /= p;
         }
     }
 
+    for (int i = 0; i < trainCount; i++)
+        trainRadianceCache(trainCells[i], (color - trainColors[i]) / max(trainThroughputs[i], vec3(1e-4)));
+
+    for (int i = 0; i < guidingCount; i++)
+    {
+        float incident = luminance((color - guidingColors[i]) / max(guidingThroughputs[i], vec3(1e-4)));
+        if (incident > 0)
+            addGuidingRecord(guidingPositions[i], guidingDirs[i], incident / guidingPdfs[i]);
+    }
+
     return color;
 }
 
+int getPrimaryCacheIndex()
+{
+    int position = int(samplerIndex % uint(primaryCachePositions));
+    return (pixel.y * int(pixelSize.x) + pixel.x) * primaryCachePositions + position;
+}
+
+// R2 points rotated per pixel, the same position is revisited every primaryCachePositions samples
+vec2 getPrimaryCacheJitter()
+{
+    uint position = samplerIndex % uint(primaryCachePositions);
+    uint hash = hashUint(samplerPixelSeed);
+    vec2 offset = vec2(hash & 0xffffu, hash >> 16) / 65536.0;
+    return fract(offset + float(position) * vec2(0.7548776662, 0.5698402910)) - 0.5;
+}
+
+// Returns false when the cached position has to be traced
+bool replayPrimaryHit(inout Ray ray, uvec2 cached, out bool hit)
+{
+    int objIndex = int(cached.x & ((1u << PRIMARY_CACHE_OBJECT_BITS) - 1)) - 1;
+    int triIndex = int(cached.y) - 1;
+    hit = objIndex != -1;
+    if (cached.x >> PRIMARY_CACHE_OBJECT_BITS != uint(primaryCacheEpoch)) return false;
+    if (!hit) return true;
+
+    Object obj = objects[objIndex];
+    bool replayed = triIndex != -1 ? intersectMeshTriangle(ray, obj, triIndex) : intersectPrimitive(ray, obj);
+    if (!replayed) return false;
+
+    ray.hitObjIndex = objIndex;
+    ray.hitTriIndex = triIndex;
+    return true;
+}
+
+// Returns false when the pixel has to be traced, primitives are not rasterized and are tested here
+bool resolveRasterHit(inout Ray ray, out bool hit)
+{
+    ivec2 ids = texelFetch(rasterHits, pixel, 0).xy;
+    hit = ids.x != -1;
+    if (hit)
+    {
+        Object obj = objects[ids.x];
+        beginMeshAlphaTest(obj);
+        if (getAlphaTestMaterial(ids.y) != -1 || !intersectMeshTriangle(ray, obj, ids.y)) return false;
+        ray.hitObjIndex = ids.x;
+    }
+
+    for (int i = 0; i < primObjCount; i++)
+    {
+        int objIndex = int(primObjIndices[i]);
+        if (intersectObj(ray, objects[objIndex], false))
+        {
+            hit = true;
+            ray.hitObjIndex = objIndex;
+        }
+    }
+    return true;
+}
+
 vec3 trace()
 {
     vec3 right = cameraRotMat[0].xyz;
@@ -171,53 +363,94 @@ vec3 trace()
     #ifdef BENCHMARK_BUILD
     vec2 jitter = vec2(0, 0);
     #else
-    vec2 jitter = vec2(rand(), rand()) - 0.5;
+    vec2 jitter = usePrimaryCache ? getPrimaryCacheJitter() : sample2D(-1, SAMPLE_CAMERA) - 0.5;
     #endif
+    if (useRasterPrimary)
+        jitter = rasterJitter;
 
     vec3 finalRayDir = normalize(lb + (x + jitter.x * dx) * right + (y + jitter.y * dy) * up);
-    return castRay(Ray(cameraPos, finalRayDir, RAY_DEFAULT_ARGS));
+    Ray ray = Ray(cameraPos, finalRayDir, RAY_DEFAULT_ARGS);
+
+    bool hit;
+    if (useRasterPrimary && resolveRasterHit(ray, hit))
+        return castRay(ray, hit);
+
+    int cacheIndex = usePrimaryCache ? getPrimaryCacheIndex() : -1;
+    if (cacheIndex == -1 || !replayPrimaryHit(ray, primaryHits[cacheIndex], hit))
+    {
+        stochasticOpacityTested = false;
+        hit = intersectWorld(ray, false);
+
+        // Hits decided by partial opacity are traced again, caching them would freeze one realization
+        if (cacheIndex != -1 && !stochasticOpacityTested)
+            primaryHits[cacheIndex] = uvec2(uint(primaryCacheEpoch) << PRIMARY_CACHE_OBJECT_BITS | uint(hit ? ray.hitObjIndex + 1 : 0), uint(hit ? ray.hitTriIndex + 1 : 0));
+    }
+    return castRay(ray, hit);
 }
 
-uniform sampler2D accumMeanTexture;
-uniform sampler2D accumSqrTexture;
+// Accumulated since the last reset, every invocation owns its pixel so plain load/store is enough
+layout(rgba32f, binding = 0) uniform image2D accumMeanImage; // a: mean of squared luminance
+layout(rgba16f, binding = 1) uniform image2D accumAlbedoImage;
+layout(rgba32f, binding = 2) uniform writeonly image2D normalDepthImage;
 
-layout(location = 1) out vec4 outMean;
-layout(location = 2) out vec4 outSqr;
-layout(location = 3) out vec4 outVariance;
+// Samples traced by each invocation before the accumulation is written back
+uniform int invocationSamples = 1;
 
 void main()
 {
-    InitRNG(gl_FragCoord.xy, frame * samplesPerPixel + totalSamples);
     // COLOR_DEBUG = vec3(0);
 
-    vec3 color = trace();
+    // Welford over the batch, kept in registers
+    vec3 batchMean = vec3(0);
+    float batchLumSqr = 0;
+    vec3 batchAlbedo = vec3(0);
+    for (int i = 0; i < invocationSamples; i++)
+    {
+        InitRNG(gl_FragCoord.xy, frame * samplesPerPixel + totalSamples + i);
+        InitSampler(ivec2(gl_FragCoord.xy), totalSamples + i);
+        gbufferAlbedo = vec3(1);
+        gbufferNormal = vec3(0);
+        gbufferDepth = 0;
+
+        vec3 color = trace();
+        float lum = luminance(color);
+        float weight = 1.0 / (i + 1);
+        batchMean += (color - batchMean) * weight;
+        batchLumSqr += (lum * lum - batchLumSqr) * weight;
+        batchAlbedo += (gbufferAlbedo - batchAlbedo) * weight;
+    }
+
+    if (useRestir)
+        storeReservoir(reservoirWriteOffset + pixel.y * reservoirStride + pixel.x, restirCarried);
+
     vec3 finalColor;
     #ifdef BENCHMARK_BUILD
     {
-        finalColor = color;
+        finalColor = batchMean;
     }
     #else
     {
-        vec2 uv = gl_FragCoord.xy / pixelSize;
-        vec3 prevMean = texture(accumMeanTexture, uv).rgb;
-        vec3 prevSqr = texture(accumSqrTexture, uv).rgb;
+        ivec2 texel = ivec2(gl_FragCoord.xy);
+        vec4 prevMean = imageLoad(accumMeanImage, texel);
+        vec3 prevAlbedo = imageLoad(accumAlbedoImage, texel).rgb;
 
         // Catch NaNs
-        if (prevMean != prevMean) prevMean = vec3(0);
-        if (prevSqr != prevSqr) prevSqr = vec3(0);
+        if (prevMean != prevMean) prevMean = vec4(0);
+        if (prevAlbedo != prevAlbedo) prevAlbedo = vec3(1);
 
-        vec3 newMean = mix(prevMean, color, 1.0 / (totalSamples + 1));
-        vec3 newSqr = mix(prevSqr, color * color, 1.0 / (totalSamples + 1));
-        vec3 variance = newSqr - newMean * newMean;
+        float batchWeight = float(invocationSamples) / (totalSamples + invocationSamples);
+        vec4 newMean = mix(prevMean, vec4(batchMean, batchLumSqr), batchWeight);
 
         // if (COLOR_DEBUG != vec3(-1))
-        //     newMean = COLOR_DEBUG;
+        //     newMean.rgb = COLOR_DEBUG;
+
+        imageStore(accumMeanImage, texel, newMean);
 
-        outMean = vec4(newMean, 1.0);
-        outSqr = vec4(newSqr, 1.0);
-        outVariance = vec4(variance, 1.0);
+        // Albedo is averaged like the color so demodulation matches at edges, the geometry is the latest sample
+        imageStore(accumAlbedoImage, texel, vec4(mix(prevAlbedo, batchAlbedo, batchWeight), 1.0));
+        imageStore(normalDepthImage, texel, vec4(gbufferNormal, gbufferDepth));
 
-        finalColor = newMean;
+        finalColor = newMean.rgb;
     }
     #endif
 
@@ -0,0 +1,10 @@
+#version 460 core
+
+flat in ivec2 hitIds;
+
+layout(location = 0) out ivec2 outHit;
+
+void main()
+{
+    outHit = hitIds;
+}
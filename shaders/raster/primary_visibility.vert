@@ -0,0 +1,19 @@
+#version 460 core
+#extension GL_ARB_shading_language_include : enable
+#include "common.glsl"
+
+// Drawn per mesh with its object as base instance and its first triangle as first vertex,
+// so the vertex id addresses the shared triangle buffer directly
+uniform mat4 viewProj;
+
+flat out ivec2 hitIds;
+
+void main()
+{
+    int triIndex = gl_VertexID / 3;
+    Object obj = objects[gl_BaseInstance];
+    vec3 localPos = triangles[triIndex].vertices[gl_VertexID % 3].posU.xyz;
+
+    gl_Position = viewProj * vec4(localToGlobal(localPos, obj), 1.0);
+    hitIds = ivec2(gl_BaseInstance, triIndex);
+}
@@ -0,0 +1,235 @@
+// ----------- RESTIR -----------
+// Direct lighting of the first bounce is resampled (Bitterli 2020, biased variant). Light candidates are
+// merged with the reservoirs of the previous draw around the reprojected pixel, which persist per pixel.
+// Samples are a light and a point on it, measured per light area, so every shading point shares
+// the measure and reused samples need no jacobian.
+
+#define RESTIR_NORMAL_TOLERANCE 0.9
+#define RESTIR_DISTANCE_TOLERANCE 0.05
+
+uniform bool useRestir = false;
+uniform int restirCandidates;
+uniform int restirSpatialSamples;
+uniform float restirSpatialRadius;
+uniform float restirMaxHistory;
+
+// Two halves swapped every draw, reads see the previous draw only. Reservoirs follow the guiding records
+// in frameRecords, starting at reservoirBase.
+uniform int reservoirBase;
+uniform int reservoirReadOffset;
+uniform int reservoirWriteOffset;
+uniform int reservoirStride;
+
+// Camera of the previous draw
+uniform vec3 prevCameraPos;
+uniform mat4 prevCameraRotMat;
+uniform vec2 prevPixelSize;
+
+struct Reservoir
+{
+    vec4 lightSample; // xyz: point on the light, direction for distant lights, w: light index
+    vec4 surface;     // xyz: shading point, w: samples seen
+    vec4 normal;      // xyz: shading normal, w: contribution weight
+};
+
+Reservoir loadReservoir(int index)
+{
+    int offset = reservoirBase + index * 3;
+    return Reservoir(frameRecords[offset], frameRecords[offset + 1], frameRecords[offset + 2]);
+}
+void storeReservoir(int index, Reservoir r)
+{
+    int offset = reservoirBase + index * 3;
+    frameRecords[offset] = r.lightSample;
+    frameRecords[offset + 1] = r.surface;
+    frameRecords[offset + 2] = r.normal;
+}
+
+struct ShadingPoint
+{
+    vec3 N;
+    vec3 V;
+    vec3 P;
+    vec3 diffColor;
+    vec3 specColor;
+    float roughness;
+};
+
+struct LightReservoir
+{
+    int lightIndex;
+    vec3 lightPoint;
+    float weightSum;
+    float count;
+    float targetPdf;
+};
+
+// Written back once per invocation, later samples of a batch continue from it
+Reservoir restirCarried = Reservoir(vec4(0), vec4(0), vec4(0));
+
+// Resampling only happens at the first hit, its decisions are drawn for bounce 0
+#define RESTIR_BOUNCE 0
+
+bool isResamplingLights(int bounce)
+{
+    return useRestir && bounce == RESTIR_BOUNCE && lightCount > 0;
+}
+
+bool isDistantLight(Light light)
+{
+    return light.lightType == LIGHT_TYPE_DIRECTIONAL || light.lightType == LIGHT_TYPE_ENVIRONMENTAL;
+}
+
+// Area lights include the geometry term, their area cancels against the uniform area pdf
+vec3 evalLightSample(int lightIndex, vec3 lightPoint, vec3 P, out vec3 L, out float dist, out float sourcePdf)
+{
+    Light light = lights[lightIndex];
+    sourcePdf = getLightSelectPdf(lightIndex);
+    if (isDistantLight(light))
+    {
+        L = lightPoint;
+        dist = 1e10;
+        if (light.lightType == LIGHT_TYPE_DIRECTIONAL)
+            return light.color * light.properties1.x;
+
+        sourcePdf *= getEnvMapPdf(L);
+        return sampleEnvMap(L) * light.color;
+    }
+
+    L = normalize(lightPoint - P);
+    dist = length(lightPoint - P);
+    if (light.lightType == LIGHT_TYPE_POINT)
+        return getPointLightFalloff(light, dist) * light.color * light.properties1.x;
+
+    if (light.lightType == LIGHT_TYPE_TRIANGLE)
+    {
+        Object obj = objects[int(light.properties1.z)];
+        vec3 emission = getObjMaterial(obj, int(light.properties1.x)).emission;
+        return emission / getLightPdf(light, obj, P, L, lightPoint);
+    }
+
+    Object obj = objects[int(light.properties1.x)];
+    return materials[obj.materialIndex].emission / getLightPdf(light, obj, P, L, lightPoint);
+}
+
+// Unshadowed contribution, also returns what it takes to shade the sample
+vec3 evalLightContribution(ShadingPoint s, int lightIndex, vec3 lightPoint, out vec3 L, out float dist, out float sourcePdf)
+{
+    vec3 radiance = evalLightSample(lightIndex, lightPoint, s.P, L, dist, sourcePdf);
+    float NdotL = clamp0(dot(L, s.N));
+    if (NdotL < 1e-5) return vec3(0);
+    return radiance * ggxBRDF(s.N, L, s.V, NdotL, s.roughness, s.specColor, s.diffColor) * NdotL;
+}
+float getTargetPdf(ShadingPoint s, int lightIndex, vec3 lightPoint, out float sourcePdf)
+{
+    vec3 L;
+    float dist;
+    return luminance(evalLightContribution(s, lightIndex, lightPoint, L, dist, sourcePdf));
+}
+
+// Each update is a repetition of the resample decision, candidates first, then the temporal and spatial reuse
+void updateReservoir(inout LightReservoir r, int update, int lightIndex, vec3 lightPoint, float weight, float count, float targetPdf)
+{
+    r.weightSum += weight;
+    r.count += count;
+    if (weight <= 0 || sample1D(RESTIR_BOUNCE, SAMPLE_RESTIR_RESAMPLE, update) * r.weightSum >= weight) return;
+
+    r.lightIndex = lightIndex;
+    r.lightPoint = lightPoint;
+    r.targetPdf = targetPdf;
+}
+
+bool isReusable(Reservoir stored, ShadingPoint s)
+{
+    int lightIndex = int(stored.lightSample.w);
+    if (stored.surface.w <= 0 || lightIndex < 0 || lightIndex >= lightCount) return false;
+    if (dot(stored.normal.xyz, s.N) < RESTIR_NORMAL_TOLERANCE) return false;
+    return distance(stored.surface.xyz, s.P) < RESTIR_DISTANCE_TOLERANCE * distance(cameraPos, s.P);
+}
+void mergeReservoir(inout LightReservoir r, int update, Reservoir stored, ShadingPoint s)
+{
+    int lightIndex = int(stored.lightSample.w);
+    float count = min(stored.surface.w, restirMaxHistory);
+    float sourcePdf;
+    float targetPdf = getTargetPdf(s, lightIndex, stored.lightSample.xyz, sourcePdf);
+    updateReservoir(r, update, lightIndex, stored.lightSample.xyz, targetPdf * stored.normal.w * count, count, targetPdf);
+}
+
+// Where the shading point was seen by the camera of the previous draw, fails outside of its view
+bool reprojectToPrevPixel(vec3 P, out ivec2 prevPixel)
+{
+    vec3 dir = P - prevCameraPos;
+    float z = dot(dir, prevCameraRotMat[2].xyz);
+    prevPixel = ivec2(-1);
+    if (z <= 0) return false;
+
+    vec2 pos = vec2(dot(dir, prevCameraRotMat[0].xyz), dot(dir, prevCameraRotMat[1].xyz)) * focalDistance / z + 0.5 * viewSize;
+    prevPixel = ivec2(pos / viewSize * prevPixelSize);
+    return all(greaterThanEqual(prevPixel, ivec2(0))) && all(lessThan(prevPixel, ivec2(prevPixelSize)));
+}
+Reservoir loadPrevReservoir(ivec2 p)
+{
+    return loadReservoir(reservoirReadOffset + p.y * reservoirStride + p.x);
+}
+
+vec3 getResampledDirectLighting(ShadingPoint s)
+{
+    LightReservoir r = LightReservoir(-1, vec3(0), 0, 0, 0);
+    for (int i = 0; i < restirCandidates; i++)
+    {
+        float selectPdf, lightPdf, dist;
+        vec3 L, radiance;
+        int lightIndex = sampleLightIndex(sample1D(RESTIR_BOUNCE, SAMPLE_RESTIR_LIGHT_SELECT, i), selectPdf);
+        sampleLight(lightIndex, s.P, sample2D(RESTIR_BOUNCE, SAMPLE_RESTIR_LIGHT_POS, i), L, radiance, dist, lightPdf);
+        vec3 lightPoint = isDistantLight(lights[lightIndex]) ? L : s.P + L * dist;
+
+        float sourcePdf;
+        float targetPdf = getTargetPdf(s, lightIndex, lightPoint, sourcePdf);
+        updateReservoir(r, i, lightIndex, lightPoint, sourcePdf > 0 ? targetPdf / sourcePdf : 0, 1, targetPdf);
+    }
+
+    // Earlier samples of the batch stand in for the previous draw at the same pixel
+    ivec2 prevPixel;
+    bool reprojected = reprojectToPrevPixel(s.P, prevPixel);
+    if (isReusable(restirCarried, s))
+        mergeReservoir(r, restirCandidates, restirCarried, s);
+    else if (reprojected)
+    {
+        Reservoir prev = loadPrevReservoir(prevPixel);
+        if (isReusable(prev, s))
+            mergeReservoir(r, restirCandidates, prev, s);
+    }
+
+    if (reprojected)
+    {
+        for (int i = 0; i < restirSpatialSamples; i++)
+        {
+            vec2 u = sample2D(RESTIR_BOUNCE, SAMPLE_RESTIR_SPATIAL, i);
+            vec2 offset = sampleCircleUniform(u.x, u.y).xy * restirSpatialRadius;
+            ivec2 neighbor = prevPixel + ivec2(offset);
+            if (neighbor == prevPixel || any(lessThan(neighbor, ivec2(0))) || any(greaterThanEqual(neighbor, ivec2(prevPixelSize)))) continue;
+
+            Reservoir stored = loadPrevReservoir(neighbor);
+            if (isReusable(stored, s))
+                mergeReservoir(r, restirCandidates + 1 + i, stored, s);
+        }
+    }
+
+    float W = r.lightIndex != -1 && r.targetPdf > 0 ? r.weightSum / (r.count * r.targetPdf) : 0;
+    vec3 color = vec3(0);
+    if (W > 0)
+    {
+        vec3 L;
+        float dist, sourcePdf;
+        vec3 contribution = evalLightContribution(s, r.lightIndex, r.lightPoint, L, dist, sourcePdf);
+
+        // Occluded samples are kept with no weight, so neighbours don't pick up the shadowed light
+        if (occluded(s.P, L, dist - 0.001))
+            W = 0;
+        color = contribution * W;
+    }
+
+    restirCarried = Reservoir(vec4(r.lightPoint, r.lightIndex), vec4(s.P, min(r.count, restirMaxHistory)), vec4(s.N, W));
+    return color;
+}
+// ----------- RESTIR -----------
@@ -1,6 +1,7 @@
 #include "BVH.h"
 
 #include "BVHMortonBuilder.h"
+#include "CpuBVH.h"
 #include "Triangle.h"
 #include "Utils.h"
 
@@ -12,14 +13,17 @@ void BVH::init()
 void BVH::buildBVH()
 {
 	builder->build();
+	CpuBVH::rebuild();
 }
 void BVH::rebuildBVH()
 {
  	builder->rebuild();
+	CpuBVH::rebuild();
 }
 void BVH::rebuildTopLevelBVH()
 {
 	builder->buildTopLevel();
+	CpuBVH::rebuildTopLevel();
 }
 
 AABB AABB::getUnitedBox(const AABB& box1, const AABB& box2)
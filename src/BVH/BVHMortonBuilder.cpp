@@ -3,6 +3,7 @@
 #include <execution>
 
 #include "BufferController.h"
+#include "BVH6SidedBuilder.h"
 #include "GLObject.h"
 #include "Graphical.h"
 #include "Model.h"
@@ -18,6 +19,7 @@ BVHMortonBuilder::BVHMortonBuilder()
 	_bvhMorton = make_unique<ComputeShaderProgram>("shaders/compute/bvh/bvh_part1_morton.comp");
 	_bvhBuild = make_unique<ComputeShaderProgram>("shaders/compute/bvh/bvh_part2_build.comp");
 	radixSort = make_unique<glu::RadixSort>();
+	BVH6SidedBuilder::init();
 
 	_ssboCenters = make_unique<SSBO>(TRI_CENTER_ALIGN);
 	_ssboMinMaxBound = make_unique<SSBO>(MIN_MAX_BOUND_ALIGN);
@@ -40,6 +42,7 @@ void BVHMortonBuilder::buildGPU()
 	int topLevelPrimCount = Scene::graphicals.size();
 	int nodeCount = 2 * n - models.size() + 2 * topLevelPrimCount - 1 + 1000;
 	BufferController::ssboBVHNodes()->ensureDataCapacity(nodeCount);
+	BufferController::ssboSceneTables()->ensureSectionCapacity((int)SceneTable::BVHLinks6, nodeCount * BufferController::BVH_LINKS6_ALIGN);
 
 	int nodeOffset = 2 * topLevelPrimCount + 1000;
 	int primOffset = 0;
@@ -128,6 +131,8 @@ void BVHMortonBuilder::buildCompute_tree(int nodeOffset, int n_, bool isTopLevel
 
 	_bvhBuild->setInt("pass", 3);
 	ComputeShaderProgram::dispatch({(2 * n_ - 1) / SHADER_GROUP_SIZE + 1, 1, 1}, GL_SHADER_STORAGE_BARRIER_BIT);
+
+	BVH6SidedBuilder::buildLinks(nodeOffset, 2 * n_ - 1);
 }
 
 //
@@ -0,0 +1,595 @@
+#include "CpuBVH.h"
+
+#include <algorithm>
+#include <numeric>
+
+#include "Graphical.h"
+#include "Model.h"
+#include "MyMath.h"
+#include "Scene.h"
+
+static float halfArea(const glm::vec3& min, const glm::vec3& max)
+{
+	glm::vec3 d = max - min;
+	return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+std::shared_ptr<const CpuBVH::Snapshot> CpuBVH::snapshot()
+{
+	std::lock_guard lock(_snapshotMutex);
+	return _snapshot;
+}
+
+void CpuBVH::rebuild()
+{
+	buildSnapshot(true);
+}
+void CpuBVH::rebuildTopLevel()
+{
+	buildSnapshot(false);
+}
+
+CpuBVH::Tree CpuBVH::buildTree(const std::vector<glm::vec3>& mins, const std::vector<glm::vec3>& maxs)
+{
+	struct Bin
+	{
+		glm::vec3 min = glm::vec3(FLT_MAX), max = glm::vec3(-FLT_MAX);
+		int count = 0;
+	};
+	struct Task
+	{
+		int node, start, count;
+	};
+
+	Tree tree;
+	int primCount = mins.size();
+	if (primCount == 0) return tree;
+
+	std::vector<glm::vec3> centers(primCount);
+	for (int i = 0; i < primCount; i++)
+		centers[i] = (mins[i] + maxs[i]) * 0.5f;
+
+	tree.indices.resize(primCount);
+	std::iota(tree.indices.begin(), tree.indices.end(), 0);
+	tree.nodes.reserve(primCount * 2);
+	tree.nodes.push_back({});
+
+	std::vector<Task> tasks = {{0, 0, primCount}};
+	while (!tasks.empty())
+	{
+		auto [nodeIndex, start, count] = tasks.back();
+		tasks.pop_back();
+
+		glm::vec3 min(FLT_MAX), max(-FLT_MAX), centerMin(FLT_MAX), centerMax(-FLT_MAX);
+		for (int i = start; i < start + count; i++)
+		{
+			int prim = tree.indices[i];
+			min = glm::min(min, mins[prim]);
+			max = glm::max(max, maxs[prim]);
+			centerMin = glm::min(centerMin, centers[prim]);
+			centerMax = glm::max(centerMax, centers[prim]);
+		}
+		tree.nodes[nodeIndex] = {min, start, max, count};
+		if (count <= MAX_LEAF_SIZE) continue;
+
+		// Binned SAH over the centroid bounds
+		int bestAxis = -1, bestSplit = -1;
+		float bestCost = count * halfArea(min, max);
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float extent = centerMax[axis] - centerMin[axis];
+			if (extent <= 0) continue;
+
+			Bin bins[BIN_COUNT];
+			float scale = BIN_COUNT / extent;
+			for (int i = start; i < start + count; i++)
+			{
+				int prim = tree.indices[i];
+				int b = std::min((int)((centers[prim][axis] - centerMin[axis]) * scale), BIN_COUNT - 1);
+				bins[b].min = glm::min(bins[b].min, mins[prim]);
+				bins[b].max = glm::max(bins[b].max, maxs[prim]);
+				bins[b].count++;
+			}
+
+			float rightCosts[BIN_COUNT];
+			Bin right;
+			for (int b = BIN_COUNT - 1; b > 0; b--)
+			{
+				right.min = glm::min(right.min, bins[b].min);
+				right.max = glm::max(right.max, bins[b].max);
+				right.count += bins[b].count;
+				rightCosts[b] = right.count == 0 ? 0 : right.count * halfArea(right.min, right.max);
+			}
+
+			Bin left;
+			for (int b = 0; b < BIN_COUNT - 1; b++)
+			{
+				left.min = glm::min(left.min, bins[b].min);
+				left.max = glm::max(left.max, bins[b].max);
+				left.count += bins[b].count;
+				float cost = (left.count == 0 ? 0 : left.count * halfArea(left.min, left.max)) + rightCosts[b + 1];
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = b;
+				}
+			}
+		}
+
+		int mid;
+		if (bestAxis != -1)
+		{
+			float scale = BIN_COUNT / (centerMax[bestAxis] - centerMin[bestAxis]);
+			auto midIt = std::partition(tree.indices.begin() + start, tree.indices.begin() + start + count, [&](int prim)
+			{
+				int b = std::min((int)((centers[prim][bestAxis] - centerMin[bestAxis]) * scale), BIN_COUNT - 1);
+				return b <= bestSplit;
+			});
+			mid = midIt - tree.indices.begin();
+		}
+		else
+		{
+			// Splitting does not pay off, but oversized leaves are still halved along the widest axis
+			if (count <= MAX_LEAF_SIZE * 4) continue;
+
+			glm::vec3 extent = centerMax - centerMin;
+			int axis = extent.x > extent.y ? extent.x > extent.z ? 0 : 2 : extent.y > extent.z ? 1 : 2;
+			mid = start + count / 2;
+			std::nth_element(tree.indices.begin() + start, tree.indices.begin() + mid, tree.indices.begin() + start + count, [&](int a, int b) { return centers[a][axis] < centers[b][axis]; });
+		}
+		if (mid == start || mid == start + count) mid = start + count / 2;
+
+		int left = tree.nodes.size();
+		tree.nodes.push_back({});
+		tree.nodes.push_back({});
+		tree.nodes[nodeIndex].start = left;
+		tree.nodes[nodeIndex].count = 0;
+
+		tasks.push_back({left, start, mid - start});
+		tasks.push_back({left + 1, mid, start + count - mid});
+	}
+	return tree;
+}
+
+std::shared_ptr<const CpuBVH::Blas> CpuBVH::buildBlas(const Model* model)
+{
+	auto blas = std::make_shared<Blas>();
+	blas->triStartIndex = model->triStartIndex();
+
+	const auto& baseTriangles = model->baseTriangles();
+	blas->triangles.resize(baseTriangles.size());
+	std::vector<glm::vec3> mins(baseTriangles.size()), maxs(baseTriangles.size());
+	for (int i = 0; i < baseTriangles.size(); i++)
+	{
+		auto& vertices = baseTriangles[i]->vertices();
+		auto& triangle = blas->triangles[i];
+		for (int v = 0; v < 3; v++)
+		{
+			triangle.pos[v] = vertices[v].pos;
+			triangle.normal[v] = vertices[v].normal;
+			triangle.uv[v] = vertices[v].uvPos;
+		}
+		mins[i] = min(min(triangle.pos[0], triangle.pos[1]), triangle.pos[2]);
+		maxs[i] = max(max(triangle.pos[0], triangle.pos[1]), triangle.pos[2]);
+	}
+	blas->tree = buildTree(mins, maxs);
+	return blas;
+}
+
+void CpuBVH::buildSnapshot(bool rebuildBlases)
+{
+	auto oldSnapshot = snapshot();
+	auto newSnapshot = std::make_shared<Snapshot>();
+
+	// Models keep their triangles after init, so trees are only built for new or moved ones
+	std::vector<const Model*> newModels;
+	for (auto graphical : Scene::graphicals)
+	{
+		auto mesh = dynamic_cast<Mesh*>(graphical);
+		if (mesh == nullptr || mesh->model() == nullptr || newSnapshot->blases.contains(mesh->model()->id())) continue;
+
+		auto model = mesh->model();
+		auto it = oldSnapshot->blases.find(model->id());
+		bool valid = it != oldSnapshot->blases.end() && (!rebuildBlases || (it->second->triStartIndex == model->triStartIndex() && it->second->triangles.size() == model->baseTriangles().size()));
+		newSnapshot->blases[model->id()] = valid ? it->second : nullptr;
+		if (!valid) newModels.push_back(model);
+	}
+
+	std::vector<std::shared_ptr<const Blas>> newBlases(newModels.size());
+	#pragma omp parallel for
+	for (int i = 0; i < newModels.size(); i++)
+		newBlases[i] = buildBlas(newModels[i]);
+	for (int i = 0; i < newModels.size(); i++)
+		newSnapshot->blases[newModels[i]->id()] = newBlases[i];
+
+	std::vector<glm::vec3> mins, maxs;
+	for (int i = 0; i < Scene::graphicals.size(); i++)
+	{
+		auto obj = Scene::graphicals[i];
+		if (obj == nullptr) continue;
+
+		Instance instance {};
+		instance.objIndex = i;
+		instance.pos = obj->pos();
+		auto toWorld = obj->getTransform();
+		instance.toLocal = inverse(toWorld);
+		instance.normalToWorld = transpose(glm::mat3(instance.toLocal));
+
+		glm::vec3 localMin, localMax;
+		if (auto mesh = dynamic_cast<Mesh*>(obj))
+		{
+			if (mesh->model() == nullptr || mesh->model()->baseTriangles().empty()) continue;
+			instance.objType = 0;
+			instance.blas = newSnapshot->blases[mesh->model()->id()];
+			localMin = mesh->model()->boundsMin();
+			localMax = mesh->model()->boundsMax();
+		}
+		else if (auto sphere = dynamic_cast<Sphere*>(obj))
+		{
+			instance.objType = 1;
+			instance.radius = sphere->radius() * sphere->scale().x;
+			localMin = glm::vec3(-sphere->radius());
+			localMax = glm::vec3(sphere->radius());
+		}
+		else if (dynamic_cast<Plane*>(obj))
+		{
+			instance.objType = 2;
+			newSnapshot->unboundedInstances.push_back(newSnapshot->instances.size());
+			newSnapshot->instances.push_back(instance);
+			continue;
+		}
+		else if (auto disk = dynamic_cast<Disk*>(obj))
+		{
+			instance.objType = 3;
+			instance.radius = disk->radius() * disk->scale().x;
+			localMin = {-disk->radius(), 0, -disk->radius()};
+			localMax = {disk->radius(), 0, disk->radius()};
+		}
+		else
+			continue;
+
+		Math::transformBounds(toWorld, localMin, localMax, instance.min, instance.max);
+
+		mins.push_back(instance.min);
+		maxs.push_back(instance.max);
+		newSnapshot->instances.push_back(instance);
+	}
+
+	// The top level indexes the bounded instances only, which come in order after skipping planes
+	std::vector<int> boundedInstances;
+	for (int i = 0; i < newSnapshot->instances.size(); i++)
+	{
+		if (newSnapshot->instances[i].objType != 2)
+			boundedInstances.push_back(i);
+	}
+	newSnapshot->tlas = buildTree(mins, maxs);
+	for (auto& index : newSnapshot->tlas.indices)
+		index = boundedInstances[index];
+
+	std::lock_guard lock(_snapshotMutex);
+	_snapshot = std::move(newSnapshot);
+}
+
+bool CpuBVH::intersectBox(const glm::vec3& min, const glm::vec3& max, const glm::vec3& pos, const glm::vec3& invDir, float tMax, float& tEntry)
+{
+	glm::vec3 t0 = (min - pos) * invDir;
+	glm::vec3 t1 = (max - pos) * invDir;
+	glm::vec3 tNear = glm::min(t0, t1);
+	glm::vec3 tFar = glm::max(t0, t1);
+
+	tEntry = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+	float tExit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+	return tEntry <= tExit;
+}
+
+bool CpuBVH::intersectTriangle(const std::array<glm::vec3, 3>& tri, const glm::vec3& pos, const glm::vec3& dir, float& t, glm::vec2& uv)
+{
+	glm::vec3 e1 = tri[1] - tri[0];
+	glm::vec3 e2 = tri[2] - tri[0];
+	glm::vec3 pv = cross(dir, e2);
+	float det = dot(e1, pv);
+	if (det == 0) return false;
+
+	float invDet = 1.0f / det;
+	glm::vec3 tv = pos - tri[0];
+	float u = dot(tv, pv) * invDet;
+	if (u < -0.00001f || u > 1.00001f) return false;
+
+	glm::vec3 qv = cross(tv, e1);
+	float v = dot(dir, qv) * invDet;
+	if (v < -0.00001f || u + v > 1.00001f) return false;
+
+	float hitT = dot(e2, qv) * invDet;
+	if (hitT <= 0 || hitT >= t) return false;
+
+	t = hitT;
+	uv = {u, v};
+	return true;
+}
+
+bool CpuBVH::intersectSphere(const glm::vec3& center, float radius, const glm::vec3& pos, const glm::vec3& dir, float& t)
+{
+	glm::vec3 inter = pos - center;
+	float a = dot(dir, dir);
+	float b = 2 * dot(dir, inter);
+	float c = dot(inter, inter) - radius * radius;
+	float discr = b * b - 4 * a * c;
+	if (discr < 0) return false;
+
+	float sqrtDiscr = sqrt(discr);
+	float x0 = (-b - sqrtDiscr) / (2 * a);
+	float x1 = (-b + sqrtDiscr) / (2 * a);
+	float hitT = x0 > 0 ? x0 : x1;
+	if (hitT <= 0 || hitT >= t) return false;
+
+	t = hitT;
+	return true;
+}
+
+bool CpuBVH::intersectBlas(const Blas& blas, const glm::vec3& pos, const glm::vec3& dir, float& t, glm::vec2& uv, int& triIndex, bool anyHit)
+{
+	const auto& nodes = blas.tree.nodes;
+	if (nodes.empty()) return false;
+
+	glm::vec3 invDir = 1.0f / dir;
+	float tEntry;
+	if (!intersectBox(nodes[0].min, nodes[0].max, pos, invDir, t, tEntry)) return false;
+
+	bool hit = false;
+	std::vector<int> stack = {0};
+	stack.reserve(STACK_RESERVE);
+	while (!stack.empty())
+	{
+		const auto& node = nodes[stack.back()];
+		stack.pop_back();
+		if (node.count > 0)
+		{
+			for (int i = node.start; i < node.start + node.count; i++)
+			{
+				int tri = blas.tree.indices[i];
+				if (!intersectTriangle(blas.triangles[tri].pos, pos, dir, t, uv)) continue;
+
+				hit = true;
+				triIndex = tri;
+				if (anyHit) return true;
+			}
+			continue;
+		}
+
+		// Visit the nearer child first and skip children behind the current hit
+		float tLeft, tRight;
+		bool hitLeft = intersectBox(nodes[node.start].min, nodes[node.start].max, pos, invDir, t, tLeft);
+		bool hitRight = intersectBox(nodes[node.start + 1].min, nodes[node.start + 1].max, pos, invDir, t, tRight);
+		if (hitLeft && hitRight)
+		{
+			bool leftFirst = tLeft <= tRight;
+			stack.push_back(leftFirst ? node.start + 1 : node.start);
+			stack.push_back(leftFirst ? node.start : node.start + 1);
+		}
+		else if (hitLeft)
+			stack.push_back(node.start);
+		else if (hitRight)
+			stack.push_back(node.start + 1);
+	}
+	return hit;
+}
+
+bool CpuBVH::intersectInstance(const Instance& instance, const glm::vec3& pos, const glm::vec3& dir, BVHHit& hit, bool anyHit)
+{
+	if (instance.objType == 0)
+	{
+		// The local direction is left unnormalized, so the hit distance stays in world units
+		glm::vec3 localPos = instance.toLocal * glm::vec4(pos, 1);
+		glm::vec3 localDir = glm::mat3(instance.toLocal) * dir;
+
+		glm::vec2 bary;
+		int tri;
+		if (!intersectBlas(*instance.blas, localPos, localDir, hit.t, bary, tri, anyHit)) return false;
+
+		const auto& triangle = instance.blas->triangles[tri];
+		float w = 1 - bary.x - bary.y;
+		glm::vec3 norm = normalize(instance.normalToWorld * (w * triangle.normal[0] + bary.x * triangle.normal[1] + bary.y * triangle.normal[2]));
+		glm::vec3 geomNorm = instance.normalToWorld * cross(triangle.pos[1] - triangle.pos[0], triangle.pos[2] - triangle.pos[0]);
+		if (dot(geomNorm, norm) < 0) geomNorm = -geomNorm;
+
+		hit.normal = dot(geomNorm, dir) <= 0 ? norm : -norm;
+		hit.uv = w * triangle.uv[0] + bary.x * triangle.uv[1] + bary.y * triangle.uv[2];
+		hit.triIndex = instance.blas->triStartIndex + tri;
+	}
+	else if (instance.objType == 1)
+	{
+		if (!intersectSphere(instance.pos, instance.radius, pos, dir, hit.t)) return false;
+
+		hit.normal = normalize(pos + dir * hit.t - instance.pos);
+		glm::vec3 uvN = glm::mat3(instance.toLocal) * hit.normal;
+		hit.uv = {atan2(uvN.z, uvN.x) / (2 * PI) + 0.5f, uvN.y * 0.5f + 0.5f};
+		hit.triIndex = -1;
+	}
+	else
+	{
+		// Planes and disks share the plane test, disks additionally clip by radius
+		glm::vec3 normal = normalize(instance.normalToWorld * vec3::UP);
+		float denom = -dot(normal, dir);
+		if (denom == 0) return false;
+
+		float t = -dot(normal, instance.pos - pos) / denom;
+		if (t <= 0 || t >= hit.t) return false;
+
+		glm::vec3 inter = pos + dir * t - instance.pos;
+		if (instance.objType == 3 && dot(inter, inter) > instance.radius * instance.radius) return false;
+
+		hit.t = t;
+		hit.normal = dot(dir, normal) < 0 ? normal : -normal;
+		hit.uv = {};
+		hit.triIndex = -1;
+	}
+
+	hit.objIndex = instance.objIndex;
+	return true;
+}
+
+bool CpuBVH::traverse(const Snapshot& snapshot, const glm::vec3& pos, const glm::vec3& dir, BVHHit& hit, bool anyHit)
+{
+	bool didHit = false;
+	for (int i : snapshot.unboundedInstances)
+	{
+		if (!intersectInstance(snapshot.instances[i], pos, dir, hit, anyHit)) continue;
+
+		didHit = true;
+		if (anyHit) return true;
+	}
+
+	const auto& nodes = snapshot.tlas.nodes;
+	if (nodes.empty()) return didHit;
+
+	glm::vec3 invDir = 1.0f / dir;
+	float tEntry;
+	if (!intersectBox(nodes[0].min, nodes[0].max, pos, invDir, hit.t, tEntry)) return didHit;
+
+	std::vector<int> stack = {0};
+	stack.reserve(STACK_RESERVE);
+	while (!stack.empty())
+	{
+		const auto& node = nodes[stack.back()];
+		stack.pop_back();
+		if (node.count > 0)
+		{
+			for (int i = node.start; i < node.start + node.count; i++)
+			{
+				const auto& instance = snapshot.instances[snapshot.tlas.indices[i]];
+				if (!intersectBox(instance.min, instance.max, pos, invDir, hit.t, tEntry)) continue;
+				if (!intersectInstance(instance, pos, dir, hit, anyHit)) continue;
+
+				didHit = true;
+				if (anyHit) return true;
+			}
+			continue;
+		}
+
+		float tLeft, tRight;
+		bool hitLeft = intersectBox(nodes[node.start].min, nodes[node.start].max, pos, invDir, hit.t, tLeft);
+		bool hitRight = intersectBox(nodes[node.start + 1].min, nodes[node.start + 1].max, pos, invDir, hit.t, tRight);
+		if (hitLeft && hitRight)
+		{
+			bool leftFirst = tLeft <= tRight;
+			stack.push_back(leftFirst ? node.start + 1 : node.start);
+			stack.push_back(leftFirst ? node.start : node.start + 1);
+		}
+		else if (hitLeft)
+			stack.push_back(node.start);
+		else if (hitRight)
+			stack.push_back(node.start + 1);
+	}
+	return didHit;
+}
+
+bool CpuBVH::raycast(const glm::vec3& pos, const glm::vec3& dir, float maxDis, BVHHit& hit)
+{
+	hit = {};
+	hit.t = maxDis;
+	if (!traverse(*snapshot(), pos, dir, hit, false)) return false;
+
+	hit.pos = pos + dir * hit.t;
+	return true;
+}
+
+bool CpuBVH::anyHit(const glm::vec3& pos, const glm::vec3& dir, float maxDis)
+{
+	BVHHit hit {};
+	hit.t = maxDis;
+	return traverse(*snapshot(), pos, dir, hit, true);
+}
+
+std::vector<int> CpuBVH::overlapBox(const glm::vec3& min, const glm::vec3& max)
+{
+	auto snap = snapshot();
+	std::vector<int> result;
+
+	// A plane overlaps the box when the box corners are not all on one side of it
+	for (int i : snap->unboundedInstances)
+	{
+		const auto& instance = snap->instances[i];
+		glm::vec3 normal = instance.normalToWorld * vec3::UP;
+		glm::vec3 center = (min + max) * 0.5f;
+		float radius = dot(abs(normal), (max - min) * 0.5f);
+		if (abs(dot(normal, center - instance.pos)) <= radius)
+			result.push_back(instance.objIndex);
+	}
+
+	const auto& nodes = snap->tlas.nodes;
+	if (nodes.empty()) return result;
+
+	auto overlaps = [&](const glm::vec3& boxMin, const glm::vec3& boxMax)
+	{
+		return all(lessThanEqual(boxMin, max)) && all(greaterThanEqual(boxMax, min));
+	};
+
+	std::vector<int> stack = {0};
+	stack.reserve(STACK_RESERVE);
+	while (!stack.empty())
+	{
+		const auto& node = nodes[stack.back()];
+		stack.pop_back();
+		if (!overlaps(node.min, node.max)) continue;
+
+		if (node.count > 0)
+		{
+			for (int i = node.start; i < node.start + node.count; i++)
+			{
+				const auto& instance = snap->instances[snap->tlas.indices[i]];
+				if (overlaps(instance.min, instance.max))
+					result.push_back(instance.objIndex);
+			}
+			continue;
+		}
+		stack.push_back(node.start);
+		stack.push_back(node.start + 1);
+	}
+	return result;
+}
+
+std::vector<int> CpuBVH::overlapFrustum(const std::array<glm::vec4, 6>& planes)
+{
+	auto snap = snapshot();
+	std::vector<int> result;
+	for (int i : snap->unboundedInstances)
+		result.push_back(snap->instances[i].objIndex);
+
+	const auto& nodes = snap->tlas.nodes;
+	if (nodes.empty()) return result;
+
+	// Planes point inwards, a box is outside when its most positive corner is behind any of them
+	auto overlaps = [&](const glm::vec3& boxMin, const glm::vec3& boxMax)
+	{
+		for (const auto& plane : planes)
+		{
+			glm::vec3 corner = glm::mix(boxMin, boxMax, glm::greaterThanEqual(glm::vec3(plane), glm::vec3(0)));
+			if (dot(glm::vec3(plane), corner) + plane.w < 0) return false;
+		}
+		return true;
+	};
+
+	std::vector<int> stack = {0};
+	stack.reserve(STACK_RESERVE);
+	while (!stack.empty())
+	{
+		const auto& node = nodes[stack.back()];
+		stack.pop_back();
+		if (!overlaps(node.min, node.max)) continue;
+
+		if (node.count > 0)
+		{
+			for (int i = node.start; i < node.start + node.count; i++)
+			{
+				const auto& instance = snap->instances[snap->tlas.indices[i]];
+				if (overlaps(instance.min, instance.max))
+					result.push_back(instance.objIndex);
+			}
+			continue;
+		}
+		stack.push_back(node.start);
+		stack.push_back(node.start + 1);
+	}
+	return result;
+}
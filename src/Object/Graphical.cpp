@@ -87,22 +87,39 @@ Mesh::Mesh(Model* model, glm::vec3 pos, glm::quat rot, glm::vec3 scale) : Graphi
 {
 	init(model);
 }
-Mesh::Mesh(const Mesh& orig) : Graphical(orig), _model(orig._model)
+Mesh::Mesh(const Mesh& orig) : Graphical(orig), _model(orig._model), _useModelMaterials(orig._useModelMaterials)
 {
 	init(orig._model);
 }
 void Mesh::init(Model* model)
 {
 	setModel(model);
+	if (_useModelMaterials && _model != nullptr)
+		_model->loadMaterials();
 }
 
 void Mesh::setModel(Model* model)
 {
 	if (model == _model) return;
 	_model = model;
+	if (_useModelMaterials && _model != nullptr)
+		_model->loadMaterials();
 
 	BufferController::markBufferForUpdate(BufferType::Objects);
 }
+void Mesh::setUseModelMaterials(bool useModelMaterials)
+{
+	if (useModelMaterials == _useModelMaterials) return;
+	_useModelMaterials = useModelMaterials;
+	if (_useModelMaterials && _model != nullptr)
+		_model->loadMaterials();
+
+	BufferController::markBufferForUpdate(BufferType::Objects);
+}
+bool Mesh::usesModelMaterials() const
+{
+	return _useModelMaterials && _model != nullptr && !_model->materials().empty();
+}
 
 Square::Square() : _side(0)
 {
@@ -1,26 +1,28 @@
 #include "Material.h"
 
+#include <fstream>
 #include <stb_image.h>
 #include <tinyexr.h>
 
 #include "BufferController.h"
 #include "Scene.h"
+#include "TextureStreamer.h"
 #include "Utils.h"
 
+static float srgbToLinear(float c)
+{
+	return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+}
+static float linearToSrgb(float c)
+{
+	return c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+}
+
 Texture::Texture(const std::filesystem::path& path) : _id(_nextAvailableId++), _path(path.string())
 {
 	Scene::textures.push_back(this);
 
-	std::vector<float> image;
-	if (!readImage(image, path))
-	{
-		Debug::logError("Error loading texture: ", path);
-		return;
-	}
-	initData(image);
-
-	_glTex = std::make_unique<GLTexture2D>(_width, _height, _data, GL_RGBA, GL_RGBA32F, GL_LINEAR, GL_FLOAT);
-	_glTex->setWrapMode(GL_REPEAT);
+	TextureStreamer::request(this);
 
 	BufferController::markBufferForUpdate(BufferType::Textures);
 }
@@ -30,17 +32,21 @@ Texture::Texture(Color color) : _id(_nextAvailableId++)
 
 	_width = 2;
 	_height = 2;
+	_isHdr = true;
 
-	_data = new float[4 * sizeof(Color)];
+	_mips.resize(1);
+	_mips[0].resize(_width * _height * sizeof(Color));
+	auto data = (float*)_mips[0].data();
 	for (int i = 0; i < _width * _height; ++i)
 	{
-		_data[i * 4 + 0] = color.x;
-		_data[i * 4 + 1] = color.y;
-		_data[i * 4 + 2] = color.z;
-		_data[i * 4 + 3] = color.w;
+		data[i * 4 + 0] = color.x;
+		data[i * 4 + 1] = color.y;
+		data[i * 4 + 2] = color.z;
+		data[i * 4 + 3] = color.w;
 	}
 
-	_glTex = std::make_unique<GLTexture2D>(_width, _height, _data, GL_RGBA, GL_RGBA32F, GL_LINEAR, GL_FLOAT);
+	_glTex = std::make_unique<GLTexture2D>(_width, _height, data, GL_RGBA, GL_RGBA32F, GL_LINEAR, GL_FLOAT);
+	_state = TextureState::Ready;
 
 	BufferController::markBufferForUpdate(BufferType::Textures);
 }
@@ -48,7 +54,7 @@ Texture::Texture(const Texture& other) : Texture(other._path) {}
 
 Texture::~Texture()
 {
-	delete[] _data;
+	TextureStreamer::cancel(this);
 	std::erase(Scene::textures, this);
 }
 
@@ -58,70 +64,199 @@ Texture* Texture::defaultTex()
 	return &instance;
 }
 
-bool Texture::readImage(std::vector<float>& data_v, const std::filesystem::path& path)
+bool Texture::load(const std::filesystem::path& path)
+{
+	auto cachePath = getMipCachePath(path);
+	if (readMipCache(cachePath)) return true;
+
+	if (!readImage(path)) return false;
+	generateMips();
+	writeMipCache(cachePath);
+	return true;
+}
+size_t Texture::byteSize() const
+{
+	size_t size = 0;
+	for (const auto& level : _mips)
+		size += level.size();
+	return size;
+}
+
+uint64_t Texture::handle() const
+{
+	return _glTex ? _glTex->getHandle() : TextureStreamer::placeholderHandle();
+}
+void Texture::waitUntilLoaded()
+{
+	TextureStreamer::finish(this);
+}
+
+bool Texture::readImage(const std::filesystem::path& path)
 {
 	int n;
 	if (path.extension() == ".exr")
-		return readImageExr(data_v, path);
+		return readImageExr(path);
 
 	unsigned char* data = stbi_load(path.string().c_str(), &_width, &_height, &n, STBI_rgb_alpha);
+	if (data == nullptr) return false;
 
-	if (data != nullptr)
-	{
-		data_v.resize(_width * _height * 4);
-		for (int i = 0; i < _width * _height * 4; ++i)
-			data_v[i] = data[i] / 255.0f;
-	}
+	_isHdr = false;
+	_mips.resize(1);
+	_mips[0].assign(data, data + _width * _height * 4);
 
 	stbi_image_free(data);
 	return true;
 }
-bool Texture::readImageExr(std::vector<float>& data_v, const std::filesystem::path& path)
+bool Texture::readImageExr(const std::filesystem::path& path)
 {
 	float* exrData = nullptr;
 	const char* err;
 
 	int ret = LoadEXR(&exrData, &_width, &_height, path.string().c_str(), &err);
 
-	if (ret != TINYEXR_SUCCESS && err)
+	if (ret != TINYEXR_SUCCESS)
 	{
-		fprintf(stderr, "ERR : %s\n", err);
-		FreeEXRErrorMessage(err);
-
+		if (err)
+		{
+			fprintf(stderr, "ERR : %s\n", err);
+			FreeEXRErrorMessage(err);
+		}
 		return false;
 	}
 
-	data_v.resize(_width * _height * 4);
-	for (int i = 0; i < _width * _height; ++i)
+	_isHdr = true;
+	_mips.resize(1);
+	_mips[0].assign((unsigned char*)exrData, (unsigned char*)(exrData + _width * _height * 4));
+
+	free(exrData);
+	return true;
+}
+
+void Texture::generateMips()
+{
+	int levelCount = (int)floor(log2(std::max(_width, _height))) + 1;
+	_mips.resize(levelCount);
+
+	float srgbToLinearTable[256];
+	for (int i = 0; i < 256; i++)
+		srgbToLinearTable[i] = srgbToLinear(i / 255.0f);
+
+	for (int level = 1; level < levelCount; level++)
 	{
-		float r = exrData[4 * i + 0];
-		float g = exrData[4 * i + 1];
-		float b = exrData[4 * i + 2];
-		float a = exrData[4 * i + 3];
-
-		data_v[4 * i + 0] = powf(r, 1.0f / 2.2f);
-		data_v[4 * i + 1] = powf(g, 1.0f / 2.2f);
-		data_v[4 * i + 2] = powf(b, 1.0f / 2.2f);
-		data_v[4 * i + 3] = a;
+		int prevWidth = std::max(1, _width >> (level - 1));
+		int prevHeight = std::max(1, _height >> (level - 1));
+		int width = std::max(1, _width >> level);
+		int height = std::max(1, _height >> level);
+
+		const auto& prev = _mips[level - 1];
+		auto& curr = _mips[level];
+		curr.resize(width * height * (_isHdr ? 4 * sizeof(float) : 4));
+
+		#pragma omp parallel for
+		for (int y = 0; y < height; y++)
+		{
+			int y0 = std::min(2 * y, prevHeight - 1), y1 = std::min(2 * y + 1, prevHeight - 1);
+			for (int x = 0; x < width; x++)
+			{
+				int x0 = std::min(2 * x, prevWidth - 1), x1 = std::min(2 * x + 1, prevWidth - 1);
+				int srcIndices[4] = {y0 * prevWidth + x0, y0 * prevWidth + x1, y1 * prevWidth + x0, y1 * prevWidth + x1};
+				int dstIndex = y * width + x;
+
+				if (_isHdr)
+				{
+					auto src = (const float*)prev.data();
+					auto dst = (float*)curr.data();
+					for (int c = 0; c < 4; c++)
+						dst[dstIndex * 4 + c] = 0.25f * (src[srcIndices[0] * 4 + c] + src[srcIndices[1] * 4 + c] + src[srcIndices[2] * 4 + c] + src[srcIndices[3] * 4 + c]);
+				}
+				else
+				{
+					for (int c = 0; c < 4; c++)
+					{
+						float sum = 0;
+						for (int srcIndex : srcIndices)
+						{
+							unsigned char value = prev[srcIndex * 4 + c];
+							sum += c < 3 ? srgbToLinearTable[value] : value / 255.0f;
+						}
+						float avg = c < 3 ? linearToSrgb(sum * 0.25f) : sum * 0.25f;
+						curr[dstIndex * 4 + c] = (unsigned char)std::clamp(avg * 255.0f + 0.5f, 0.0f, 255.0f);
+					}
+				}
+			}
+		}
 	}
+}
 
-	return true;
+std::filesystem::path Texture::getMipCachePath(const std::filesystem::path& path)
+{
+	std::error_code ec;
+	auto fileSize = std::filesystem::file_size(path, ec);
+	auto writeTime = std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+	auto key = std::filesystem::absolute(path, ec).string() + "|" + std::to_string(fileSize) + "|" + std::to_string(writeTime);
+
+	return MIP_CACHE_DIR / (std::to_string(std::hash<std::string>()(key)) + ".mips");
 }
+bool Texture::readMipCache(const std::filesystem::path& cachePath)
+{
+	std::ifstream file(cachePath, std::ios::binary);
+	if (!file) return false;
+
+	int header[5];
+	file.read((char*)header, sizeof(header));
+	if (!file || header[0] != MIP_CACHE_VERSION || header[1] <= 0 || header[2] <= 0 || header[4] <= 0) return false;
+
+	_width = header[1];
+	_height = header[2];
+	_isHdr = header[3] != 0;
+	_mips.resize(header[4]);
+	for (int level = 0; level < _mips.size(); level++)
+	{
+		int width = std::max(1, _width >> level);
+		int height = std::max(1, _height >> level);
+		_mips[level].resize(width * height * (_isHdr ? 4 * sizeof(float) : 4));
+		file.read((char*)_mips[level].data(), _mips[level].size());
+	}
 
-void Texture::initData(const std::vector<float>& image)
+	if (!file)
+	{
+		_mips.clear();
+		return false;
+	}
+	return true;
+}
+void Texture::writeMipCache(const std::filesystem::path& cachePath) const
 {
-	_data = new float[_width * _height * 4];
-	memcpy(_data, image.data(), _width * _height * 4 * sizeof(float));
+	std::error_code ec;
+	std::filesystem::create_directories(cachePath.parent_path(), ec);
+
+	std::ofstream file(cachePath, std::ios::binary);
+	if (!file) return;
+
+	int header[5] = {MIP_CACHE_VERSION, _width, _height, _isHdr, (int)_mips.size()};
+	file.write((const char*)header, sizeof(header));
+	for (const auto& level : _mips)
+		file.write((const char*)level.data(), level.size());
 }
 
-void Texture::setWrapMode(GLint wrapMode) const
+void Texture::setWrapMode(GLint wrapMode)
 {
-	_glTex->setWrapMode(wrapMode);
+	_wrapMode = wrapMode;
+	if (_glTex) _glTex->setWrapMode(wrapMode);
 }
 Color Texture::colorAt(int x, int y) const
 {
+	if (_mips.empty()) return Color::white();
+
 	int i = (y * _width + x) * 4;
-	return Color(_data[i + 0], _data[i + 1], _data[i + 2], _data[i + 3]);
+	if (_isHdr)
+	{
+		auto data = (const float*)_mips[0].data();
+		return Color(data[i + 0], data[i + 1], data[i + 2], data[i + 3]);
+	}
+	Color color(_mips[0][i + 0] / 255.0f, _mips[0][i + 1] / 255.0f, _mips[0][i + 2] / 255.0f, _mips[0][i + 3] / 255.0f);
+	if (_isLinear) return color;
+	return Color(srgbToLinear(color.r()), srgbToLinear(color.g()), srgbToLinear(color.b()), color.a());
 }
 void WindyTexture::setScale(float scale)
 {
@@ -155,6 +290,19 @@ Material::Material(Color color, bool lit, Texture* texture, float roughness, flo
 	_roughness{roughness}, _metallic{metallic}
 {
 	Scene::materials.push_back(this);
+	if (_opacityTexture) _opacityTexture->setLinear(true);
+
+	if (!_freeSlots.empty())
+	{
+		_slot = _freeSlots.back();
+		_freeSlots.pop_back();
+		_slots[_slot] = this;
+	}
+	else
+	{
+		_slot = _slots.size();
+		_slots.push_back(this);
+	}
 
 	BufferController::markBufferForUpdate(BufferType::Materials);
 }
@@ -163,6 +311,9 @@ Material::Material(const Material& material) : Material(material._color, materia
 Material::~Material()
 {
 	std::erase(Scene::materials, this);
+
+	_slots[_slot] = nullptr;
+	_freeSlots.push_back(_slot);
 }
 
 void Material::setLit(bool lit)
@@ -199,6 +350,7 @@ void Material::setOpacity(float opacity)
 void Material::setOpacityTexture(Texture* texture)
 {
 	_opacityTexture = texture;
+	if (_opacityTexture) _opacityTexture->setLinear(true);
 
 	BufferController::markBufferForUpdate(BufferType::Materials);
 	BufferController::markBufferForUpdate(BufferType::Textures);
@@ -2,8 +2,10 @@
 
 #include <fstream>
 
+#include "Assets.h"
 #include "BufferController.h"
 #include "Debug.h"
+#include "Material.h"
 #include "MyMath.h"
 #include "rapidobj.hpp"
 #include "Scene.h"
@@ -25,6 +27,20 @@ void Model::init()
 {
 	Scene::models.push_back(this);
 
+	if (!_baseTriangles.empty())
+	{
+		_boundsMin = glm::vec3(FLT_MAX);
+		_boundsMax = glm::vec3(-FLT_MAX);
+		for (auto triangle : _baseTriangles)
+		{
+			for (auto& vertex : triangle->vertices())
+			{
+				_boundsMin = min(_boundsMin, vertex.pos);
+				_boundsMax = max(_boundsMax, vertex.pos);
+			}
+		}
+	}
+
 	_triStartIndex = Scene::baseTriangles.size();
 	Scene::baseTriangles.insert(Scene::baseTriangles.end(), this->_baseTriangles.begin(), this->_baseTriangles.end());
 	BufferController::markBufferForUpdate(BufferType::Triangles);
@@ -52,8 +68,19 @@ Model::~Model()
 	for (auto it = fromInd; it!= toInd; ++it)
 		*it = nullptr;
 
-	for (auto& triangle : _baseTriangles)
-		delete triangle;
+	if (_triangleStorage.empty())
+	{
+		for (auto& triangle : _baseTriangles)
+			delete triangle;
+	}
+
+	for (auto material : _materials)
+		delete material;
+}
+
+bool Model::hasEmissiveMaterial() const
+{
+	return std::ranges::any_of(_materials, [](const Material* mat) { return mat->emission() != Color::clear(); });
 }
 
 void Model::setBvhRootNode(int bvhRootNode)
@@ -61,9 +88,25 @@ void Model::setBvhRootNode(int bvhRootNode)
 	_bvhRootNode = bvhRootNode;
 }
 
+void Model::loadMaterials()
+{
+	if (!_materials.empty() || _library.empty()) return;
+
+	for (const auto& mtl : _library)
+	{
+		auto texture = !mtl.texturePath.empty() ? Assets::load<Texture>(mtl.texturePath) : Texture::defaultTex();
+		auto opacityTexture = !mtl.opacityTexturePath.empty() ? Assets::load<Texture>(mtl.opacityTexturePath) : nullptr;
+		_materials.push_back(new ::Material(mtl.color, true, texture, mtl.roughness, 0, mtl.emission, mtl.opacity, opacityTexture, mtl.specColor));
+	}
+
+	// Triangles hold the slots of their library material, emitters and alpha flags follow them
+	BufferController::markBufferForUpdate(BufferType::Triangles | BufferType::Lights | BufferType::Objects);
+}
+
 void Model::parseRapidobj(const std::filesystem::path& path)
 {
 	using namespace rapidobj;
+	// rapidobj memory-maps the file and parses it in parallel chunks, vertices are then written straight into the triangle storage
 	auto mtlLib = MaterialLibrary::Default(Load::Optional);
 	Result result = ParseFile(path, mtlLib);
 	if (result.error) Debug::logError("Error loading OBJ file: ", result.error.code.message());
@@ -71,57 +114,73 @@ void Model::parseRapidobj(const std::filesystem::path& path)
 	bool success = Triangulate(result);
 	if (!success) Debug::logError("Triangulation failed!");
 
-	std::atomic f = 0;
-	for (const auto& shape : result.shapes)
+	std::vector<int> shapeTriOffsets(result.shapes.size() + 1, 0);
+	for (int s = 0; s < result.shapes.size(); s++)
 	{
-		const auto& mesh = shape.mesh;
-		const auto& attributes = result.attributes;
+		const auto& faceVertices = result.shapes[s].mesh.num_face_vertices;
+		if (std::ranges::any_of(faceVertices, [](auto count) { return count != 3; })) throw std::runtime_error("Non triangle found after triangulation.");
+		shapeTriOffsets[s + 1] = shapeTriOffsets[s] + (int)faceVertices.size();
+	}
+
+	const auto& attributes = result.attributes;
+	int positionCount = attributes.positions.size() / 3;
+	int normalCount = attributes.normals.size() / 3;
+	int uvCount = attributes.texcoords.size() / 2;
 
-		_baseTriangles.resize(_baseTriangles.size() + mesh.num_face_vertices.size());
-		#ifndef NDEBUG
-		std::vector<Vertex> vertices(3);
-		#else
+	// Material library, Ns is mapped to GGX roughness as sqrt(2 / (Ns + 2))
+	auto mtlDir = path.parent_path();
+	for (const auto& mtl : result.materials)
+	{
+		auto [r, g, b] = mtl.diffuse;
+		auto [er, eg, eb] = mtl.emission;
+		auto [sr, sg, sb] = mtl.specular;
+
+		LibraryMaterial material;
+		material.color = Color(r, g, b);
+		material.specColor = Color(sr, sg, sb);
+		material.emission = er + eg + eb > 0 ? Color(er, eg, eb) : Color::clear();
+		material.roughness = sqrt(2 / (std::max(mtl.shininess, 0.0f) + 2));
+		material.opacity = mtl.dissolve;
+		if (!mtl.diffuse_texname.empty()) material.texturePath = mtlDir / mtl.diffuse_texname;
+		if (!mtl.alpha_texname.empty()) material.opacityTexturePath = mtlDir / mtl.alpha_texname;
+		_library.push_back(material);
+	}
+
+	_triangleStorage.resize(shapeTriOffsets.back());
+	for (int s = 0; s < result.shapes.size(); s++)
+	{
+		const auto& mesh = result.shapes[s].mesh;
+		int triOffset = shapeTriOffsets[s];
+		bool hasMaterialIds = !_library.empty() && mesh.material_ids.size() == shapeTriOffsets[s + 1] - triOffset;
+
+		#ifdef NDEBUG
 		#pragma omp parallel for
 		#endif
-		for (int j = 0; j < mesh.num_face_vertices.size(); j++)
+		for (int j = 0; j < shapeTriOffsets[s + 1] - triOffset; j++)
 		{
-			if (mesh.num_face_vertices[j] != 3) throw std::runtime_error("Non triangle found after triangulation.");
-			#ifdef NDEBUG
-			std::vector<Vertex> vertices(3);
-			#endif
+			auto& vertices = _triangleStorage[triOffset + j].vertices();
 			for (int v = 0; v < 3; v++)
 			{
 				const auto& [posIdx, uvIdx, normalIdx] = mesh.indices[j * 3 + v];
-				#ifndef NDEBUG
-				vertices[v] = Vertex();
-				#endif
-				vertices[v].pos.x = attributes.positions[posIdx * 3 + 0];
-				vertices[v].pos.y = attributes.positions[posIdx * 3 + 1];
-				vertices[v].pos.z = attributes.positions[posIdx * 3 + 2];
-
-				if (normalIdx >= 0 && normalIdx < attributes.normals.size() / 3)
-				{
-					vertices[v].normal.x = attributes.normals[normalIdx * 3 + 0];
-					vertices[v].normal.y = attributes.normals[normalIdx * 3 + 1];
-					vertices[v].normal.z = attributes.normals[normalIdx * 3 + 2];
-				}
+				if (posIdx >= 0 && posIdx < positionCount)
+					vertices[v].pos = {attributes.positions[posIdx * 3 + 0], attributes.positions[posIdx * 3 + 1], attributes.positions[posIdx * 3 + 2]};
 
-				if (uvIdx >= 0 && uvIdx < attributes.texcoords.size() / 2)
-				{
-					vertices[v].uvPos.x = Math::mod(attributes.texcoords[uvIdx * 2 + 0], 1.0f);
-					vertices[v].uvPos.y = Math::mod(attributes.texcoords[uvIdx * 2 + 1], 1.0f);
-				}
+				if (normalIdx >= 0 && normalIdx < normalCount)
+					vertices[v].normal = {attributes.normals[normalIdx * 3 + 0], attributes.normals[normalIdx * 3 + 1], attributes.normals[normalIdx * 3 + 2]};
+
+				if (uvIdx >= 0 && uvIdx < uvCount)
+					vertices[v].uvPos = {Math::mod(attributes.texcoords[uvIdx * 2 + 0], 1.0f), Math::mod(attributes.texcoords[uvIdx * 2 + 1], 1.0f)};
 			}
+			_triangleStorage[triOffset + j].updateNormals();
 
-			_baseTriangles[f++] = new BaseTriangle(vertices[0], vertices[1], vertices[2]);
+			if (hasMaterialIds && mesh.material_ids[j] >= 0 && mesh.material_ids[j] < _library.size())
+				_triangleStorage[triOffset + j].setMaterialIndex(mesh.material_ids[j]);
 		}
 	}
 
-	for (int i = 0; i < _baseTriangles.size(); i++)
-	{
-		if (_baseTriangles[i] == nullptr)
-			Debug::log("Triangle ", i);
-	}
+	_baseTriangles.resize(_triangleStorage.size());
+	for (int i = 0; i < _triangleStorage.size(); i++)
+		_baseTriangles[i] = &_triangleStorage[i];
 }
 
 void Model::parseSelfWritten(const std::filesystem::path& path)
@@ -4,8 +4,13 @@
 #include "BVH.h"
 #include "Graphical.h"
 
-BaseTriangle::BaseTriangle(Vertex v1, Vertex v2, Vertex v3) : _vertices({v1, v2, v3}), _localNormal(normalize(cross(v2.pos - v1.pos, v3.pos - v2.pos)))
+BaseTriangle::BaseTriangle(const Vertex& v1, const Vertex& v2, const Vertex& v3) : _vertices({v1, v2, v3})
 {
+	updateNormals();
+}
+void BaseTriangle::updateNormals()
+{
+	_localNormal = normalize(cross(_vertices[1].pos - _vertices[0].pos, _vertices[2].pos - _vertices[1].pos));
 	for (auto& v : _vertices)
 	{
 		if (v.normal == glm::vec3(0, 0, 0) || abs(dot(v.normal, _localNormal)) < 0.01f)
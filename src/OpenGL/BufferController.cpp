@@ -4,6 +4,7 @@
 #include "Camera.h"
 #include "Graphical.h"
 #include "Light.h"
+#include "Material.h"
 #include "Model.h"
 #include "MyMath.h"
 #include "Renderer.h"
@@ -14,23 +15,42 @@ void BufferController::init()
 {
 	_uboTextures = make_unique<UBO>(TEXTURE_ALIGN, 1);
 	_uboMaterials = make_unique<SSBO>(MATERIAL_ALIGN, 2);
-	_uboLights = make_unique<UBO>(LIGHT_ALIGN, 3);
+	_ssboLights = make_unique<SSBO>(LIGHT_ALIGN, 3);
 	_ssboObjects = make_unique<SSBO>(OBJECT_ALIGN, 4);
 	_ssboTriangles = make_unique<SSBO>(TRIANGLE_ALIGN, 5);
+	_ssboTriangleRecords = make_unique<SSBO>(TRIANGLE_RECORD_ALIGN, 17);
 	_ssboBVHNodes = make_unique<SSBO>(BVH_NODE_ALIGN, 6);
 	_ssboPrimObjIndices = make_unique<SSBO>(PRIM_OBJ_INDICES_ALIGN, 7);
+	_ssboSceneTables = make_unique<SectionedSSBO>((int)SceneTable::Count, 12);
 
 	_uboTextures->setStorage(UBO_TEXTURES_SIZE, GL_DYNAMIC_STORAGE_BIT);
-	_uboLights->setStorage(UBO_LIGHTS_SIZE, GL_DYNAMIC_STORAGE_BIT);
+
+	_triangleRecordsProgram = make_unique<ComputeShaderProgram>("shaders/compute/triangle_records.comp");
+
+	_staging = make_unique<StagingBuffer>(STAGING_FRAME_SIZE);
+	_textures = make_unique<TrackedBuffer<TextureStruct>>(_uboTextures.get());
+	_materials = make_unique<TrackedBuffer<MaterialStruct>>(_uboMaterials.get());
+	_lights = make_unique<TrackedBuffer<LightStruct>>(_ssboLights.get());
+	_lightAliases = make_unique<TrackedBuffer<LightAliasStruct>>(_ssboSceneTables.get(), (int)SceneTable::LightAliases);
+	_objectLightIndices = make_unique<TrackedBuffer<float>>(_ssboSceneTables.get(), (int)SceneTable::ObjectLightIndices);
+	_objects = make_unique<TrackedBuffer<ObjectStruct>>(_ssboObjects.get());
+	_triangles = make_unique<TrackedBuffer<TriangleStruct>>(_ssboTriangles.get());
+	_primObjIndices = make_unique<TrackedBuffer<float>>(_ssboPrimObjIndices.get());
+	_triangleAlphaFlags = make_unique<TrackedBuffer<uint32_t>>(_ssboSceneTables.get(), (int)SceneTable::TriangleAlphaFlags);
 }
 
 void BufferController::checkIfBufferUpdateRequired()
 {
 	if (Utils::hasFlag(_buffersForUpdate, BufferType::Textures))
+	{
 		updateTextures();
+		if (updateAlphaMasks())
+			markBufferForUpdate(BufferType::Materials);
+	}
 	if (Utils::hasFlag(_buffersForUpdate, BufferType::Materials))
 		updateMaterials();
-	if (Utils::hasFlag(_buffersForUpdate, BufferType::Lights))
+	// Emitter areas and light indices depend on object transforms and order
+	if (Utils::hasFlag(_buffersForUpdate, BufferType::Lights) || Utils::hasFlag(_buffersForUpdate, BufferType::Objects))
 		updateLights();
 	if (Utils::hasFlag(_buffersForUpdate, BufferType::Triangles))
 	{
@@ -44,6 +64,10 @@ void BufferController::checkIfBufferUpdateRequired()
 	}
 
 	_buffersForUpdate = BufferType::None;
+
+	_staging->nextFrame();
+	_lastFrameUploadedBytes = _uploadedBytes;
+	_uploadedBytes = 0;
 }
 
 void BufferController::markBufferForUpdate(BufferType bufferType)
@@ -56,6 +80,7 @@ void BufferController::initBuffers()
 	bindBuffers();
 
 	updateTextures();
+	updateAlphaMasks();
 	updateMaterials();
 	updateLights();
 	updateTriangles();
@@ -67,66 +92,156 @@ void BufferController::bindBuffers()
 {
 	_uboTextures->bindDefault();
 	_uboMaterials->bindDefault();
-	_uboLights->bindDefault();
+	_ssboLights->bindDefault();
 	_ssboObjects->bindDefault();
 	_ssboTriangles->bindDefault();
+	_ssboTriangleRecords->bindDefault();
 	_ssboBVHNodes->bindDefault();
 	_ssboPrimObjIndices->bindDefault();
+	_ssboSceneTables->bindDefault();
 }
 
 void BufferController::updateTextures()
 {
+	// The UBO has a fixed size, textures past it keep the handles they had
 	auto textures = Scene::textures;
-	std::vector<TextureStruct> data(textures.size());
-	for (int i = 0; i < textures.size(); i++)
-	{
-		auto tex = textures[i];
+	if (textures.size() > UBO_TEXTURES_SIZE)
+		Debug::logError("Exceeded texture UBO size.");
 
-		TextureStruct texInfoStruct{};
-		texInfoStruct.handle = tex->glTex()->getHandle();
+	// Handles only change once a texture finishes streaming, so most updates upload a few entries
+	std::vector<TextureStruct> data(std::min((int)textures.size(), UBO_TEXTURES_SIZE));
+	for (int i = 0; i < data.size(); i++)
+		data[i].handle = textures[i]->handle();
+	_textures->assign(data);
+
+	_uploadedBytes += _textures->upload(_staging.get());
+	Renderer::resetScene();
+}
 
-		data[i] = texInfoStruct;
+void BufferController::updateMaterials()
+{
+	// Every slot is converted, only the ones that changed are uploaded
+	const auto& slots = Material::slots();
+	int count = slots.size();
+
+	_materials->resize(count);
+	_alphaMaterials.resize(count);
+
+	bool alphaChanged = false;
+	for (int i = 0; i < count; i++)
+	{
+		_materials->set(i, slots[i] != nullptr ? toMaterialStruct(slots[i]) : MaterialStruct{});
+
+		bool alpha = slots[i] != nullptr && hasAlpha(slots[i]);
+		alphaChanged |= alpha != _alphaMaterials[i];
+		_alphaMaterials[i] = alpha;
 	}
-	_uboTextures->setSubData((float*)data.data(), data.size());
-	Renderer::resetSamples();
 
-	if (data.size() > UBO_TEXTURES_SIZE)
-		Debug::logError("Exceeded texture UBO size.");
+	_uploadedBytes += _materials->upload(_staging.get());
+	Renderer::renderProgram()->fragShader()->setInt("materialCount", count);
+	Renderer::resetScene();
+
+	// Triangle flags and mesh bits follow the library materials
+	if (alphaChanged)
+	{
+		updateTriangleAlphaFlags();
+		markBufferForUpdate(BufferType::Objects);
+	}
+}
+BufferController::MaterialStruct BufferController::toMaterialStruct(const Material* mat)
+{
+	MaterialStruct materialStruct{};
+	materialStruct.color = mat->color().xyz;
+	materialStruct.id = mat->id();
+	materialStruct.lit = mat->lit();
+	materialStruct.roughness = mat->roughness();
+	materialStruct.metallic = mat->metallic();
+	materialStruct.texIndex = mat->texture()->id();
+	materialStruct.emission = mat->emission().xyz;
+	if (mat->opacityTexture())
+	{
+		materialStruct.opacityTexIndex = mat->opacityTexture()->id();
+		if (auto it = _alphaMaskOffsets.find(mat->opacityTexture()->id()); it != _alphaMaskOffsets.end())
+			materialStruct.alphaMaskOffset = it->second;
+	}
+	materialStruct.specColor = mat->specColor().xyz;
+	materialStruct.opacity = mat->opacity();
+	if (auto windyTex = dynamic_cast<WindyTexture*>(mat->texture()))
+	{
+		materialStruct.windyScale = windyTex->scale();
+		materialStruct.windyStrength = windyTex->strength();
+	}
+	return materialStruct;
+}
+bool BufferController::hasAlpha(const Material* mat)
+{
+	return mat->opacity() < 1 || mat->opacityTexture() != nullptr;
 }
 
-void BufferController::updateMaterials()
+bool BufferController::updateAlphaMasks()
+{
+	int oldSize = _alphaMaskData.size();
+	bool added = false;
+	for (auto mat : Material::slots())
+	{
+		if (mat == nullptr || mat->opacityTexture() == nullptr) continue;
+
+		// Streamed textures get their mask once their base level is decoded
+		auto tex = mat->opacityTexture();
+		if (!tex->isLoaded() || _alphaMaskOffsets.contains(tex->id())) continue;
+
+		_alphaMaskOffsets[tex->id()] = _alphaMaskData.size();
+		appendAlphaMask(tex);
+		added = true;
+	}
+	if (!added) return false;
+
+	// Masks are only appended, earlier ones keep their place in the section
+	int addedSize = _alphaMaskData.size() - oldSize;
+	_ssboSceneTables->ensureSectionCapacity((int)SceneTable::AlphaMasks, _alphaMaskData.size());
+	_ssboSceneTables->setSectionData((int)SceneTable::AlphaMasks, _alphaMaskData.data() + oldSize, addedSize, oldSize);
+	_uploadedBytes += addedSize * sizeof(uint32_t);
+	return true;
+}
+void BufferController::appendAlphaMask(const Texture* tex)
 {
-	auto materials = Scene::materials;
-	std::ranges::sort(materials, [](const Material* a, const Material* b) { return a->id() < b->id(); });
-	std::vector<MaterialStruct> data(materials.size());
+	int texWidth = tex->width();
+	int texHeight = tex->height();
+	int width = std::min(texWidth, ALPHA_MASK_MAX_SIZE);
+	int height = std::min(texHeight, ALPHA_MASK_MAX_SIZE);
+
+	int offset = _alphaMaskData.size();
+	_alphaMaskData.resize(offset + 2 + (width * height + 31) / 32);
+	_alphaMaskData[offset] = width;
+	_alphaMaskData[offset + 1] = height;
+	auto bits = _alphaMaskData.data() + offset + 2;
+
+	// Box filtered down to the mask size, each word is written by one thread
 	#pragma omp parallel for
-	for (int i = 0; i < materials.size(); i++)
+	for (int word = 0; word < (width * height + 31) / 32; word++)
 	{
-		auto mat = materials[i];
-
-		MaterialStruct materialStruct{};
-		materialStruct.color = mat->color().xyz;
-		materialStruct.id = mat->id();
-		materialStruct.lit = mat->lit();
-		materialStruct.roughness = mat->roughness();
-		materialStruct.metallic = mat->metallic();
-		materialStruct.texIndex = mat->texture()->id();
-		materialStruct.emission = mat->emission().xyz;
-		if (mat->opacityTexture()) materialStruct.opacityTexIndex = mat->opacityTexture()->id();
-		materialStruct.specColor = mat->specColor().xyz;
-		materialStruct.opacity = mat->opacity();
-		if (auto windyTex = dynamic_cast<WindyTexture*>(mat->texture()))
+		for (int bit = 0; bit < 32; bit++)
 		{
-			materialStruct.windyScale = windyTex->scale();
-			materialStruct.windyStrength = windyTex->strength();
-		}
+			int i = word * 32 + bit;
+			if (i >= width * height) break;
+
+			int x = i % width, y = i / width;
+			int texX0 = x * texWidth / width, texX1 = std::max(texX0 + 1, (x + 1) * texWidth / width);
+			int texY0 = y * texHeight / height, texY1 = std::max(texY0 + 1, (y + 1) * texHeight / height);
 
-		data[i] = materialStruct;
+			float sum = 0;
+			for (int ty = texY0; ty < texY1; ty++)
+			{
+				for (int tx = texX0; tx < texX1; tx++)
+				{
+					auto c = tex->colorAt(tx, ty);
+					sum += (c.r() + c.g() + c.b()) / 3;
+				}
+			}
+			if (sum / ((texX1 - texX0) * (texY1 - texY0)) >= ALPHA_MASK_THRESHOLD)
+				bits[word] |= 1u << bit;
+		}
 	}
-	_uboMaterials->ensureDataCapacity(data.size());
-	_uboMaterials->setSubData((float*)data.data(), data.size());
-	Renderer::renderProgram()->fragShader()->setInt("materialCount", data.size());
-	Renderer::resetSamples();
 }
 
 void BufferController::updateLights()
@@ -158,27 +273,45 @@ void BufferController::updateLights()
 	}
 
 	// Environmental light
-	//if (Camera::instance->bgColor() != Color::black())
-	//{
-	//	LightStruct lightStruct{};
-	//	lightStruct.lightType = 99;
-	//	lightStruct.color = Camera::instance->bgColor();
+	int envLightIndex = -1;
+	if (glm::vec3(Camera::instance->bgColor()) != glm::vec3(0))
+	{
+		LightStruct lightStruct{};
+		lightStruct.lightType = 99;
+		lightStruct.color = Camera::instance->bgColor();
 
-	//	data.insert(data.begin(), lightStruct);
-	//}
+		envLightIndex = data.size();
+		data.push_back(lightStruct);
+	}
+	int analyticLightCount = data.size();
+	std::vector<float> weights(analyticLightCount);
 
-	// Emissive objects
+	// Emissive objects, triangles of a mesh get consecutive light indices
 	auto graphicals = Scene::graphicals;
+	std::vector<float> objectLightIndices(graphicals.size(), -1);
 	for (int i = 0; i < graphicals.size(); i++)
 	{
-		if (graphicals[i]->materialNoCopy()->emission() == Color::clear()) continue;
+		if (graphicals[i] == nullptr) continue;
+		auto emission = graphicals[i]->materialNoCopy()->emission();
+		auto mesh = dynamic_cast<Mesh*>(graphicals[i]);
+		bool triMaterials = mesh != nullptr && mesh->usesModelMaterials();
+		if (emission == Color::clear() && !(triMaterials && mesh->model()->hasEmissiveMaterial())) continue;
+		float emissionLum = Math::luminance(emission);
 
-		if (auto mesh = dynamic_cast<Mesh*>(graphicals[i]))
+		if (mesh != nullptr)
 		{
+			if (mesh->model() == nullptr) continue;
 			const auto& triangles = mesh->model()->baseTriangles();
+			const auto& materials = mesh->model()->materials();
 			if (triangles.empty()) continue;
 
 			int triStartIndex = mesh->model()->triStartIndex();
+			int lightStartIndex = data.size();
+			objectLightIndices[i] = lightStartIndex;
+			data.resize(lightStartIndex + triangles.size());
+			weights.resize(data.size());
+
+			#pragma omp parallel for
 			for (int j = 0; j < triangles.size(); j++)
 			{
 				auto tri = triangles[j];
@@ -191,25 +324,91 @@ void BufferController::updateLights()
 				lightStruct.lightType = 2;
 				lightStruct.properties1.xyz = {triStartIndex + j, triArea, i};
 
-				data.push_back(lightStruct);
+				float triEmissionLum = emissionLum;
+				if (triMaterials && tri->materialIndex() != -1)
+					triEmissionLum = Math::luminance(materials[tri->materialIndex()]->emission());
+
+				data[lightStartIndex + j] = lightStruct;
+				weights[lightStartIndex + j] = triEmissionLum * triArea;
 			}
 		}
 		else if (auto disk = dynamic_cast<Disk*>(graphicals[i]))
 		{
+			float radius = disk->radius() * disk->scale().x;
+
 			LightStruct lightStruct{};
 			lightStruct.lightType = 3;
 			lightStruct.properties1.x = i;
 
+			objectLightIndices[i] = data.size();
 			data.push_back(lightStruct);
+			weights.push_back(emissionLum * PI * radius * radius);
 		}
 	}
 
-	_uboLights->setSubData((float*)data.data(), data.size());
+	// Analytic lights share the same budget as all emitters together
+	float emitterPower = 0;
+	for (int i = analyticLightCount; i < weights.size(); i++)
+		emitterPower += weights[i];
+	float analyticWeight = emitterPower > 0 ? emitterPower / analyticLightCount : 1;
+	std::fill_n(weights.begin(), analyticLightCount, analyticWeight);
+
+	auto aliasTable = buildLightAliasTable(weights);
+
+	_lights->assign(data);
+	_lightAliases->assign(aliasTable);
+	_objectLightIndices->assign(objectLightIndices);
+	_uploadedBytes += _lights->upload(_staging.get());
+	_uploadedBytes += _lightAliases->upload(_staging.get());
+	_uploadedBytes += _objectLightIndices->upload(_staging.get());
+
+	_sceneLightCount = lights.size();
 	Renderer::renderProgram()->fragShader()->setInt("lightCount", data.size());
-	Renderer::resetSamples();
+	Renderer::renderProgram()->fragShader()->setInt("envLightIndex", envLightIndex);
+	Renderer::resetScene();
+}
+std::vector<BufferController::LightAliasStruct> BufferController::buildLightAliasTable(const std::vector<float>& weights)
+{
+	int count = weights.size();
+	std::vector<LightAliasStruct> table(count);
+	if (count == 0) return table;
+
+	double weightSum = 0;
+	for (auto weight : weights)
+		weightSum += weight;
+
+	// Vose's alias method, degenerate sums fall back to uniform selection
+	std::vector<double> scaled(count);
+	std::vector<int> small, large;
+	for (int i = 0; i < count; i++)
+	{
+		double pdf = weightSum > 0 ? weights[i] / weightSum : 1.0 / count;
+		table[i] = {1, i, (float)pdf, 0};
+		scaled[i] = pdf * count;
+		(scaled[i] < 1 ? small : large).push_back(i);
+	}
+
+	while (!small.empty() && !large.empty())
+	{
+		int s = small.back();
+		int l = large.back();
+		small.pop_back();
+		large.pop_back();
+
+		table[s].prob = scaled[s];
+		table[s].alias = l;
+
+		scaled[l] = scaled[l] + scaled[s] - 1;
+		(scaled[l] < 1 ? small : large).push_back(l);
+	}
+
+	// Leftovers are 1 up to rounding
+	for (int i : small)
+		table[i].prob = 1;
+	for (int i : large)
+		table[i].prob = 1;
 
-	if (data.size() > UBO_LIGHTS_SIZE)
-		Debug::logError("Exceeded light UBO size.");
+	return table;
 }
 
 void BufferController::updateObjects()
@@ -225,16 +424,31 @@ void BufferController::updateObjects()
 		auto obj = graphicals[i];
 
 		ObjectStruct objectStruct{};
-		objectStruct.materialId = obj->materialNoCopy()->id();
-		objectStruct.pos = {obj->pos(), 0};
-		objectStruct.transform = obj->getTransform();
+		objectStruct.materialId = obj->materialNoCopy()->slot();
+		if (auto mesh = dynamic_cast<Mesh*>(obj); mesh != nullptr && mesh->model() != nullptr && mesh->usesModelMaterials())
+			objectStruct.alphaTriangles = std::ranges::any_of(mesh->model()->materials(), hasAlpha);
+
+		auto toWorld = obj->getTransform();
+		auto toLocal = inverse(toWorld);
+		auto normalToWorld = transpose(glm::mat3(toLocal));
+		for (int r = 0; r < 3; r++)
+		{
+			objectStruct.toWorld[r] = {toWorld[0][r], toWorld[1][r], toWorld[2][r], toWorld[3][r]};
+			objectStruct.toLocal[r] = {toLocal[0][r], toLocal[1][r], toLocal[2][r], toLocal[3][r]};
+			objectStruct.normalToWorld[r] = {normalToWorld[0][r], normalToWorld[1][r], normalToWorld[2][r], 0};
+		}
+
+		glm::vec3 boundsMin(0), boundsMax(0);
 
 		bool isPrim = true;
 		if (auto mesh = dynamic_cast<Mesh*>(obj))
 		{
 			objectStruct.objType = 0;
 			if (mesh->model() != nullptr)
-				objectStruct.properties = {mesh->model()->triStartIndex(), mesh->model()->baseTriangles().size(), mesh->model()->bvhRootNode(), 0};
+			{
+				objectStruct.properties = {mesh->model()->triStartIndex(), mesh->model()->baseTriangles().size(), mesh->model()->bvhRootNode(), mesh->usesModelMaterials()};
+				Math::transformBounds(toWorld, mesh->model()->boundsMin(), mesh->model()->boundsMax(), boundsMin, boundsMax);
+			}
 			else
 				objectStruct.properties.xyz = {-1, -1, -1};
 			isPrim = false;
@@ -243,18 +457,30 @@ void BufferController::updateObjects()
 		{
 			objectStruct.objType = 1;
 			objectStruct.properties.x = sphere->radius();
+			objectStruct.radius = sphere->radius() * sphere->scale().x;
+			boundsMin = sphere->pos() - objectStruct.radius;
+			boundsMax = sphere->pos() + objectStruct.radius;
 		}
 		else if (auto plane = dynamic_cast<Plane*>(obj))
 		{
 			objectStruct.objType = 2;
 			objectStruct.properties.xyz = vec3::UP;
+			boundsMin = glm::vec3(-PLANE_BOUNDS_EXTENT);
+			boundsMax = glm::vec3(PLANE_BOUNDS_EXTENT);
 		}
 		else if (auto disk = dynamic_cast<Disk*>(obj))
 		{
 			objectStruct.objType = 3;
 			objectStruct.properties.x = disk->radius();
+			objectStruct.radius = disk->radius() * disk->scale().x;
+			Math::transformBounds(toWorld, {-disk->radius(), 0, -disk->radius()}, {disk->radius(), 0, disk->radius()}, boundsMin, boundsMax);
 		}
 
+		objectStruct.normalToWorld[0].w = boundsMin.x;
+		objectStruct.normalToWorld[1].w = boundsMin.y;
+		objectStruct.normalToWorld[2].w = boundsMin.z;
+		objectStruct.boundsMax = {boundsMax, 0};
+
 		data[i] = objectStruct;
 
 		if (isPrim)
@@ -264,43 +490,183 @@ void BufferController::updateObjects()
 			mutex.unlock();
 		}
 	}
-	_ssboObjects->ensureDataCapacity(data.size());
-	_ssboObjects->setSubData((float*)data.data(), data.size());
+	_objects->assign(data);
+	_uploadedBytes += _objects->upload(_staging.get());
+
+	// Keep the order stable, otherwise every update would look like a change
+	std::ranges::sort(primIndicesData);
 	Renderer::renderProgram()->fragShader()->setInt("objectCount", data.size());
 
 	_lastPrimObjCount = primIndicesData.size();
-	_ssboPrimObjIndices->ensureDataCapacity(primIndicesData.size());
-	_ssboPrimObjIndices->setSubData(primIndicesData.data(), primIndicesData.size());
+	_primObjIndices->assign(primIndicesData);
+	_uploadedBytes += _primObjIndices->upload(_staging.get());
 	Renderer::renderProgram()->fragShader()->setInt("primObjCount", primIndicesData.size());
 
-	Renderer::resetSamples();
+	Renderer::resetScene();
 	Scene::updateTriangleCount();
 }
 
 void BufferController::updateTriangles()
 {
-	auto triangles = Scene::baseTriangles;
+	const auto& triangles = Scene::baseTriangles;
 	std::vector<TriangleStruct> data(triangles.size());
 	#pragma omp parallel for
 	for (int i = 0; i < triangles.size(); i++)
 	{
 		auto triangle = triangles[i];
 		TriangleStruct triangleStruct{};
-		for (int k = 0; k < 3; ++k)
+		triangleStruct.info.x = -1;
+		if (triangle != nullptr)
 		{
-			triangleStruct.vertices[k].posU = glm::vec4(triangle->vertices()[k].pos, triangle->vertices()[k].uvPos.x);
-			triangleStruct.vertices[k].normalV = glm::vec4(triangle->vertices()[k].normal, triangle->vertices()[k].uvPos.y);
+			for (int k = 0; k < 3; ++k)
+			{
+				triangleStruct.vertices[k].posU = glm::vec4(triangle->vertices()[k].pos, triangle->vertices()[k].uvPos.x);
+				triangleStruct.vertices[k].normalV = glm::vec4(triangle->vertices()[k].normal, triangle->vertices()[k].uvPos.y);
+			}
 		}
-		//triangleStruct.info = glm::vec4(triangle->mesh()->materialNoCopy()->id(), triangle->mesh()->indexId(), 0, 0);
 
 		data[i] = triangleStruct;
 	}
-	_ssboTriangles->ensureDataCapacity(data.size());
-	_ssboTriangles->setSubData((float*)data.data(), data.size());
-	Renderer::renderProgram()->fragShader()->setInt("triCount", data.size());
 
-	Renderer::resetSamples();
+	// Per-triangle material slots of models with a material library
+	for (auto model : Scene::models)
+	{
+		const auto& materials = model->materials();
+		if (materials.empty()) continue;
+
+		const auto& modelTriangles = model->baseTriangles();
+		#pragma omp parallel for
+		for (int j = 0; j < modelTriangles.size(); j++)
+		{
+			int materialIndex = modelTriangles[j]->materialIndex();
+			if (materialIndex != -1)
+				data[model->triStartIndex() + j].info.x = materials[materialIndex]->slot();
+		}
+	}
+
+	// Models added or removed at the end only upload their own range
+	_triangles->assign(data);
+	_uploadedBytes += _triangles->upload(_staging.get());
+
+	updateTriangleRecords();
+	updateTriangleAlphaFlags();
+	Renderer::renderProgram()->fragShader()->setInt("triCount", triangles.size());
+
+	Renderer::resetScene();
+}
+void BufferController::updateTriangleRecords()
+{
+	int triCount = Scene::baseTriangles.size();
+	_ssboTriangleRecords->ensureDataCapacity(triCount);
+	if (triCount == 0) return;
+
+	_ssboTriangles->bindDefault();
+	_ssboTriangleRecords->bindDefault();
+
+	_triangleRecordsProgram->use();
+	_triangleRecordsProgram->setInt("triCount", triCount);
+	ComputeShaderProgram::dispatch({(triCount + SHADER_GROUP_SIZE - 1) / SHADER_GROUP_SIZE, 1, 1}, GL_SHADER_STORAGE_BARRIER_BIT);
+
+	Renderer::renderProgram()->use();
 }
+void BufferController::updateTriangleAlphaFlags()
+{
+	// Only triangles with their own library material are flagged, the rest fall back to the object material
+	std::vector<uint32_t> flags((Scene::baseTriangles.size() + 31) / 32);
+	for (auto model : Scene::models)
+	{
+		const auto& materials = model->materials();
+		if (materials.empty()) continue;
+
+		const auto& modelTriangles = model->baseTriangles();
+		for (int j = 0; j < modelTriangles.size(); j++)
+		{
+			int materialIndex = modelTriangles[j]->materialIndex();
+			if (materialIndex == -1 || !hasAlpha(materials[materialIndex])) continue;
+
+			int triIndex = model->triStartIndex() + j;
+			flags[triIndex / 32] |= 1u << (triIndex % 32);
+		}
+	}
+	_triangleAlphaFlags->assign(flags);
+	_uploadedBytes += _triangleAlphaFlags->upload(_staging.get());
+}
+void BufferController::updateEnvMapDistribution()
+{
+	auto envMap = Renderer::envMap();
+	if (envMap == nullptr || envMap->width() == 0)
+	{
+		Renderer::renderProgram()->setInt2("envMapDistSize", {0, 0});
+		return;
+	}
+
+	int texWidth = envMap->width();
+	int texHeight = envMap->height();
+	int width = std::min(texWidth, ENV_MAP_DISTRIBUTION_MAX_WIDTH);
+	int height = std::min(texHeight, ENV_MAP_DISTRIBUTION_MAX_HEIGHT);
+
+	// Luminance weighted by sin(theta) of the equirectangular row
+	std::vector<float> func(width * height);
+	#pragma omp parallel for
+	for (int y = 0; y < height; y++)
+	{
+		int texY0 = y * texHeight / height, texY1 = std::max(texY0 + 1, (y + 1) * texHeight / height);
+		float sinTheta = sin(PI * (y + 0.5f) / height);
+		for (int x = 0; x < width; x++)
+		{
+			int texX0 = x * texWidth / width, texX1 = std::max(texX0 + 1, (x + 1) * texWidth / width);
+
+			float sum = 0;
+			for (int ty = texY0; ty < texY1; ty++)
+			{
+				for (int tx = texX0; tx < texX1; tx++)
+				{
+					auto c = envMap->colorAt(tx, ty);
+					sum += Math::luminance(c);
+				}
+			}
+			func[y * width + x] = sum / ((texX1 - texX0) * (texY1 - texY0)) * sinTheta;
+		}
+	}
+
+	// Layout: marginal cdf (height + 1), conditional cdfs (height * (width + 1)), pdf over uv (height * width)
+	std::vector<float> data(height + 1 + height * (width + 1) + height * width);
+	float* marginalCdf = data.data();
+	float* conditionalCdf = marginalCdf + height + 1;
+	float* pdf = conditionalCdf + height * (width + 1);
+
+	std::vector<float> rowIntegrals(height);
+	#pragma omp parallel for
+	for (int y = 0; y < height; y++)
+	{
+		float* cdf = conditionalCdf + y * (width + 1);
+		cdf[0] = 0;
+		for (int x = 0; x < width; x++)
+			cdf[x + 1] = cdf[x] + func[y * width + x] / width;
+
+		rowIntegrals[y] = cdf[width];
+		for (int x = 1; x <= width; x++)
+			cdf[x] = rowIntegrals[y] > 0 ? cdf[x] / rowIntegrals[y] : (float)x / width;
+	}
+
+	marginalCdf[0] = 0;
+	for (int y = 0; y < height; y++)
+		marginalCdf[y + 1] = marginalCdf[y] + rowIntegrals[y] / height;
+
+	float integral = marginalCdf[height];
+	for (int y = 1; y <= height; y++)
+		marginalCdf[y] = integral > 0 ? marginalCdf[y] / integral : (float)y / height;
+
+	#pragma omp parallel for
+	for (int i = 0; i < width * height; i++)
+		pdf[i] = integral > 0 ? func[i] / integral : 1;
+
+	_ssboSceneTables->ensureSectionCapacity((int)SceneTable::EnvMapDistribution, data.size());
+	_ssboSceneTables->setSectionData((int)SceneTable::EnvMapDistribution, data.data(), data.size());
+	Renderer::renderProgram()->setInt2("envMapDistSize", {width, height});
+	Renderer::resetScene();
+}
+
 void BufferController::setBVHRootNode(int bvhRootNode)
 {
 	_bvhRootNode = bvhRootNode;
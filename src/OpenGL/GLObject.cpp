@@ -28,6 +28,10 @@ GLBuffer::GLBuffer()
 {
 	glGenBuffers(1, &_id);
 }
+GLBuffer::~GLBuffer()
+{
+	glDeleteBuffers(1, &_id);
+}
 void GLBuffer::setDefaultBind(int index)
 {
 	_currBase = index;
@@ -89,17 +93,95 @@ void GLBufferObject::ensureDataCapacity(int capacity, GLenum type)
 	setDataCapacity(capacity * CAPACITY_MULT, type);
 }
 
-void GLBufferObject::clear(const void* data) const
+void GLBufferObject::growDataCapacity(int capacity, GLenum type)
 {
-	glBindBuffer(_type, _id);
-	glClearBufferData(_type, GL_R32I, GL_RED, GL_INT, data);
-	glBindBuffer(_type, 0);
+	static constexpr int CAPACITY_MULT = 2;
+	if (_capacity >= capacity) return;
+
+	// Copy the old contents into the new storage so only new elements need uploading
+	int newCapacity = std::max(capacity, std::max(_capacity, 1) * CAPACITY_MULT);
+	GLuint newId;
+	glCreateBuffers(1, &newId);
+	glNamedBufferData(newId, newCapacity * _align * sizeof(float), nullptr, type);
+	if (_capacity > 0)
+		glCopyNamedBufferSubData(_id, newId, 0, 0, _capacity * _align * sizeof(float));
+	glDeleteBuffers(1, &_id);
+
+	_id = newId;
+	_capacity = newCapacity;
+	if (_currBase != -1) bindDefault();
+}
+
+void GLBufferObject::clear(const void* data, int offset, int count) const
+{
+	if (count == -1)
+	{
+		glClearNamedBufferData(_id, GL_R32I, GL_RED, GL_INT, data);
+		return;
+	}
+	glClearNamedBufferSubData(_id, GL_R32I, offset * _align * sizeof(float), count * _align * sizeof(float), GL_RED, GL_INT, data);
+}
+
+void* GLBufferObject::mapStorage(GLbitfield access) const
+{
+	auto ptr = glMapNamedBufferRange(_id, 0, _capacity * _align * sizeof(float), access);
+	if (ptr == nullptr) throw std::runtime_error("Could not map buffer storage.");
+	return ptr;
 }
 
 UBO::UBO(int align, int baseIndex) : GLBufferObject(GL_UNIFORM_BUFFER, align, baseIndex) {}
 
 SSBO::SSBO(int align, int baseIndex) : GLBufferObject(GL_SHADER_STORAGE_BUFFER, align, baseIndex) {}
 
+SectionedSSBO::SectionedSSBO(int sectionCount, int baseIndex) : SSBO(1, baseIndex), _offsets(sectionCount), _capacities(sectionCount, 0)
+{
+	setData(nullptr, layout(), GL_DYNAMIC_DRAW);
+	glNamedBufferSubData(_id, 0, _offsets.size() * sizeof(int), _offsets.data());
+}
+// Places the sections one after another and returns the total size
+int SectionedSSBO::layout()
+{
+	// Sections start on 16 bytes, so vec4 sized elements stay aligned
+	auto alignUp = [](int count) { return (count + SECTION_ALIGN - 1) / SECTION_ALIGN * SECTION_ALIGN; };
+
+	int size = alignUp(_offsets.size());
+	for (int i = 0; i < _offsets.size(); i++)
+	{
+		_offsets[i] = size;
+		size += alignUp(_capacities[i]);
+	}
+	return size;
+}
+void SectionedSSBO::ensureSectionCapacity(int section, int count)
+{
+	static constexpr int CAPACITY_MULT = 2;
+	if (_capacities[section] >= count) return;
+
+	auto oldOffsets = _offsets;
+	auto oldCapacities = _capacities;
+	_capacities[section] = std::max(count, _capacities[section] * CAPACITY_MULT);
+	int size = layout();
+
+	GLuint newId;
+	glCreateBuffers(1, &newId);
+	glNamedBufferData(newId, size * sizeof(float), nullptr, GL_DYNAMIC_DRAW);
+	glNamedBufferSubData(newId, 0, _offsets.size() * sizeof(int), _offsets.data());
+	for (int i = 0; i < _offsets.size(); i++)
+	{
+		if (oldCapacities[i] > 0)
+			glCopyNamedBufferSubData(_id, newId, oldOffsets[i] * sizeof(float), _offsets[i] * sizeof(float), oldCapacities[i] * sizeof(float));
+	}
+	glDeleteBuffers(1, &_id);
+
+	_id = newId;
+	_capacity = size;
+	if (_currBase != -1) bindDefault();
+}
+void SectionedSSBO::setSectionData(int section, const void* data, int count, int offset) const
+{
+	glNamedBufferSubData(_id, (_offsets[section] + offset) * sizeof(float), count * sizeof(float), data);
+}
+
 AtomicCounterBuffer::AtomicCounterBuffer(int baseIndex, int initValue)
 {
 	glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, _id);
@@ -115,6 +197,103 @@ void AtomicCounterBuffer::bind(int index)
 	glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, index, _id);
 }
 
+PixelUnpackBuffer::PixelUnpackBuffer()
+{
+	glGenBuffers(1, &_id);
+}
+PixelUnpackBuffer::~PixelUnpackBuffer()
+{
+	glDeleteBuffers(1, &_id);
+}
+
+void* PixelUnpackBuffer::map(size_t size)
+{
+	_capacity = std::max(_capacity, size);
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _id);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, _capacity, nullptr, GL_STREAM_DRAW);
+	auto ptr = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	if (ptr == nullptr) throw std::runtime_error("Could not map the pixel unpack buffer.");
+	return ptr;
+}
+void PixelUnpackBuffer::unmap() const
+{
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _id);
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void PixelUnpackBuffer::bind() const
+{
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _id);
+}
+void PixelUnpackBuffer::unbind()
+{
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+FencedRing::~FencedRing()
+{
+	for (auto fence : _fences)
+		if (fence) glDeleteSync(fence);
+}
+
+// Fences the commands that use the current slot and moves on to the next one
+void FencedRing::submit()
+{
+	_fences[_frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	_frame = (_frame + 1) % FRAME_COUNT;
+}
+// True once per submit, when the slot's fence is found signalled
+bool FencedRing::complete(int slot, bool wait)
+{
+	auto& fence = _fences[slot];
+	if (fence == nullptr) return false;
+
+	auto status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? UINT64_MAX : 0);
+	if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) return false;
+	glDeleteSync(fence);
+	fence = nullptr;
+	return true;
+}
+
+StagingBuffer::StagingBuffer(size_t frameSize) : _frameSize(frameSize)
+{
+	constexpr GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glCreateBuffers(1, &_id);
+	glNamedBufferStorage(_id, _frameSize * FencedRing::FRAME_COUNT, nullptr, flags);
+	_mapped = (char*)glMapNamedBufferRange(_id, 0, _frameSize * FencedRing::FRAME_COUNT, flags);
+	if (_mapped == nullptr) throw std::runtime_error("Could not map the staging buffer.");
+}
+StagingBuffer::~StagingBuffer()
+{
+	glUnmapNamedBuffer(_id);
+	glDeleteBuffers(1, &_id);
+}
+
+bool StagingBuffer::copy(const GLBufferObject& dst, size_t dstOffset, const void* data, size_t size)
+{
+	if (_frameOffset + size > _frameSize) return false;
+
+	size_t srcOffset = _ring.frame() * _frameSize + _frameOffset;
+	memcpy(_mapped + srcOffset, data, size);
+	glCopyNamedBufferSubData(_id, dst.id(), srcOffset, dstOffset, size);
+
+	_frameOffset = (_frameOffset + size + COPY_ALIGN - 1) / COPY_ALIGN * COPY_ALIGN;
+	return true;
+}
+void StagingBuffer::nextFrame()
+{
+	if (_frameOffset == 0) return;
+
+	_ring.submit();
+	_frameOffset = 0;
+
+	// Only blocks when the GPU is more than FRAME_COUNT frames of uploads behind
+	_ring.complete(_ring.frame(), true);
+}
+
 GLTexture::GLTexture()
 {
 	glGenTextures(1, &_id);
@@ -138,6 +317,20 @@ GLTexture2D::GLTexture2D(int width, int height, const void* data, GLenum format,
 
 	glBindTexture(GL_TEXTURE_2D, 0);
 }
+GLTexture2D::GLTexture2D(int width, int height, int levels, GLenum internalFormat) : _width(width), _height(height), _format(GL_RGBA)
+{
+	glBindTexture(GL_TEXTURE_2D, _id);
+
+	glTexStorage2D(GL_TEXTURE_2D, levels, internalFormat, width, height);
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
 uint64_t GLTexture2D::getHandle() const
 {
 	GLuint64 handle = glGetTextureHandleARB(_id);
@@ -153,6 +346,21 @@ void GLTexture2D::setWrapMode(GLint wrapMode) const
 	glBindTexture(GL_TEXTURE_2D, 0);
 }
 
+void GLTexture2D::setLevelData(int level, const void* data, GLenum format, GLenum type) const
+{
+	glBindTexture(GL_TEXTURE_2D, _id);
+	glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, std::max(1, _width >> level), std::max(1, _height >> level), format, type, data);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+void GLTexture2D::bindImage(int unit, GLenum access, GLenum internalFormat) const
+{
+	glBindImageTexture(unit, _id, 0, GL_FALSE, 0, access, internalFormat);
+}
+void GLTexture2D::copyTo(const GLTexture2D& dst) const
+{
+	glCopyImageSubData(_id, GL_TEXTURE_2D, 0, 0, 0, 0, dst._id, GL_TEXTURE_2D, 0, 0, 0, 0, std::min(_width, dst._width), std::min(_height, dst._height), 1);
+}
+
 GLFrameBuffer::GLFrameBuffer(glm::ivec2 size)
 {
 	glGenFramebuffers(1, &_id);
@@ -46,6 +46,11 @@ void BaseShaderMethods::setInt(const std::string& name, int value) const
 	glUseProgram(_id);
 	glUniform1i(glGetUniformLocation(_id, name.c_str()), value);
 }
+void BaseShaderMethods::setInt2(const std::string& name, glm::ivec2 value) const
+{
+	glUseProgram(_id);
+	glUniform2i(glGetUniformLocation(_id, name.c_str()), value.x, value.y);
+}
 void BaseShaderMethods::setFloat(const std::string& name, float value) const
 {
 	glUseProgram(_id);
@@ -249,7 +249,10 @@ void SceneLoaderPbrt::loadScene_materials(const minipbrt::Scene* scene, const st
 				else
 					baseColor = Color(m->Kd.value[0], m->Kd.value[1], m->Kd.value[2]);
 				if (m->Ks.texture != minipbrt::kInvalidIndex)
+				{
+					parsedTextures[m->Ks.texture]->waitUntilLoaded();
 					specColor = parsedTextures[m->Ks.texture]->colorAt(0, 0);
+				}
 				else
 					specColor = Color(m->Ks.value[0], m->Ks.value[1], m->Ks.value[2]);
 				roughness = m->roughness.value;
@@ -307,7 +310,10 @@ void SceneLoaderPbrt::loadScene_materials(const minipbrt::Scene* scene, const st
 				else
 					baseColor = Color(m->Kd.value[0], m->Kd.value[1], m->Kd.value[2]);
 				if (m->Ks.texture != minipbrt::kInvalidIndex)
+				{
+					parsedTextures[m->Ks.texture]->waitUntilLoaded();
 					specColor = parsedTextures[m->Ks.texture]->colorAt(0, 0);
+				}
 				else
 					specColor = Color(m->Ks.value[0], m->Ks.value[1], m->Ks.value[2]);
 				roughness = m->uroughness.value;
@@ -516,13 +522,11 @@ void SceneLoaderPbrt::loadScene_lights(const minipbrt::Scene* scene)
 			if (il->mapname != nullptr)
 			{
 				auto tex = Assets::load<Texture>(il->mapname);
-				Renderer::renderProgram()->setBool("useEnvMap", true);
-				Renderer::renderProgram()->setHandle("envMap", tex->glTex()->getHandle());
 
 				auto envMapToWorld = transpose(glm::make_mat4x4(&il->lightToWorld.start[0][0]));
 				glm::mat4 toYUp = rotate(glm::mat4(1.0f), glm::radians(-90.0f), glm::vec3(1, 0, 0));
 				glm::mat4 rotateY = rotate(glm::mat4(1.0f), glm::radians(-0.0f), glm::vec3(0, 1, 0));
-				Renderer::renderProgram()->setMatrix4X4("envMapToWorld", rotateY * toYUp * envMapToWorld);
+				Renderer::setEnvMap(tex, rotateY * toYUp * envMapToWorld);
 			}
 		}
 	}
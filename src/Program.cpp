@@ -5,15 +5,19 @@
 
 #include <SDL.h>
 
+#include "Benchmark.h"
 #include "BufferController.h"
 #include "BVH.h"
+#include "ImageStats.h"
 #include "ImGuiHandler.h"
 #include "Input.h"
 #include "MyTime.h"
+#include "PathGuiding.h"
 #include "Physics.h"
 #include "SDLHandler.h"
 #include "Scene.h"
 #include "Renderer.h"
+#include "TextureStreamer.h"
 #include "Tweener.h"
 #include "Utils.h"
 
@@ -34,6 +38,9 @@ void Program::init()
 	SDLHandler::init();
 	tm.printElapsedFromLast("SDL init in ");
 
+	TextureStreamer::init();
+	tm.printElapsedFromLast("TextureStreamer init in ");
+
 	Renderer::init();
 	tm.printElapsedFromLast("Renderer init in ");
 
@@ -61,6 +68,10 @@ void Program::init()
 	tm.printElapsedFromLast("BVH built in ");
 
 	tm.printElapsed("Total init in ");
+
+	#ifdef BENCHMARK_BUILD
+	Benchmark::runTimings();
+	#endif
 }
 
 void Program::loop()
@@ -72,9 +83,14 @@ void Program::loop()
 		SDLHandler::update();
 		Tweener::update();
 
+		TextureStreamer::update();
 		BufferController::checkIfBufferUpdateRequired();
+		Physics::update();
+		ImageStats::update();
+		PathGuiding::update();
 
 		Renderer::render();
+		Benchmark::update();
 		ImGuiHandler::draw();
 
 		SDLHandler::swapBuffers();
@@ -83,5 +99,7 @@ void Program::loop()
 
 void Program::quit()
 {
+	TextureStreamer::quit();
+	PathGuiding::quit();
 	SDLHandler::quit();
 }
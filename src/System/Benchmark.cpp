@@ -0,0 +1,210 @@
+#include "Benchmark.h"
+
+#include <format>
+
+#include "GLObject.h"
+#include "Program.h"
+#include "Utils.h"
+
+Benchmark::Settings Benchmark::Settings::current()
+{
+	return {
+		Renderer::samplesPerPixel(), Renderer::samplesPerInvocation(), Renderer::maxRayBounces(), Renderer::bvhTraversalMode(),
+		Renderer::useTriangleRecords(), Renderer::useOccluderCache(), Renderer::usePrimaryCache(), Renderer::useRasterPrimary(),
+		Renderer::samplerType(), Renderer::useRestir(), Renderer::useRadianceCache(), Renderer::usePathGuiding(),
+		Renderer::useDenoiser(), false
+	};
+}
+void Benchmark::Settings::apply() const
+{
+	Renderer::setSPP(spp);
+	Renderer::setSamplesPerInvocation(samplesPerInvocation);
+	Renderer::setMaxRayBounces(bounces);
+	Renderer::setBVHTraversalMode(traversalMode);
+	Renderer::setUseTriangleRecords(triangleRecords);
+	Renderer::setUseOccluderCache(occluderCache);
+	Renderer::setUsePrimaryCache(primaryCache);
+	Renderer::setUseRasterPrimary(rasterPrimary);
+	Renderer::setSamplerType(samplerType);
+	Renderer::setUseRestir(restir);
+	Renderer::setUseRadianceCache(radianceCache);
+	Renderer::setUsePathGuiding(pathGuiding);
+	Renderer::setUseDenoiser(denoiser);
+}
+
+void Benchmark::runTimings()
+{
+	// Every run changes one thing, so each line compares against the first
+	std::vector<Run> runs = {
+		{"Stack traversal", [](Settings& s) { s.traversalMode = BVHTraversalMode::Stack; }},
+		{"Link traversal", [](Settings& s) { s.traversalMode = BVHTraversalMode::Links; }},
+		{"Six-sided traversal", [](Settings& s) { s.traversalMode = BVHTraversalMode::SixSided; }},
+		{"Without triangle records", [](Settings& s) { s.triangleRecords = false; }},
+		{"Occluder cache", [](Settings& s) { s.occluderCache = true; }},
+		{"Occluder cache, link traversal", [](Settings& s) { s.occluderCache = true; s.traversalMode = BVHTraversalMode::Links; }},
+		{"Occluder cache, six-sided traversal", [](Settings& s) { s.occluderCache = true; s.traversalMode = BVHTraversalMode::SixSided; }},
+		{"Primary cache", [](Settings& s) { s.primaryCache = true; }},
+		{"Raster primary", [](Settings& s) { s.rasterPrimary = true; }},
+		{"ReSTIR", [](Settings& s) { s.restir = true; }},
+		{"Radiance cache", [](Settings& s) { s.radianceCache = true; }},
+		{"Path guiding", [](Settings& s) { s.pathGuiding = true; }},
+	};
+	for (int k = 1; k <= BATCH_SPP; k *= 2)
+		runs.push_back({std::format("{} spp, {} per invocation", BATCH_SPP, k), [k](Settings& s) { s.spp = BATCH_SPP; s.samplesPerInvocation = k; }});
+
+	Settings base = {
+		1, 1, TIMING_BOUNCES, BVHTraversalMode::Stack, true, false, false, false, SamplerType::Sobol,
+		false, false, false, false, false
+	};
+	start(std::move(runs), base, true);
+}
+
+void Benchmark::compareSamplers()
+{
+	#ifdef BENCHMARK_BUILD
+	Debug::logError("Benchmark: sampler errors need the accumulation, which BENCHMARK_BUILD skips.");
+	#else
+	// The reference uses white noise, so it favours none of the samplers it is compared to
+	std::vector<Run> runs = {
+		{"Reference", [](Settings& s) { s.samplerType = SamplerType::Random; s.spp = REFERENCE_SPP; }, REFERENCE_SAMPLES},
+		{"Random sampler", [](Settings& s) { s.samplerType = SamplerType::Random; }, ERROR_SAMPLES},
+		{"Sobol sampler", [](Settings& s) { s.samplerType = SamplerType::Sobol; }, ERROR_SAMPLES},
+		{"Blue noise sampler", [](Settings& s) { s.samplerType = SamplerType::BlueNoise; }, ERROR_SAMPLES},
+	};
+
+	auto base = Settings::current();
+	base.spp = 1;
+	start(std::move(runs), base, false);
+	#endif
+}
+
+void Benchmark::compareFeatures()
+{
+	#ifdef BENCHMARK_BUILD
+	Debug::logError("Benchmark: feature comparisons need the accumulation and the denoiser, which BENCHMARK_BUILD skips.");
+	#else
+	// The reference traces the plain estimator with white noise, so the biased features are measured against the truth
+	std::vector<Run> runs = {
+		{"Reference", [](Settings& s) { s.samplerType = SamplerType::Random; s.spp = REFERENCE_SPP; }, REFERENCE_SAMPLES},
+		{"Without features", [](Settings&) {}, 0, EQUAL_TIME_MS},
+		{"ReSTIR", [](Settings& s) { s.restir = true; }, 0, EQUAL_TIME_MS},
+		{"Radiance cache", [](Settings& s) { s.radianceCache = true; }, 0, EQUAL_TIME_MS},
+		{"Path guiding", [](Settings& s) { s.pathGuiding = true; }, 0, EQUAL_TIME_MS},
+		{"Without denoiser", [](Settings&) {}},
+		{"Denoiser", [](Settings& s) { s.denoiser = true; }},
+		{"Image stats every frame", [](Settings& s) { s.readStats = true; }},
+	};
+
+	auto base = Settings::current();
+	base.spp = 1;
+	base.restir = false;
+	base.radianceCache = false;
+	base.pathGuiding = false;
+	base.denoiser = false;
+	start(std::move(runs), base, false);
+	#endif
+}
+
+void Benchmark::start(std::vector<Run> runs, const Settings& baseSettings, bool quitWhenDone)
+{
+	if (isRunning())
+	{
+		Debug::logError("Benchmark: already running.");
+		return;
+	}
+
+	_runs = std::move(runs);
+	_baseSettings = baseSettings;
+	_userSettings = Settings::current();
+	_quitWhenDone = quitWhenDone;
+	_reference.clear();
+
+	Debug::log("Benchmark: ", _runs.size(), " runs.");
+	startRun(0);
+}
+
+// Called once the frame is rendered
+void Benchmark::update()
+{
+	if (!isRunning()) return;
+
+	auto now = std::chrono::steady_clock::now();
+	float cpuFrameTime = std::chrono::duration<float, std::milli>(now - _lastUpdate).count();
+	_lastUpdate = now;
+
+	// The reduction the stats overlay asks for, its GPU work is outside the render time so the CPU time shows any stall
+	if (_runSettings.readStats)
+		Renderer::computeSampleVariance();
+
+	const auto& run = _runs[_runIndex];
+	if (run.samples == 0 && run.time == 0)
+	{
+		if (++_frame <= WARMUP_FRAMES) return;
+
+		_frameTimeSum += Renderer::renderTime();
+		_samplesPerSecondSum += Renderer::samplesPerSecond();
+		_cpuFrameTimeSum += cpuFrameTime;
+		if (_frame < WARMUP_FRAMES + MEASURED_FRAMES) return;
+
+		float frameTime = _frameTimeSum / MEASURED_FRAMES;
+		float cpuTime = _cpuFrameTimeSum / MEASURED_FRAMES;
+		float samplesPerSecond = _samplesPerSecondSum / MEASURED_FRAMES;
+		Debug::log("Benchmark: ", run.name, ": ", std::format("{:.3f}", frameTime), "ms GPU, ", std::format("{:.3f}", cpuTime), "ms CPU, ",
+		           std::format("{:.1f}", samplesPerSecond / 1e6f), " Msamples/s");
+	}
+	else
+	{
+		_frameTimeSum += Renderer::renderTime();
+		if (run.samples > 0 ? Renderer::totalSamples() < run.samples : _frameTimeSum < run.time) return;
+
+		auto mean = readMean();
+		if (_reference.empty())
+		{
+			_reference = std::move(mean);
+			Debug::log("Benchmark: ", run.name, ": ", Renderer::totalSamples(), " samples");
+		}
+		else
+			Debug::log("Benchmark: ", run.name, ": ", std::format("{:.4e}", Utils::computeMSE(mean, _reference)), " MSE at ", Renderer::totalSamples(),
+			           " samples in ", std::format("{:.0f}", _frameTimeSum), "ms");
+	}
+
+	startRun(_runIndex + 1);
+}
+
+void Benchmark::startRun(int index)
+{
+	_frame = 0;
+	_frameTimeSum = 0;
+	_samplesPerSecondSum = 0;
+	_cpuFrameTimeSum = 0;
+	_lastUpdate = std::chrono::steady_clock::now();
+
+	if (index >= _runs.size())
+	{
+		Debug::log("Benchmark: done.");
+		_runIndex = -1;
+		_userSettings.apply();
+		if (_quitWhenDone)
+			Program::doQuit = true;
+		return;
+	}
+
+	_runIndex = index;
+	auto settings = _baseSettings;
+	_runs[index].change(settings);
+	settings.apply();
+	_runSettings = settings;
+	Renderer::resetSamples();
+}
+
+std::vector<glm::vec3> Benchmark::readMean()
+{
+	// The accumulation is written through image stores
+	glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+	auto data = Renderer::_accumMeanTex->readData<glm::vec4>();
+
+	std::vector<glm::vec3> mean(data.size());
+	for (int i = 0; i < data.size(); i++)
+		mean[i] = data[i];
+	return mean;
+}
@@ -0,0 +1,439 @@
+#include "Denoiser.h"
+
+#include <algorithm>
+
+#include "Camera.h"
+#include "GLObject.h"
+#include "MyMath.h"
+#include "Renderer.h"
+
+DenoiserCamera DenoiserCamera::current()
+{
+	auto camera = Camera::instance;
+	return {camera->pos(), camera->getTransform(), {camera->ratio(), 1}, camera->getFocalDis()};
+}
+
+void Denoiser::init()
+{
+	_temporalProgram = make_unique<ComputeShaderProgram>("shaders/compute/denoise/denoise_temporal.comp");
+	_temporalProgram->use();
+	_temporalProgram->setInt("maxHistorySamples", MAX_HISTORY_SAMPLES);
+	_temporalProgram->setInt("minMomentSamples", MIN_MOMENT_SAMPLES);
+	_temporalProgram->setFloat("depthTolerance", DEPTH_TOLERANCE);
+	_temporalProgram->setFloat("normalTolerance", NORMAL_TOLERANCE);
+	_temporalProgram->setFloat("albedoEpsilon", ALBEDO_EPSILON);
+
+	_atrousProgram = make_unique<ComputeShaderProgram>("shaders/compute/denoise/denoise_atrous.comp");
+	_atrousProgram->use();
+	_atrousProgram->setFloat("sigmaNormal", SIGMA_NORMAL);
+	_atrousProgram->setFloat("sigmaDepth", SIGMA_DEPTH);
+	_atrousProgram->setFloat("sigmaLuminance", SIGMA_LUMINANCE);
+	_atrousProgram->setFloat("albedoEpsilon", ALBEDO_EPSILON);
+}
+
+void Denoiser::resize(glm::ivec2 size)
+{
+	_size = size;
+
+	_priorTex = make_unique<GLTexture2D>(size.x, size.y, nullptr, GL_RGBA, GL_RGBA32F, GL_NEAREST);
+	_historyTex = make_unique<GLTexture2D>(size.x, size.y, nullptr, GL_RGBA, GL_RGBA32F, GL_NEAREST);
+	_prevNormalDepthTex = make_unique<GLTexture2D>(size.x, size.y, nullptr, GL_RGBA, GL_RGBA32F, GL_NEAREST);
+	for (auto& filterTex : _filterTex)
+		filterTex = make_unique<GLTexture2D>(size.x, size.y, nullptr, GL_RGBA, GL_RGBA32F, GL_NEAREST);
+	_outputTex = make_unique<GLTexture2D>(size.x, size.y, nullptr, GL_RGBA, GL_RGBA8);
+
+	_hasHistory = false;
+}
+
+void Denoiser::denoise(const DenoiserInputs& inputs, glm::ivec2 size, const DenoiserCamera& camera, int sampleCount, bool samplesReset)
+{
+	glm::ivec3 groups = {(size.x + SHADER_GROUP_SIZE - 1) / SHADER_GROUP_SIZE, (size.y + SHADER_GROUP_SIZE - 1) / SHADER_GROUP_SIZE, 1};
+	constexpr GLenum barrier = GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT;
+
+	_temporalProgram->use();
+	_temporalProgram->setFloat2("pixelSize", size);
+	_temporalProgram->setFloat3("cameraPos", camera.pos);
+	_temporalProgram->setMatrix4X4("cameraRotMat", camera.rot);
+	_temporalProgram->setFloat2("viewSize", camera.viewSize);
+	_temporalProgram->setFloat("focalDistance", camera.focalDistance);
+	_temporalProgram->setFloat3("prevCameraPos", _prevCamera.pos);
+	_temporalProgram->setMatrix4X4("prevCameraRotMat", _prevCamera.rot);
+	_temporalProgram->setFloat2("prevViewSize", _prevCamera.viewSize);
+	_temporalProgram->setFloat("prevFocalDistance", _prevCamera.focalDistance);
+	_temporalProgram->setFloat2("prevPixelSize", _prevSize);
+	_temporalProgram->setInt("sampleCount", sampleCount);
+
+	_temporalProgram->setHandle("meanTexture", inputs.mean->getHandle());
+	_temporalProgram->setHandle("albedoTexture", inputs.albedo->getHandle());
+	_temporalProgram->setHandle("normalDepthTexture", inputs.normalDepth->getHandle());
+	_temporalProgram->setHandle("prevNormalDepthTexture", _prevNormalDepthTex->getHandle());
+	_temporalProgram->setHandle("historyTexture", _historyTex->getHandle());
+	_temporalProgram->setHandle("priorTexture", _priorTex->getHandle());
+
+	_priorTex->bindImage(0, GL_WRITE_ONLY, GL_RGBA32F);
+	_historyTex->bindImage(1, GL_WRITE_ONLY, GL_RGBA32F);
+	_filterTex[0]->bindImage(2, GL_WRITE_ONLY, GL_RGBA32F);
+
+	// The prior is only replaced on resets, a reset with a still camera and extent means the scene changed and drops it
+	if (samplesReset)
+	{
+		_temporalProgram->setBool("reproject", _hasHistory && (camera != _prevCamera || size != _prevSize));
+		_temporalProgram->setInt("pass", PASS_REPROJECT);
+		ComputeShaderProgram::dispatch(groups, barrier);
+	}
+	_temporalProgram->setInt("pass", PASS_COMBINE);
+	ComputeShaderProgram::dispatch(groups, barrier);
+
+	_atrousProgram->use();
+	_atrousProgram->setFloat2("pixelSize", size);
+	_atrousProgram->setFloat("pixelAngle", camera.viewSize.y / size.y / camera.focalDistance);
+	_atrousProgram->setHandle("albedoTexture", inputs.albedo->getHandle());
+	_atrousProgram->setHandle("normalDepthTexture", inputs.normalDepth->getHandle());
+	_outputTex->bindImage(3, GL_WRITE_ONLY, GL_RGBA8);
+
+	for (int i = 0; i < ATROUS_ITERATIONS; i++)
+	{
+		_atrousProgram->setInt("stepSize", 1 << i);
+		_atrousProgram->setBool("lastIteration", i == ATROUS_ITERATIONS - 1);
+		_atrousProgram->setHandle("filterTexture", _filterTex[i % 2]->getHandle());
+		_filterTex[(i + 1) % 2]->bindImage(2, GL_WRITE_ONLY, GL_RGBA32F);
+		ComputeShaderProgram::dispatch(groups, barrier);
+	}
+
+	inputs.normalDepth->copyTo(*_prevNormalDepthTex);
+	_prevSize = size;
+	_prevCamera = camera;
+	_hasHistory = true;
+}
+
+std::vector<glm::vec3> CpuDenoiser::denoise(const DenoiserFrame& frame)
+{
+	// The history keeps the previous size and is reprojected from it, like the compute passes do
+	int pixelCount = frame.size.x * frame.size.y;
+	_size = frame.size;
+
+	// The renderer resets samples whenever its extent changes, the prior can't be reused across sizes either way
+	if (frame.samplesReset || (int)_prior.size() != pixelCount)
+	{
+		bool reproject = _hasHistory && (frame.camera != _prevCamera || _size != _prevSize);
+		std::vector<glm::vec4> prior(pixelCount, glm::vec4(0));
+		if (reproject)
+		{
+			#pragma omp parallel for
+			for (int i = 0; i < pixelCount; i++)
+				prior[i] = reprojectHistory(frame, {i % _size.x, i / _size.x});
+		}
+		_prior = std::move(prior);
+	}
+	_history.resize(pixelCount);
+
+	auto filtered = combine(frame);
+	for (int i = 0; i < Denoiser::ATROUS_ITERATIONS; i++)
+		filtered = filter(frame, filtered, 1 << i);
+
+	std::vector<glm::vec3> result(pixelCount);
+	for (int i = 0; i < pixelCount; i++)
+		result[i] = remodulate(glm::vec3(filtered[i]), frame.albedo[i]);
+
+	_prevNormalDepth = frame.normalDepth;
+	_prevSize = _size;
+	_prevCamera = frame.camera;
+	_hasHistory = true;
+	return result;
+}
+
+glm::vec4 CpuDenoiser::reprojectHistory(const DenoiserFrame& frame, glm::ivec2 p) const
+{
+	glm::vec4 normalDepth = frame.normalDepth[pixelIndex(p)];
+	if (normalDepth.w <= 0) return glm::vec4(0);
+
+	glm::vec3 worldPos = frame.camera.pos + getCameraRayDir(glm::vec2(p) + 0.5f, _size, frame.camera) * normalDepth.w;
+	glm::vec3 prevDir = worldPos - _prevCamera.pos;
+	float prevDepth = length(prevDir);
+
+	glm::vec2 prevPixelPos;
+	if (!projectToPixel(prevDir / prevDepth, _prevSize, _prevCamera, prevPixelPos)) return glm::vec4(0);
+
+	glm::vec2 base = prevPixelPos - 0.5f;
+	glm::ivec2 p0 = glm::ivec2(floor(base));
+	glm::vec2 f = base - glm::vec2(p0);
+
+	glm::vec4 historySum = glm::vec4(0);
+	float weightSum = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		glm::ivec2 offset = {i & 1, i >> 1};
+		glm::ivec2 q = p0 + offset;
+		if (!isInside(q, _prevSize)) continue;
+
+		int prevIndex = q.y * _prevSize.x + q.x;
+		glm::vec4 prevNormalDepth = _prevNormalDepth[prevIndex];
+		if (abs(prevNormalDepth.w - prevDepth) > Denoiser::DEPTH_TOLERANCE * prevDepth) continue;
+		if (dot(glm::vec3(prevNormalDepth), glm::vec3(normalDepth)) < Denoiser::NORMAL_TOLERANCE) continue;
+
+		glm::vec2 bilinear = mix(1.0f - f, f, glm::vec2(offset));
+		float w = bilinear.x * bilinear.y;
+		historySum += _history[prevIndex] * w;
+		weightSum += w;
+	}
+	if (weightSum < 0.01f) return glm::vec4(0);
+
+	glm::vec4 history = historySum / weightSum;
+	return {glm::vec3(history), std::min(history.w, (float)Denoiser::MAX_HISTORY_SAMPLES)};
+}
+
+std::vector<glm::vec4> CpuDenoiser::combine(const DenoiserFrame& frame)
+{
+	int pixelCount = _size.x * _size.y;
+	std::vector<glm::vec4> result(pixelCount);
+
+	#pragma omp parallel for
+	for (int i = 0; i < pixelCount; i++)
+	{
+		glm::vec3 illumination = demodulate(frame.mean[i], frame.albedo[i]);
+		glm::vec4 prior = _prior[i];
+
+		float weight = prior.w + frame.sampleCount;
+		glm::vec3 color = (glm::vec3(prior) * prior.w + illumination * (float)frame.sampleCount) / weight;
+		float variance = getSampleVariance(frame, {i % _size.x, i / _size.x}, weight) / weight;
+
+		_history[i] = {color, weight};
+		result[i] = {color, variance};
+	}
+	return result;
+}
+
+float CpuDenoiser::getSampleVariance(const DenoiserFrame& frame, glm::ivec2 p, float weight) const
+{
+	int i = pixelIndex(p);
+	if (weight >= Denoiser::MIN_MOMENT_SAMPLES)
+	{
+		float albedoLum = std::max(Math::luminance(frame.albedo[i]), Denoiser::ALBEDO_EPSILON);
+		float lum = Math::luminance(frame.mean[i]);
+		return std::max(frame.lumSqr[i] - lum * lum, 0.0f) / (albedoLum * albedoLum);
+	}
+
+	float sum = 0;
+	float sqrSum = 0;
+	int count = 0;
+	for (int y = -1; y <= 1; y++)
+	{
+		for (int x = -1; x <= 1; x++)
+		{
+			glm::ivec2 q = p + glm::ivec2(x, y);
+			if (!isInsideView(q)) continue;
+
+			int qi = pixelIndex(q);
+			float lum = Math::luminance(demodulate(frame.mean[qi], frame.albedo[qi]));
+			sum += lum;
+			sqrSum += lum * lum;
+			count++;
+		}
+	}
+	float mean = sum / count;
+	return std::max(sqrSum / count - mean * mean, 0.0f);
+}
+
+std::vector<glm::vec4> CpuDenoiser::filter(const DenoiserFrame& frame, const std::vector<glm::vec4>& input, int stepSize) const
+{
+	static constexpr float KERNEL[3] = {3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+	static constexpr float GAUSSIAN[2] = {1.0f / 4.0f, 1.0f / 8.0f};
+
+	int pixelCount = _size.x * _size.y;
+	float pixelAngle = frame.camera.viewSize.y / _size.y / frame.camera.focalDistance;
+	std::vector<glm::vec4> result(pixelCount);
+
+	#pragma omp parallel for
+	for (int i = 0; i < pixelCount; i++)
+	{
+		glm::ivec2 p = {i % _size.x, i / _size.x};
+		glm::vec4 center = input[i];
+		glm::vec4 normalDepth = frame.normalDepth[i];
+		if (normalDepth.w <= 0)
+		{
+			result[i] = center;
+			continue;
+		}
+
+		float blurredVariance = 0;
+		float blurWeightSum = 0;
+		for (int y = -1; y <= 1; y++)
+		{
+			for (int x = -1; x <= 1; x++)
+			{
+				glm::ivec2 q = p + glm::ivec2(x, y);
+				if (!isInsideView(q)) continue;
+
+				float w = GAUSSIAN[abs(x)] * GAUSSIAN[abs(y)];
+				blurredVariance += input[pixelIndex(q)].w * w;
+				blurWeightSum += w;
+			}
+		}
+
+		float lum = Math::luminance(glm::vec3(center));
+		float lumScale = Denoiser::SIGMA_LUMINANCE * sqrt(blurredVariance / blurWeightSum) + 1e-10f;
+
+		glm::vec3 colorSum = glm::vec3(0);
+		float varianceSum = 0;
+		float weightSum = 0;
+		for (int y = -2; y <= 2; y++)
+		{
+			for (int x = -2; x <= 2; x++)
+			{
+				glm::ivec2 q = p + glm::ivec2(x, y) * stepSize;
+				if (!isInsideView(q)) continue;
+
+				int qi = pixelIndex(q);
+				glm::vec4 sampleNormalDepth = frame.normalDepth[qi];
+				if (sampleNormalDepth.w <= 0) continue;
+				glm::vec4 sampleValue = input[qi];
+
+				float depthScale = Denoiser::SIGMA_DEPTH * normalDepth.w * pixelAngle * stepSize * length(glm::vec2(x, y)) + 1e-10f;
+
+				float wNormal = pow(std::max(dot(glm::vec3(normalDepth), glm::vec3(sampleNormalDepth)), 0.0f), Denoiser::SIGMA_NORMAL);
+				float wDepth = exp(-abs(normalDepth.w - sampleNormalDepth.w) / depthScale);
+				float wLum = exp(-abs(lum - Math::luminance(glm::vec3(sampleValue))) / lumScale);
+				float w = KERNEL[abs(x)] * KERNEL[abs(y)] * wNormal * wDepth * wLum;
+
+				colorSum += glm::vec3(sampleValue) * w;
+				varianceSum += sampleValue.w * w * w;
+				weightSum += w;
+			}
+		}
+		result[i] = {colorSum / weightSum, varianceSum / (weightSum * weightSum)};
+	}
+	return result;
+}
+
+glm::vec3 CpuDenoiser::demodulate(const glm::vec3& color, const glm::vec3& albedo)
+{
+	return color / max(albedo, glm::vec3(Denoiser::ALBEDO_EPSILON));
+}
+glm::vec3 CpuDenoiser::remodulate(const glm::vec3& illumination, const glm::vec3& albedo)
+{
+	return illumination * max(albedo, glm::vec3(Denoiser::ALBEDO_EPSILON));
+}
+
+glm::vec3 CpuDenoiser::getCameraRayDir(glm::vec2 pixelPos, glm::ivec2 size, const DenoiserCamera& camera)
+{
+	glm::vec3 right = glm::vec3(camera.rot[0]), up = glm::vec3(camera.rot[1]), forward = glm::vec3(camera.rot[2]);
+	glm::vec3 lb = camera.focalDistance * forward - 0.5f * camera.viewSize.x * right - 0.5f * camera.viewSize.y * up;
+	glm::vec2 pos = pixelPos / glm::vec2(size) * camera.viewSize;
+	return normalize(lb + pos.x * right + pos.y * up);
+}
+bool CpuDenoiser::projectToPixel(const glm::vec3& dir, glm::ivec2 size, const DenoiserCamera& camera, glm::vec2& pixelPos)
+{
+	glm::vec3 right = glm::vec3(camera.rot[0]), up = glm::vec3(camera.rot[1]), forward = glm::vec3(camera.rot[2]);
+	float z = dot(dir, forward);
+	if (z <= 0) return false;
+
+	glm::vec2 pos = glm::vec2(dot(dir, right), dot(dir, up)) * camera.focalDistance / z + 0.5f * camera.viewSize;
+	pixelPos = pos / camera.viewSize * glm::vec2(size);
+	return true;
+}
+
+// A floor and a back wall under smooth light, with noise that shrinks with the sample count
+DenoiserFrame CpuDenoiser::makeCheckFrame(const DenoiserCamera& camera, int sampleCount, bool samplesReset, int seed)
+{
+	constexpr float floorY = -1;
+	constexpr float wallZ = 6;
+	constexpr float noiseAmplitude = 0.15f;
+
+	int pixelCount = CHECK_SIZE.x * CHECK_SIZE.y;
+	DenoiserFrame frame {CHECK_SIZE, std::vector<glm::vec3>(pixelCount), std::vector<float>(pixelCount), std::vector<glm::vec3>(pixelCount), std::vector<glm::vec4>(pixelCount), camera, sampleCount, samplesReset};
+	for (int i = 0; i < pixelCount; i++)
+	{
+		glm::ivec2 p = {i % CHECK_SIZE.x, i / CHECK_SIZE.x};
+		glm::vec3 dir = getCameraRayDir(glm::vec2(p) + 0.5f, CHECK_SIZE, camera);
+
+		float tFloor = dir.y < 0 ? (floorY - camera.pos.y) / dir.y : FLT_MAX;
+		float tWall = dir.z > 0 ? (wallZ - camera.pos.z) / dir.z : FLT_MAX;
+		float t = std::min(tFloor, tWall);
+		if (t == FLT_MAX)
+		{
+			frame.mean[i] = glm::vec3(0.5f);
+			frame.lumSqr[i] = 0.25f;
+			frame.albedo[i] = glm::vec3(1);
+			continue;
+		}
+
+		glm::vec3 pos = camera.pos + dir * t;
+		bool isFloor = tFloor < tWall;
+		bool checker = ((int)floor(pos.x) + (int)floor(isFloor ? pos.z : pos.y)) % 2 == 0;
+		glm::vec3 albedo = checker ? glm::vec3(0.8f, 0.7f, 0.6f) : glm::vec3(0.3f, 0.4f, 0.5f);
+		float light = isFloor ? 0.6f + 0.2f * sin(pos.x) : 0.3f + 0.1f * cos(pos.y * 2);
+
+		// Deterministic per pixel and frame, so both sides see the same input
+		uint32_t h = (uint32_t)p.x * 73856093u ^ (uint32_t)p.y * 19349663u ^ (uint32_t)seed * 83492791u;
+		h ^= h >> 13;
+		h *= 0x5bd1e995u;
+		h ^= h >> 15;
+		float noise = ((h & 0xffffff) / (float)0xffffff * 2 - 1) * noiseAmplitude / sqrt((float)sampleCount);
+
+		frame.mean[i] = albedo * std::max(light + noise, 0.0f);
+		float lum = Math::luminance(frame.mean[i]);
+		frame.lumSqr[i] = lum * lum + Math::luminance(albedo) * noiseAmplitude * noiseAmplitude / (3.0f * sampleCount);
+		frame.albedo[i] = albedo;
+		frame.normalDepth[i] = {isFloor ? vec3::UP : vec3::BACKWARD, t};
+	}
+	return frame;
+}
+
+void CpuDenoiser::checkAgainstGpu()
+{
+	// A reset, a moved camera that reprojects the history, and more samples on top of it
+	glm::vec2 viewSize = {CHECK_SIZE.x / (float)CHECK_SIZE.y, 1};
+	DenoiserCamera cameraA = {{0, 0, 0}, glm::mat4(1), viewSize, 1};
+	DenoiserCamera cameraB = {{0.05f, 0.02f, 0.1f}, glm::mat4(1), viewSize, 1};
+	DenoiserFrame frames[] = {
+		makeCheckFrame(cameraA, 1, true, 0),
+		makeCheckFrame(cameraB, 1, true, 1),
+		makeCheckFrame(cameraB, 8, false, 2),
+	};
+
+	auto viewSizeBefore = Denoiser::_size;
+	Denoiser::resize(CHECK_SIZE);
+
+	CpuDenoiser cpuDenoiser;
+	for (int f = 0; f < std::size(frames); f++)
+	{
+		const auto& frame = frames[f];
+		int pixelCount = CHECK_SIZE.x * CHECK_SIZE.y;
+		std::vector<glm::vec4> mean(pixelCount), albedo(pixelCount);
+		for (int i = 0; i < pixelCount; i++)
+		{
+			mean[i] = {frame.mean[i], frame.lumSqr[i]};
+			albedo[i] = {frame.albedo[i], 1};
+		}
+
+		GLTexture2D meanTex(CHECK_SIZE.x, CHECK_SIZE.y, mean.data(), GL_RGBA, GL_RGBA32F, GL_NEAREST, GL_FLOAT);
+		GLTexture2D albedoTex(CHECK_SIZE.x, CHECK_SIZE.y, albedo.data(), GL_RGBA, GL_RGBA32F, GL_NEAREST, GL_FLOAT);
+		GLTexture2D normalDepthTex(CHECK_SIZE.x, CHECK_SIZE.y, frame.normalDepth.data(), GL_RGBA, GL_RGBA32F, GL_NEAREST, GL_FLOAT);
+		Denoiser::denoise({&meanTex, &albedoTex, &normalDepthTex}, CHECK_SIZE, frame.camera, frame.sampleCount, frame.samplesReset);
+
+		glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+		auto gpuResult = Denoiser::_outputTex->readData<glm::vec4>();
+		auto cpuResult = cpuDenoiser.denoise(frame);
+
+		// The GPU output is gamma corrected and quantized to 8 bits
+		float maxError = 0;
+		int failedPixels = 0;
+		for (int i = 0; i < pixelCount; i++)
+		{
+			glm::vec3 expected = glm::clamp(glm::pow(glm::max(cpuResult[i], 0.0f), glm::vec3(0.454545f)), 0.0f, 1.0f);
+			glm::vec3 diff = glm::abs(expected - glm::vec3(gpuResult[i]));
+			float error = std::max({diff.x, diff.y, diff.z});
+			maxError = std::max(maxError, error);
+			if (error > CHECK_TOLERANCE) failedPixels++;
+		}
+
+		if (failedPixels > 0)
+			Debug::logError("CPU denoiser check: frame ", f, " differs on ", failedPixels, " of ", pixelCount, " pixels, max error ", maxError * 255, "/255.");
+		else
+			Debug::log("CPU denoiser check: frame ", f, " matches the compute passes, max error ", maxError * 255, "/255.");
+	}
+
+	// The view's targets start over, their history was replaced by the check
+	Denoiser::resize(viewSizeBefore);
+	Renderer::resetSamples();
+}
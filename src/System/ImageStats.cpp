@@ -0,0 +1,76 @@
+#include "ImageStats.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+#include "GLObject.h"
+
+void ImageStats::init()
+{
+	constexpr GLbitfield readFlags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+	_statsProgram = make_unique<ComputeShaderProgram>("shaders/compute/image_stats.comp");
+	_statsProgram->use();
+	_statsProgram->setFloat("histogramMinLog2", HISTOGRAM_MIN_LOG2);
+	_statsProgram->setFloat("histogramMaxLog2", HISTOGRAM_MAX_LOG2);
+
+	_statsSSBO = make_unique<SSBO>(1, 22);
+	_statsSSBO->setStorage(SLOT_SIZE * FRAME_COUNT, readFlags);
+	_mappedStats = (const uint32_t*)_statsSSBO->mapStorage(readFlags);
+}
+
+void ImageStats::update()
+{
+	_ring.completeSlots(false, readSlot);
+}
+
+// Only the lower left size x size region is reduced, previews leave the rest of the targets stale
+void ImageStats::reduce(GLTexture2D* mean, glm::ivec2 size)
+{
+	// The oldest slot is reused, which only waits when results are FRAME_COUNT requests behind
+	if (_ring.complete(_ring.frame(), true))
+		readSlot(_ring.frame());
+
+	int tileSize = TILE_SIZE;
+	glm::ivec2 tileCount = (size + tileSize - 1) / tileSize;
+	while (tileCount.x * tileCount.y > MAX_TILES)
+	{
+		tileSize *= 2;
+		tileCount = (size + tileSize - 1) / tileSize;
+	}
+
+	_statsProgram->use();
+	_statsSSBO->bindDefault();
+	_statsProgram->setInt("slotOffset", _ring.frame() * SLOT_SIZE);
+	_statsProgram->setInt2("size", size);
+	_statsProgram->setInt("tileSize", tileSize);
+	_statsProgram->setInt2("tileCount", tileCount);
+	_statsProgram->setHandle("meanTexture", mean->getHandle());
+
+	_statsProgram->setInt("pass", PASS_CLEAR);
+	ComputeShaderProgram::dispatch({1, 1, 1}, GL_SHADER_STORAGE_BARRIER_BIT);
+	_statsProgram->setInt("pass", PASS_TILES);
+	ComputeShaderProgram::dispatch({tileCount.x, tileCount.y, 1}, GL_SHADER_STORAGE_BARRIER_BIT);
+	_statsProgram->setInt("pass", PASS_TOTAL);
+	ComputeShaderProgram::dispatch({1, 1, 1}, GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+
+	_tileCounts[_ring.frame()] = tileCount;
+	_ring.submit();
+}
+
+void ImageStats::readSlot(int slot)
+{
+	auto stats = _mappedStats + slot * SLOT_SIZE;
+	_latest.valid = true;
+	_latest.meanVariance = std::bit_cast<float>(stats[0]);
+	_latest.minLuminance = std::bit_cast<float>(stats[1]);
+	_latest.maxLuminance = std::bit_cast<float>(stats[2]);
+	std::memcpy(_latest.histogram.data(), stats + 4, sizeof(_latest.histogram));
+
+	int tileCount = std::min((int)stats[3], MAX_TILES);
+	_latest.tileCount = _tileCounts[slot];
+	_latest.tileVariance.resize(tileCount);
+	for (int i = 0; i < tileCount; i++)
+		_latest.tileVariance[i] = std::bit_cast<float>(stats[STATS_HEADER_SIZE + i]);
+}
@@ -30,6 +30,7 @@ void Input::updateInputState()
 	_lastMouseRightState = _mouseRightState;
 
 	_mouseWheelChange = 0;
+	_cameraMoved = false;
 }
 void Input::updateMovement()
 {
@@ -61,7 +62,10 @@ void Input::updateMovement()
 		moveDir += camera->down();
 
 	if (moveDir != vec3::ZERO)
+	{
 		camera->translate(moveDir * finalMoveSpeed * Time::deltaTime());
+		_cameraMoved = true;
+	}
 	else
 		_currMoveAcceleration = 1;
 }
@@ -179,6 +183,7 @@ void Input::handleSDLEvent(const SDL_Event& event)
 		pitch = glm::clamp(pitch, pitchMin, pitchMax);
 
 		camera->setRot(pitch, yaw, roll);
+		_cameraMoved = true;
 	}
 
 	if (event.type == SDL_MOUSEWHEEL)
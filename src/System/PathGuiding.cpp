@@ -0,0 +1,248 @@
+#include "PathGuiding.h"
+
+#include <algorithm>
+#include <cstring>
+#include <numbers>
+#include <glm/common.hpp>
+
+#include "Renderer.h"
+
+void PathGuiding::init()
+{
+	std::vector<float> noDistribution(BINS, 0);
+	_distributionSSBO = make_unique<SSBO>(1, 27);
+	_distributionSSBO->setData(noDistribution.data(), BINS);
+
+	auto program = Renderer::renderProgram();
+	program->use();
+	program->setFloat("guidingFraction", GUIDING_FRACTION);
+	program->setInt("guidingRecordCapacity", RECORD_CAPACITY);
+	program->setInt("guidingRecordRatio", RECORD_RATIO);
+	program->setInt("guidingGridRes", 0);
+
+	_worker = std::jthread(workerLoop);
+}
+void PathGuiding::quit()
+{
+	_worker.request_stop();
+	_recordsCondition.notify_all();
+	if (_worker.joinable())
+		_worker.join();
+}
+
+void PathGuiding::reset()
+{
+	{
+		std::lock_guard lock(_mutex);
+		_recordQueue.clear();
+		_builtDistribution.reset();
+		_resetRequested = true;
+	}
+	_recordsCondition.notify_one();
+
+	auto program = Renderer::renderProgram();
+	program->use();
+	program->setInt("guidingGridRes", 0);
+}
+
+// The records live at the start of the renderer's frame records, whose storage is replaced when the reservoirs
+// behind them outgrow it. Slots still pending in the previous storage are read before it goes away.
+void PathGuiding::mapRecords(const SSBO* buffer)
+{
+	if (_mappedCounts != nullptr)
+		_ring.completeSlots(true, readSlot);
+
+	_mappedCounts = (uint32_t*)buffer->mapStorage(RECORD_MAP_FLAGS);
+	_mappedRecords = (const GuidingRecord*)(_mappedCounts + 4);
+	std::memset(_mappedCounts, 0, 4 * sizeof(uint32_t));
+}
+
+// Only slots whose records were handed to the worker are written again, a busy slot skips recording
+void PathGuiding::beginFrame(bool record)
+{
+	_recording = record && !_ring.isPending(_ring.frame());
+
+	auto program = Renderer::renderProgram();
+	program->setInt("guidingSlot", _recording ? _ring.frame() : -1);
+	_distributionSSBO->bindDefault();
+}
+void PathGuiding::endFrame()
+{
+	if (!_recording) return;
+
+	glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+	_ring.submit();
+}
+
+void PathGuiding::update()
+{
+	// Never waiting, slots that aren't done yet are picked up on a later frame
+	_ring.completeSlots(false, readSlot);
+
+	UPtr<Distribution> distribution;
+	{
+		std::lock_guard lock(_mutex);
+		distribution = std::move(_builtDistribution);
+	}
+	if (distribution)
+		upload(*distribution);
+}
+
+void PathGuiding::readSlot(int slot)
+{
+	int count = std::min((int)_mappedCounts[slot], RECORD_CAPACITY);
+	auto records = _mappedRecords + slot * RECORD_CAPACITY;
+	_mappedCounts[slot] = 0;
+	if (count == 0) return;
+	{
+		std::lock_guard lock(_mutex);
+		_recordQueue.emplace_back(records, records + count);
+	}
+	_recordsCondition.notify_one();
+}
+
+void PathGuiding::upload(const Distribution& distribution)
+{
+	_distributionSSBO->setData(distribution.cdf.data(), distribution.cdf.size());
+
+	auto program = Renderer::renderProgram();
+	program->use();
+	program->setFloat3("guidingGridMin", distribution.gridMin);
+	program->setFloat3("guidingGridSize", distribution.gridSize);
+	program->setInt("guidingGridRes", GRID_RESOLUTION);
+}
+
+void PathGuiding::workerLoop(const std::stop_token& stopToken)
+{
+	while (true)
+	{
+		std::vector<GuidingRecord> records;
+		bool resetRequested;
+		{
+			std::unique_lock lock(_mutex);
+			if (!_recordsCondition.wait(lock, stopToken, [] { return !_recordQueue.empty() || _resetRequested; })) return;
+
+			resetRequested = _resetRequested;
+			_resetRequested = false;
+			if (!_recordQueue.empty())
+			{
+				records = std::move(_recordQueue.front());
+				_recordQueue.pop_front();
+			}
+		}
+
+		if (resetRequested)
+		{
+			_histograms.clear();
+			_cellRecords.clear();
+			_gridSize = {0, 0, 0};
+			_recordsSinceBuild = 0;
+		}
+		train(records);
+
+		if (_recordsSinceBuild < REBUILD_RECORDS) continue;
+		_recordsSinceBuild = 0;
+
+		auto distribution = build();
+		if (!distribution) continue;
+
+		std::lock_guard lock(_mutex);
+		if (!_resetRequested)
+			_builtDistribution = std::move(distribution);
+	}
+}
+
+void PathGuiding::train(const std::vector<GuidingRecord>& records)
+{
+	if (records.empty()) return;
+
+	// The first records after a reset decide the grid, build() widens it when paths leave it
+	if (_gridSize == glm::vec3(0))
+	{
+		_recordMin = glm::vec3(records[0].posWeight);
+		_recordMax = _recordMin;
+		for (const auto& record : records)
+		{
+			_recordMin = glm::min(_recordMin, glm::vec3(record.posWeight));
+			_recordMax = glm::max(_recordMax, glm::vec3(record.posWeight));
+		}
+		fitGrid();
+		_histograms.assign(GRID_RESOLUTION * GRID_RESOLUTION * GRID_RESOLUTION * BINS, 0);
+		_cellRecords.assign(GRID_RESOLUTION * GRID_RESOLUTION * GRID_RESOLUTION, 0);
+	}
+
+	for (const auto& record : records)
+	{
+		glm::vec3 pos = record.posWeight;
+		_recordMin = glm::min(_recordMin, pos);
+		_recordMax = glm::max(_recordMax, pos);
+
+		int cell = getCellIndex(pos);
+		_histograms[cell * BINS + getBinIndex(record.dir)] += record.posWeight.w;
+		_cellRecords[cell]++;
+	}
+	_recordsSinceBuild += records.size();
+}
+
+// Padded, so paths that reach a little further don't move the grid again
+void PathGuiding::fitGrid()
+{
+	glm::vec3 padding = glm::max(_recordMax - _recordMin, glm::vec3(1e-3f)) * GRID_PADDING;
+	_gridMin = _recordMin - padding;
+	_gridSize = _recordMax - _recordMin + 2.0f * padding;
+}
+
+UPtr<PathGuiding::Distribution> PathGuiding::build()
+{
+	// Bins no longer match once the grid moves, they are trained again from scratch
+	if (glm::any(glm::lessThan(_recordMin, _gridMin)) || glm::any(glm::greaterThan(_recordMax, _gridMin + _gridSize)))
+	{
+		fitGrid();
+		std::ranges::fill(_histograms, 0.0f);
+		std::ranges::fill(_cellRecords, 0.0f);
+		return nullptr;
+	}
+
+	// Cells with too few records keep an empty cdf and are sampled by the bsdf alone.
+	// A uniform share keeps directions that weren't recorded yet reachable.
+	auto distribution = make_unique<Distribution>(_gridMin, _gridSize, std::vector<float>(_histograms.size(), 0));
+	for (int cell = 0; cell < _cellRecords.size(); cell++)
+	{
+		const float* histogram = _histograms.data() + cell * BINS;
+		float total = 0;
+		for (int i = 0; i < BINS; i++)
+			total += histogram[i];
+		if (_cellRecords[cell] < MIN_CELL_RECORDS || total <= 0) continue;
+
+		float* cdf = distribution->cdf.data() + cell * BINS;
+		float sum = 0;
+		for (int i = 0; i < BINS; i++)
+		{
+			sum += (1 - UNIFORM_FRACTION) * histogram[i] / total + UNIFORM_FRACTION / BINS;
+			cdf[i] = sum;
+		}
+		cdf[BINS - 1] = 1;
+	}
+
+	// Older records fade out, so the distribution follows changes of the scene
+	for (auto& value : _histograms)
+		value *= HISTORY_DECAY;
+	for (auto& count : _cellRecords)
+		count *= HISTORY_DECAY;
+
+	return distribution;
+}
+
+// Same mappings as getGuidingCell and getGuidingBin in guiding.glsl
+int PathGuiding::getCellIndex(const glm::vec3& pos)
+{
+	glm::ivec3 cell = glm::clamp(glm::ivec3((pos - _gridMin) / _gridSize * (float)GRID_RESOLUTION), 0, GRID_RESOLUTION - 1);
+	return (cell.z * GRID_RESOLUTION + cell.y) * GRID_RESOLUTION + cell.x;
+}
+int PathGuiding::getBinIndex(const glm::vec3& dir)
+{
+	float u = dir.z * 0.5f + 0.5f;
+	float v = std::atan2(dir.y, dir.x) / (2 * std::numbers::pi_v<float>) + 0.5f;
+	glm::ivec2 bin = glm::clamp(glm::ivec2(glm::vec2(u, v) * (float)DIRECTION_RESOLUTION), 0, DIRECTION_RESOLUTION - 1);
+	return bin.y * DIRECTION_RESOLUTION + bin.x;
+}
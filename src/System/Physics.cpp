@@ -1,39 +1,189 @@
 #include "Physics.h"
 
+#include "Camera.h"
+#include "CpuBVH.h"
 #include "GLObject.h"
 #include "Graphical.h"
+#include "Light.h"
+#include "MyMath.h"
+#include "Renderer.h"
 #include "Scene.h"
 #include "Triangle.h"
 #include "WindowDrawer.h"
 
 void Physics::init()
 {
+	constexpr GLbitfield writeFlags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	constexpr GLbitfield readFlags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
 	_raycastProgram = make_unique<ComputeShaderProgram>("shaders/compute/raycast.comp");
+
+	_querySSBO = make_unique<SSBO>((int)sizeof(RaycastQueryStruct) / 4, 21);
+	_querySSBO->setStorage(MAX_BATCH_RAYS * FRAME_COUNT, writeFlags);
+	_mappedQueries = _querySSBO->mapStorage(writeFlags);
+
 	_resultSSBO = make_unique<SSBO>((int)sizeof(RaycastHitStruct) / 4, 20);
-	_resultSSBO->setStorage(1, GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT);
+	_resultSSBO->setStorage(MAX_BATCH_RAYS * FRAME_COUNT, readFlags);
+	_mappedResults = _resultSSBO->mapStorage(readFlags);
+}
+
+void Physics::update()
+{
+	_ring.completeSlots(false, readSlot);
+
+	dispatchPending();
 }
 
 RaycastHit Physics::raycast(glm::vec3 pos, glm::vec3 dir, float maxDis)
 {
+	// Answered from the CPU BVH, so no GPU round trip is needed
+	BVHHit hit;
+	bool didHit = CpuBVH::raycast(pos, dir, maxDis, hit);
+	float t = didHit ? hit.t : maxDis;
+
+	int lightIndex = -1;
+	if (WindowDrawer::showIcons())
+	{
+		for (int i = 0; i < Scene::lights.size(); i++)
+		{
+			if (CpuBVH::intersectSphere(Scene::lights[i]->pos(), LIGHT_ICON_RADIUS, pos, dir, t))
+				lightIndex = i;
+		}
+	}
+
+	if (lightIndex != -1)
+		return {true, pos + dir * t, vec3::RIGHT, {}, Scene::lights[lightIndex], nullptr, true};
+	if (!didHit)
+		return {};
+
+	auto triangle = hit.triIndex != -1 ? Scene::baseTriangles[hit.triIndex] : nullptr;
+	return {true, hit.pos, hit.normal, hit.uv, Scene::graphicals[hit.objIndex], triangle, false};
+}
+
+void Physics::raycastAsync(std::vector<RaycastQuery> queries, RaycastCallback callback)
+{
+	if (queries.empty()) return;
+	if (queries.size() > MAX_BATCH_RAYS)
+	{
+		Debug::logError("Raycast batch exceeds ", MAX_BATCH_RAYS, " rays.");
+		return;
+	}
+
+	_pendingRequests.push_back({std::move(queries), std::move(callback)});
+}
+
+void Physics::flushRaycasts()
+{
+	while (!_pendingRequests.empty())
+		dispatchPending();
+
+	_ring.completeSlots(true, readSlot);
+}
+
+void Physics::dispatchPending()
+{
+	if (_pendingRequests.empty()) return;
+
+	// The oldest frame slot is reused, which only waits when results are FRAME_COUNT frames behind
+	int slot = _ring.frame();
+	if (_ring.complete(slot, true))
+		readSlot(slot);
+
+	int frameOffset = slot * MAX_BATCH_RAYS;
+	int count = 0;
+	auto queries = (RaycastQueryStruct*)_mappedQueries + frameOffset;
+	while (!_pendingRequests.empty() && count + _pendingRequests.front().queries.size() <= MAX_BATCH_RAYS)
+	{
+		auto& request = _pendingRequests.front();
+		for (int i = 0; i < request.queries.size(); i++)
+		{
+			const auto& query = request.queries[i];
+			queries[count + i] = {glm::vec4(query.pos, query.maxDis), glm::vec4(query.dir, 0)};
+		}
+
+		_submittedRequests[slot].push_back({frameOffset + count, (int)request.queries.size(), std::move(request.callback)});
+		count += request.queries.size();
+		_pendingRequests.pop_front();
+	}
 	_raycastProgram->use();
 	BufferController::bindBuffers();
+	_querySSBO->bindDefault();
+	_resultSSBO->bindDefault();
 
-	_raycastProgram->setFloat3("rayPos", pos);
-	_raycastProgram->setFloat3("rayDir", dir);
-	_raycastProgram->setFloat("rayMaxDis", maxDis);
+	_raycastProgram->setInt("queryOffset", frameOffset);
+	_raycastProgram->setInt("queryCount", count);
 	_raycastProgram->setInt("objectCount", Scene::graphicals.size());
 	_raycastProgram->setInt("primObjCount", BufferController::lastPrimObjCount());
-	_raycastProgram->setInt("lightCount", Scene::lights.size());
+	_raycastProgram->setInt("sceneLightCount", BufferController::sceneLightCount());
 	_raycastProgram->setInt("triCount", Scene::baseTriangles.size());
 	_raycastProgram->setBool("doIntersectLights", WindowDrawer::showIcons());
 	_raycastProgram->setInt("bvhRootNode", BufferController::bvhRootNode());
+	_raycastProgram->setInt("bvhTraversalMode", (int)Renderer::bvhTraversalMode());
+	_raycastProgram->setBool("useTriangleRecords", Renderer::useTriangleRecords());
+
+	ComputeShaderProgram::dispatch({(count + WORK_GROUP_SIZE - 1) / WORK_GROUP_SIZE, 1, 1}, GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+	_ring.submit();
+}
+
+void Physics::readSlot(int slot)
+{
+	auto results = (const RaycastHitStruct*)_mappedResults;
+	for (auto& request : _submittedRequests[slot])
+	{
+		std::vector<RaycastHit> hits(request.count);
+		for (int i = 0; i < request.count; i++)
+		{
+			const auto& result = results[request.first + i];
+			bool hitLight = result.normalHitLight.w != 0;
+
+			// The scene may have changed while the query was in flight
+			int objCount = hitLight ? Scene::lights.size() : Scene::graphicals.size();
+			if (result.objIndex >= objCount || result.triIndex >= (int)Scene::baseTriangles.size()) continue;
 
-	ComputeShaderProgram::dispatch({1, 1, 1});
-	RaycastHitStruct result = _resultSSBO->readData<RaycastHitStruct>(1)[0];
+			auto hitObj = result.objIndex != -1 ? hitLight ? (Object*)Scene::lights[result.objIndex] : (Object*)Scene::graphicals[result.objIndex] : nullptr;
+			auto triangle = result.triIndex != -1 ? Scene::baseTriangles[result.triIndex] : nullptr;
+			hits[i] = {result.objIndex != -1, glm::vec3(result.posT), glm::vec3(result.normalHitLight), result.uv, hitObj, triangle, hitLight};
+		}
+		request.callback(hits);
+	}
+	_submittedRequests[slot].clear();
+}
+
+void Physics::checkCpuBVH()
+{
+	auto camera = Camera::instance;
+	std::vector<RaycastQuery> queries;
+	queries.reserve(CHECK_GRID_SIZE * CHECK_GRID_SIZE);
+	for (int y = 0; y < CHECK_GRID_SIZE; y++)
+	{
+		for (int x = 0; x < CHECK_GRID_SIZE; x++)
+			queries.push_back({camera->pos(), camera->getDir((glm::vec2(x, y) + 0.5f) / (float)CHECK_GRID_SIZE)});
+	}
 
-	bool hit = result.objIndex != -1;
-	auto hitObj = result.objIndex != -1 ? result.hitLight ? (Object*)Scene::lights[result.objIndex] : (Object*)Scene::graphicals[result.objIndex] : nullptr;
-	auto triangle = result.triIndex != -1 ? Scene::baseTriangles[result.triIndex] : nullptr;
+	// The CPU side is answered when the GPU results arrive, so both see the same scene
+	auto rays = queries;
+	raycastAsync(std::move(queries), [rays = std::move(rays)](const std::vector<RaycastHit>& hits)
+	{
+		int mismatches = 0;
+		for (int i = 0; i < hits.size(); i++)
+		{
+			auto cpuHit = raycast(rays[i].pos, rays[i].dir, rays[i].maxDis);
+			if (hitsAgree(hits[i], cpuHit, rays[i].pos)) continue;
+
+			if (mismatches++ < CHECK_LOGGED_MISMATCHES)
+				Debug::logError("CPU BVH check: ray ", i, " hits ", cpuHit.hit ? cpuHit.object->name() : "nothing", " on the CPU and ", hits[i].hit ? hits[i].object->name() : "nothing", " on the GPU.");
+		}
+		Debug::log("CPU BVH check: ", hits.size() - mismatches, " of ", hits.size(), " rays agree with raycast.comp.");
+	});
+}
+
+// Alpha tested surfaces are only skipped on the GPU, rays through them count as mismatches
+bool Physics::hitsAgree(const RaycastHit& a, const RaycastHit& b, const glm::vec3& origin)
+{
+	if (a.hit != b.hit) return false;
+	if (!a.hit) return true;
 
-	return {hit, result.pos, result.normal, result.uv, hitObj, triangle, result.hitLight};
+	float disA = glm::distance(origin, a.pos);
+	float disB = glm::distance(origin, b.pos);
+	return a.object == b.object && abs(disA - disB) <= CHECK_DISTANCE_TOLERANCE * std::max(disA, disB);
 }
@@ -0,0 +1,84 @@
+#include "PrimaryRaster.h"
+
+#include "Camera.h"
+#include "Debug.h"
+#include "GLObject.h"
+#include "Graphical.h"
+#include "Model.h"
+#include "Scene.h"
+
+void PrimaryRaster::init()
+{
+	_rasterProgram = make_unique<DefaultShaderProgram<>>("shaders/raster/primary_visibility.vert", "shaders/raster/primary_visibility.frag");
+	_vao = make_unique<VAO>();
+	glGenFramebuffers(1, &_fbo);
+}
+
+void PrimaryRaster::resize(glm::ivec2 size)
+{
+	_hitTex = make_unique<GLTexture2D>(size.x, size.y, nullptr, GL_RG_INTEGER, GL_RG32I, GL_NEAREST, GL_INT);
+	_depthTex = make_unique<GLTexture2D>(size.x, size.y, nullptr, GL_DEPTH_COMPONENT, GL_DEPTH_COMPONENT32F, GL_NEAREST, GL_FLOAT);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _hitTex->id(), 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, _depthTex->id(), 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		Debug::logError("ERROR::FRAMEBUFFER:: Primary raster framebuffer is not complete!");
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// Expects the scene buffers bound and the viewport set to the render size
+void PrimaryRaster::draw(glm::ivec2 renderSize, glm::vec2 jitter)
+{
+	constexpr GLint noHit[] = {-1, -1, 0, 0};
+	constexpr GLfloat farDepth = 0;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+	glClearBufferiv(GL_COLOR, 0, noHit);
+	glClearBufferfv(GL_DEPTH, 0, &farDepth);
+
+	// Reversed depth into a float buffer, precision stays even far from the camera
+	glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE);
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_GREATER);
+
+	_rasterProgram->use();
+	_rasterProgram->setMatrix4X4("viewProj", getViewProjection(renderSize, jitter));
+
+	// Vertices are pulled from the triangle buffer, every mesh is one draw over its triangle range
+	glBindVertexArray(_vao->id());
+	for (int i = 0; i < Scene::graphicals.size(); i++)
+	{
+		auto mesh = dynamic_cast<Mesh*>(Scene::graphicals[i]);
+		if (mesh == nullptr || mesh->model() == nullptr) continue;
+		auto model = mesh->model();
+
+		int triCount = model->baseTriangles().size();
+		glDrawArraysInstancedBaseInstance(GL_TRIANGLES, model->triStartIndex() * 3, triCount * 3, 1, i);
+	}
+	glBindVertexArray(0);
+
+	glDepthFunc(GL_LESS);
+	glDisable(GL_DEPTH_TEST);
+	glClipControl(GL_LOWER_LEFT, GL_NEGATIVE_ONE_TO_ONE);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// Same image plane as the camera rays of pathtracer.frag, the jitter shifts it by a fraction of a pixel
+glm::mat4 PrimaryRaster::getViewProjection(glm::ivec2 renderSize, glm::vec2 jitter)
+{
+	auto camera = Camera::instance;
+	auto transform = camera->getTransform();
+	glm::vec3 right = transform[0], up = transform[1], forward = transform[2];
+	glm::vec3 pos = camera->pos();
+
+	glm::vec2 scale = camera->getFocalDis() / (0.5f * glm::vec2(camera->ratio(), 1));
+	glm::vec2 offset = -2.0f * jitter / glm::vec2(renderSize);
+
+	glm::vec4 rowW = glm::vec4(forward, -glm::dot(forward, pos));
+	glm::vec4 rowX = glm::vec4(right, -glm::dot(right, pos)) * scale.x + offset.x * rowW;
+	glm::vec4 rowY = glm::vec4(up, -glm::dot(up, pos)) * scale.y + offset.y * rowW;
+	glm::vec4 rowZ = {0, 0, 0, NEAR_PLANE};
+
+	return glm::transpose(glm::mat4(rowX, rowY, rowZ, rowW));
+}
@@ -0,0 +1,271 @@
+#include "RadianceCache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <unordered_set>
+#include <glm/geometric.hpp>
+
+#include "Camera.h"
+#include "GLObject.h"
+#include "Renderer.h"
+
+// Same hashes as utils.glsl
+static uint32_t hashUint(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+static uint32_t hashCombine(uint32_t seed, uint32_t v)
+{
+	return seed ^ (v + (seed << 6) + (seed >> 2));
+}
+
+static uint32_t getNormalBucket(const glm::vec3& normal)
+{
+	glm::vec3 a = glm::abs(normal);
+	int axis = a.x > a.y && a.x > a.z ? 0 : a.y > a.z ? 1 : 2;
+	return axis * 2 + (normal[axis] < 0 ? 1 : 0);
+}
+
+// The view height is 1 in camera units, see Camera::setRatio
+RadianceCacheView RadianceCacheView::current(glm::vec2 pixelSize)
+{
+	auto camera = Camera::instance;
+	return {camera->pos(), RadianceCache::CELL_PIXELS / (pixelSize.y * camera->getFocalDis())};
+}
+
+RadianceCacheKey RadianceCacheKey::get(const glm::vec3& pos, const glm::vec3& normal, const RadianceCacheView& view)
+{
+	float footprint = view.footprintScale * glm::distance(view.cameraPos, pos);
+	int lod = (int)std::ceil(std::log2(std::max(footprint, 1e-6f)));
+	float cellSize = std::exp2((float)lod);
+	glm::ivec3 cell = glm::floor(pos / cellSize);
+
+	uint32_t hash = hashUint(cell.x);
+	hash = hashCombine(hash, hashUint(cell.y));
+	hash = hashCombine(hash, hashUint(cell.z));
+	hash = hashCombine(hash, hashUint((uint32_t)lod << 3 | getNormalBucket(normal)));
+	return {hash, std::max(hashUint(hash ^ 0x9e3779b9u), 1u), cellSize};
+}
+
+void RadianceCache::init()
+{
+	_resolveProgram = make_unique<ComputeShaderProgram>("shaders/compute/radiance_cache.comp");
+	_resolveProgram->use();
+	_resolveProgram->setInt("radianceCacheCapacity", CAPACITY);
+	_resolveProgram->setFloat("maxHistory", MAX_HISTORY);
+	_resolveProgram->setInt("maxAge", MAX_AGE);
+
+	_cells = make_unique<SSBO>(CELL_ALIGN, 25);
+	_cells->ensureDataCapacity(CAPACITY);
+	clear();
+}
+
+void RadianceCache::clear()
+{
+	constexpr int emptyCell = 0;
+	_cells->clear(&emptyCell);
+}
+
+void RadianceCache::resolve(int frame)
+{
+	_resolveProgram->use();
+	_cells->bindDefault();
+	_resolveProgram->setInt("frame", frame);
+	ComputeShaderProgram::dispatch({(CAPACITY + GROUP_SIZE - 1) / GROUP_SIZE, 1, 1}, GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+CpuRadianceCache::CpuRadianceCache(int capacity) : _cells(capacity) {}
+
+int CpuRadianceCache::findCell(const RadianceCacheKey& key, bool insert)
+{
+	for (int i = 0; i < RadianceCache::MAX_PROBES; i++)
+	{
+		int index = (key.hash + i) % _cells.size();
+		if (_cells[index].checksum == key.checksum) return index;
+		if (_cells[index].checksum != 0 || !insert) continue;
+
+		_cells[index].checksum = key.checksum;
+		return index;
+	}
+	return -1;
+}
+int CpuRadianceCache::findCell(const RadianceCacheKey& key) const
+{
+	for (int i = 0; i < RadianceCache::MAX_PROBES; i++)
+	{
+		int index = (key.hash + i) % _cells.size();
+		if (_cells[index].checksum == key.checksum) return index;
+	}
+	return -1;
+}
+
+void CpuRadianceCache::train(const glm::vec3& pos, const glm::vec3& normal, const RadianceCacheView& view, const glm::vec3& radiance)
+{
+	int index = findCell(RadianceCacheKey::get(pos, normal, view), true);
+	if (index == -1) return;
+
+	auto& cell = _cells[index];
+	cell.accum += glm::uvec3(glm::clamp(radiance, 0.0f, RadianceCache::MAX_RADIANCE) * RadianceCache::FIXED_SCALE);
+	cell.accumCount++;
+}
+
+bool CpuRadianceCache::lookup(const glm::vec3& pos, const glm::vec3& normal, const RadianceCacheView& view, glm::vec3& radiance, float& cellSize) const
+{
+	auto key = RadianceCacheKey::get(pos, normal, view);
+	cellSize = key.cellSize;
+
+	int index = findCell(key);
+	if (index == -1) return false;
+
+	radiance = _cells[index].radiance;
+	return _cells[index].count >= RadianceCache::MIN_SAMPLES;
+}
+
+void CpuRadianceCache::resolve(int frame)
+{
+	for (auto& cell : _cells)
+	{
+		if (cell.checksum == 0) continue;
+
+		if (cell.accumCount > 0)
+		{
+			glm::vec3 trained = glm::vec3(cell.accum) / (RadianceCache::FIXED_SCALE * cell.accumCount);
+			float count = std::min(cell.count + cell.accumCount, RadianceCache::MAX_HISTORY);
+			cell.radiance = glm::mix(cell.radiance, trained, std::min(cell.accumCount / count, 1.0f));
+			cell.count = count;
+			cell.accum = {0, 0, 0};
+			cell.accumCount = 0;
+			cell.lastFrame = frame;
+		}
+		else if (frame - (int)cell.lastFrame > RadianceCache::MAX_AGE)
+			cell = {};
+	}
+}
+
+void CpuRadianceCache::clear()
+{
+	std::fill(_cells.begin(), _cells.end(), Cell());
+}
+
+// A few samples around each of a set of points out to a hundred units, on random axis aligned normals
+std::vector<CpuRadianceCache::TrainingSample> CpuRadianceCache::makeCheckSamples(int seed)
+{
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<float> uniform(0, 1);
+
+	std::vector<TrainingSample> samples;
+	samples.reserve(CHECK_CELLS * CHECK_SAMPLES_PER_CELL);
+	for (int c = 0; c < CHECK_CELLS; c++)
+	{
+		glm::vec3 center = glm::vec3(uniform(rng), uniform(rng), uniform(rng)) * 200.0f - 100.0f;
+		glm::vec3 normal(0);
+		normal[rng() % 3] = rng() % 2 == 0 ? 1.0f : -1.0f;
+
+		// Some radiance past the clamp, so both sides saturate the same way
+		glm::vec3 radiance = glm::vec3(uniform(rng), uniform(rng), uniform(rng)) * RadianceCache::MAX_RADIANCE * 1.2f;
+		for (int s = 0; s < CHECK_SAMPLES_PER_CELL; s++)
+		{
+			glm::vec3 offset = (glm::vec3(uniform(rng), uniform(rng), uniform(rng)) - 0.5f) * 0.01f;
+			samples.push_back({{center + offset, 0}, {normal, 0}, {radiance * (0.5f + uniform(rng)), 0}});
+		}
+	}
+	return samples;
+}
+
+void CpuRadianceCache::checkAgainstGpu()
+{
+	// Cells of the first set are only trained in the first frame and age out by the last one,
+	// the second set is trained until the third frame and stays, the third only shows up in the last
+	auto first = makeCheckSamples(1);
+	auto second = makeCheckSamples(2);
+	auto third = makeCheckSamples(3);
+	std::pair<int, std::vector<const std::vector<TrainingSample>*>> frames[] = {
+		{0, {&first, &second}},
+		{1, {&second}},
+		{2, {&second, &second}},
+		{RadianceCache::MAX_AGE + 1, {&third}},
+	};
+
+	RadianceCacheView view = {{0, 0, 0}, CHECK_FOOTPRINT_SCALE};
+	ComputeShaderProgram trainProgram("shaders/compute/radiance_cache_train.comp");
+	trainProgram.use();
+	trainProgram.setInt("radianceCacheCapacity", RadianceCache::CAPACITY);
+	trainProgram.setFloat3("viewPos", view.cameraPos);
+	trainProgram.setFloat("footprintScale", view.footprintScale);
+
+	SSBO samplesSSBO(sizeof(TrainingSample) / sizeof(float), 26);
+	RadianceCache::clear();
+	CpuRadianceCache cpuCache;
+	for (const auto& [frame, sets] : frames)
+	{
+		for (auto samples : sets)
+		{
+			samplesSSBO.setData((const float*)samples->data(), samples->size());
+			samplesSSBO.bindDefault();
+			RadianceCache::_cells->bindDefault();
+			trainProgram.use();
+			trainProgram.setInt("sampleCount", samples->size());
+			ComputeShaderProgram::dispatch({((int)samples->size() + CHECK_GROUP_SIZE - 1) / CHECK_GROUP_SIZE, 1, 1}, GL_SHADER_STORAGE_BARRIER_BIT);
+
+			for (const auto& sample : *samples)
+				cpuCache.train(sample.pos, sample.normal, view, sample.radiance);
+		}
+		RadianceCache::resolve(frame);
+		cpuCache.resolve(frame);
+	}
+
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	auto gpuCells = RadianceCache::_cells->readData<GpuCell>(RadianceCache::CAPACITY);
+
+	// Cells are found by probing with the CPU key on both sides, so a different hash on the GPU shows up as a missing cell
+	int checkedCells = 0;
+	int mismatches = 0;
+	std::unordered_set<uint32_t> checked;
+	for (const auto& samples : {first, second, third})
+	{
+		for (const auto& sample : samples)
+		{
+			auto key = RadianceCacheKey::get(sample.pos, sample.normal, view);
+			if (!checked.insert(key.checksum).second) continue;
+			checkedCells++;
+
+			int cpuIndex = cpuCache.findCell(key);
+			int gpuIndex = -1;
+			for (int i = 0; i < RadianceCache::MAX_PROBES && gpuIndex == -1; i++)
+			{
+				int index = (key.hash + i) % RadianceCache::CAPACITY;
+				if (gpuCells[index].meta.x == key.checksum) gpuIndex = index;
+			}
+
+			bool agree = (cpuIndex == -1) == (gpuIndex == -1);
+			if (agree && cpuIndex != -1)
+			{
+				const auto& cpuCell = cpuCache._cells[cpuIndex];
+				const auto& gpuCell = gpuCells[gpuIndex];
+				glm::vec3 diff = glm::abs(cpuCell.radiance - glm::vec3(gpuCell.radiance));
+				float error = std::max({diff.x, diff.y, diff.z}) / std::max(1.0f, std::max({cpuCell.radiance.x, cpuCell.radiance.y, cpuCell.radiance.z}));
+				agree = cpuCell.count == gpuCell.radiance.w && cpuCell.lastFrame == gpuCell.meta.y && error <= CHECK_TOLERANCE;
+			}
+			if (agree) continue;
+
+			if (mismatches++ < CHECK_LOGGED_MISMATCHES)
+				Debug::logError("CPU radiance cache check: cell of ", sample.pos.x, ", ", sample.pos.y, ", ", sample.pos.z, " is ", cpuIndex == -1 ? "missing" : "held", " on the CPU and ", gpuIndex == -1 ? "missing" : "held", " on the GPU, or their contents differ.");
+		}
+	}
+
+	int cpuOccupied = std::ranges::count_if(cpuCache._cells, [](const Cell& cell) { return cell.checksum != 0; });
+	int gpuOccupied = std::ranges::count_if(gpuCells, [](const GpuCell& cell) { return cell.meta.x != 0; });
+	if (cpuOccupied != gpuOccupied)
+		Debug::logError("CPU radiance cache check: ", cpuOccupied, " cells in use on the CPU, ", gpuOccupied, " on the GPU.");
+	Debug::log("CPU radiance cache check: ", checkedCells - mismatches, " of ", checkedCells, " cells agree with radiance_cache.comp.");
+
+	// The check replaced whatever the view had trained
+	RadianceCache::clear();
+	Renderer::resetSamples();
+}
@@ -2,22 +2,79 @@
 
 #include "BufferController.h"
 #include "Camera.h"
+#include "Denoiser.h"
 #include "GLObject.h"
+#include "ImageStats.h"
 #include "ImGuiHandler.h"
+#include "Input.h"
 #include "Material.h"
+#include "MyTime.h"
+#include "PathGuiding.h"
+#include "PrimaryRaster.h"
+#include "RadianceCache.h"
+#include "Sampler.h"
 #include "SDLHandler.h"
 
 void Renderer::init()
 {
+	// Checked up front, a shader over the limit only fails to link
+	GLint maxStorageBlocks = 0;
+	glGetIntegerv(GL_MAX_FRAGMENT_SHADER_STORAGE_BLOCKS, &maxStorageBlocks);
+	if (maxStorageBlocks < FRAGMENT_STORAGE_BLOCKS)
+	{
+		Debug::logError("The pathtracer needs ", FRAGMENT_STORAGE_BLOCKS, " shader storage blocks in the fragment stage, the driver supports ", maxStorageBlocks, ".");
+		throw std::runtime_error("Too few fragment shader storage blocks.");
+	}
+
 	_renderProgram = make_unique<DefaultShaderProgram<RaytraceShader>>("shaders/common/pathtracer.vert", "shaders/pathtracer.frag");
 	_renderProgram->use();
 
+	_occluderCache = make_unique<SSBO>(OCCLUDER_CACHE_ALIGN, 15);
+	_primaryCache = make_unique<SSBO>(PRIMARY_CACHE_ALIGN, 23);
+	_renderProgram->setInt("primaryCachePositions", PRIMARY_CACHE_POSITIONS);
+
+	_renderProgram->setInt("reservoirBase", PathGuiding::RECORDS_SIZE - 1);
+	_renderProgram->setInt("restirCandidates", RESTIR_CANDIDATES);
+	_renderProgram->setInt("restirSpatialSamples", RESTIR_SPATIAL_SAMPLES);
+	_renderProgram->setFloat("restirSpatialRadius", RESTIR_SPATIAL_RADIUS);
+	_renderProgram->setFloat("restirMaxHistory", RESTIR_MAX_HISTORY);
+
+	RadianceCache::init();
+	_renderProgram->use();
+	_renderProgram->setInt("radianceCacheCapacity", RadianceCache::CAPACITY);
+	_renderProgram->setInt("radianceCacheTrainingRatio", RADIANCE_CACHE_TRAINING_RATIO);
+	_renderProgram->setFloat("radianceCacheCellPixels", RadianceCache::CELL_PIXELS);
+
+	PathGuiding::init();
+
+	PrimaryRaster::init();
+	Sampler::init();
+	_renderProgram->setHandle("blueNoiseTexture", Sampler::blueNoiseTexture()->getHandle());
+
+	#ifndef BENCHMARK_BUILD
+	Denoiser::init();
+	ImageStats::init();
+	#endif
+
 	setSPP(_samplesPerPixel);
+	setSamplesPerInvocation(_samplesPerInvocation);
 	setMaxRayBounces(_maxRayBounces);
 	setFogIntensity(_fogIntensity);
 	setFogColor(_fogColor);
 	setMisSampleBrdf(_misSampleBrdf);
 	setMisSampleLight(_misSampleLight);
+	setBVHTraversalMode(_bvhTraversalMode);
+	setUseTriangleRecords(_useTriangleRecords);
+	setUseOccluderCache(_useOccluderCache);
+	setUsePrimaryCache(_usePrimaryCache);
+	setUseRasterPrimary(_useRasterPrimary);
+	setUseRestir(_useRestir);
+	setUseRadianceCache(_useRadianceCache);
+	setUsePathGuiding(_usePathGuiding);
+	setSamplerType(_samplerType);
+	setUseDenoiser(_useDenoiser);
+	setDynamicResolution(_dynamicResolution);
+	setPreviewBounces(_previewBounces);
 	resizeView(ImGuiHandler::INIT_RENDER_SIZE);
 }
 
@@ -26,63 +83,193 @@ void Renderer::render()
 	if (_limitSamples && _totalSamples >= _maxAccumSamples || SDLHandler::isWindowMinimized()) return;
 	_renderProgram->use();
 
+	updatePreview();
 	updateCameraUniforms();
 	BufferController::bindBuffers();
+	_occluderCache->bindDefault();
+	_primaryCache->bindDefault();
+	_frameRecords->bindDefault();
+	RadianceCache::_cells->bindDefault();
+	PathGuiding::beginFrame(_usePathGuiding);
+	Sampler::sobolDirections()->bindDefault();
 
 	_renderProgram->setInt("frame", _frame);
 	_renderProgram->setInt("sampleFrame", _sampleFrame);
 	#ifndef BENCHMARK_BUILD
-	_renderProgram->setHandle("accumMeanTexture", _accumMeanTex->getHandle());
-	_renderProgram->setHandle("accumSqrTexture", _accumSqrTex->getHandle());
+	_accumMeanTex->bindImage(0, GL_READ_WRITE, GL_RGBA32F);
+	_accumAlbedoTex->bindImage(1, GL_READ_WRITE, GL_RGBA16F);
+	_normalDepthTex->bindImage(2, GL_WRITE_ONLY, GL_RGBA32F);
 	#endif
 
 	glBindVertexArray(_renderProgram->fragShader()->vaoScreen()->id());
 
-	GLuint query;
-	glGenQueries(1, &query);
+	bool samplesReset = _sampleFrame == 0;
 
-	glBeginQuery(GL_TIME_ELAPSED, query);
+	// A new epoch invalidates every cached first hit, the buffer is only cleared when the epoch wraps
+	if (samplesReset && _usePrimaryCache)
+	{
+		if (++_primaryCacheEpoch > PRIMARY_CACHE_MAX_EPOCH)
+		{
+			constexpr int emptyEntry = 0;
+			_primaryCache->clear(&emptyEntry);
+			_primaryCacheEpoch = 1;
+		}
+		_renderProgram->setInt("primaryCacheEpoch", _primaryCacheEpoch);
+	}
+
+	GLuint queries[2];
+	glGenQueries(2, queries);
+
+	// Each draw traces a batch per invocation, so a frame costs one accumulation write-back per batch
+	glBeginQuery(GL_TIME_ELAPSED, queries[0]);
 	int n = _renderOneByOne ? 1 : _samplesPerPixel;
-	for (int i = 0; i < n; i++)
+	int batch = 1;
+	for (int i = 0; i < n; i += batch)
 	{
-		_renderProgram->setInt("totalSamples", _totalSamples++);
+		// Rasterized visibility holds a single jitter, so those draws trace one sample each
+		batch = _useRasterPrimary ? 1 : std::min(_samplesPerInvocation, n - i);
+		if (_useRasterPrimary)
+			rasterizePrimaryHits();
+
+		_renderProgram->setInt("totalSamples", _totalSamples);
+		_renderProgram->setInt("invocationSamples", batch);
+		_totalSamples += batch;
 
 		glBindFramebuffer(GL_FRAMEBUFFER, _viewFBO->id());
 		glDrawArrays(GL_TRIANGLES, 0, 6);
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+		if (_useRestir)
+			swapReservoirs();
 	}
+
+	// Training of this frame is folded in before the next one queries the cells
+	if (_useRadianceCache)
+	{
+		RadianceCache::resolve(_frame);
+		_renderProgram->use();
+	}
+	PathGuiding::endFrame();
+	glEndQuery(GL_TIME_ELAPSED);
+
+	glBeginQuery(GL_TIME_ELAPSED, queries[1]);
+	#ifndef BENCHMARK_BUILD
+	if (_useDenoiser)
+	{
+		Denoiser::denoise({_accumMeanTex.get(), _accumAlbedoTex.get(), _normalDepthTex.get()}, _renderSize, DenoiserCamera::current(), _totalSamples, samplesReset);
+		_renderProgram->use();
+	}
+	#endif
 	glEndQuery(GL_TIME_ELAPSED);
 
-	GLuint64 elapsedTime = 0;
-	glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsedTime);
-	_renderTime = elapsedTime / 1000000.0f;
+	GLuint64 traceTime = 0, denoiseTime = 0;
+	glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &traceTime);
+	glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &denoiseTime);
+	glDeleteQueries(2, queries);
+
+	_renderTime = (traceTime + denoiseTime) / 1000000.0f;
+	_samplesPerSecond = traceTime > 0 ? (float)n * _renderSize.x * _renderSize.y / (traceTime / 1e9f) : 0;
+	// Only adapted while the camera moves, the scale stays fixed during the hold so samples can accumulate
+	if (_isPreviewing && Input::cameraMoved())
+		updatePreviewScale();
 
 	glBindVertexArray(0);
 
 	_frame++;
 	_sampleFrame++;
 }
+void Renderer::rasterizePrimaryHits()
+{
+	// One R2 point per sample for the whole image, the tracer takes its jitter from here
+	#ifdef BENCHMARK_BUILD
+	glm::vec2 jitter = {0, 0};
+	#else
+	glm::vec2 jitter = glm::fract(0.5f + (float)_totalSamples * glm::vec2(0.7548776662f, 0.5698402910f)) - 0.5f;
+	#endif
+
+	PrimaryRaster::draw(_renderSize, jitter);
+
+	_renderProgram->use();
+	glBindVertexArray(_renderProgram->fragShader()->vaoScreen()->id());
+	_renderProgram->setFloat2("rasterJitter", jitter);
+	_renderProgram->setHandle("rasterHits", PrimaryRaster::hitTexture()->getHandle());
+}
+void Renderer::swapReservoirs()
+{
+	// The next draw reuses what this one wrote, seen through this draw's camera
+	_reservoirFlip = !_reservoirFlip;
+	int pixelCount = _viewSize.x * _viewSize.y;
+	_renderProgram->setInt("reservoirReadOffset", _reservoirFlip ? pixelCount : 0);
+	_renderProgram->setInt("reservoirWriteOffset", _reservoirFlip ? 0 : pixelCount);
+	_renderProgram->setFloat3("prevCameraPos", Camera::instance->pos());
+	_renderProgram->setMatrix4X4("prevCameraRotMat", Camera::instance->getTransform());
+	_renderProgram->setFloat2("prevPixelSize", _renderSize);
+}
+void Renderer::updatePreview()
+{
+	if (Input::cameraMoved())
+		_lastMotionTime = Time::time();
+
+	// Held briefly after the last motion, so mouse events that skip a frame don't flicker back to full quality
+	bool preview = _dynamicResolution && _lastMotionTime >= 0 && Time::time() - _lastMotionTime < PREVIEW_STILL_DELAY;
+	if (preview == _isPreviewing && !preview) return;
+
+	if (preview != _isPreviewing)
+		resetSamples();
+
+	_isPreviewing = preview;
+	applyRenderSize();
+}
+void Renderer::updatePreviewScale()
+{
+	// Trace time scales with the pixel count, limited per frame so spikes don't make it oscillate
+	float ratio = sqrt(PREVIEW_TARGET_FRAME_TIME / std::max(_renderTime, 0.01f));
+	ratio = glm::clamp(ratio, 1 / PREVIEW_MAX_SCALE_STEP, PREVIEW_MAX_SCALE_STEP);
+	_previewScale = glm::clamp(_previewScale * ratio, PREVIEW_MIN_SCALE, 1.0f);
+}
+void Renderer::applyRenderSize()
+{
+	// Previews trace into the lower left corner of the full size targets, the view stretches it back
+	auto prevRenderSize = _renderSize;
+	_renderSize = _viewSize;
+	if (_isPreviewing)
+		_renderSize = glm::max(glm::ivec2(glm::vec2(_viewSize) * _previewScale), glm::ivec2(1));
+
+	// Accumulated pixels belong to the old extent
+	if (_renderSize != prevRenderSize)
+		resetSamples();
+
+	_renderProgram->use();
+	_renderProgram->setFloat2("pixelSize", _renderSize);
+	_renderProgram->setInt("maxRayBounces", _isPreviewing ? std::min(_maxRayBounces, _previewBounces) : _maxRayBounces);
+	glViewport(0, 0, _renderSize.x, _renderSize.y);
+}
+
 void Renderer::updateCameraUniforms()
 {
 	_renderProgram->setFloat3("cameraPos", Camera::instance->pos());
 	_renderProgram->setMatrix4X4("cameraRotMat", Camera::instance->getTransform());
 }
 
+GLTexture2D* Renderer::outputTexture()
+{
+	#ifndef BENCHMARK_BUILD
+	if (_useDenoiser)
+		return Denoiser::outputTexture();
+	#endif
+	return _viewFBO->renderTexture();
+}
+
 float Renderer::computeSampleVariance()
 {
 	#ifdef BENCHMARK_BUILD
 	return 0;
 	#else
-	auto varianceData = _varianceTex->readData<glm::vec3>();
-
-	float varianceSum = 0;
-	#pragma omp parallel for reduction(+:varianceSum)
-	for (int i = 0; i < varianceData.size(); i++)
-	{
-		glm::vec3& pixelVariance = varianceData[i];
-		varianceSum += (pixelVariance.r + pixelVariance.g + pixelVariance.b) / 3;
-	}
-	return varianceSum / varianceData.size();
+	// Answered by the last finished reduction, the new one is read back a few frames later
+	ImageStats::reduce(_accumMeanTex.get(), _renderSize);
+	_renderProgram->use();
+	return ImageStats::latest().meanVariance;
 	#endif
 }
 
@@ -103,6 +290,11 @@ void Renderer::setSPP(int samples)
 
 	resetSamples();
 }
+void Renderer::setSamplesPerInvocation(int samples)
+{
+	// Batches only change how samples are grouped, the estimate stays the same
+	_samplesPerInvocation = samples;
+}
 void Renderer::setMaxAccumSamples(int maxAccumSamples)
 {
 	auto prevMaxAccumSamples = _maxAccumSamples;
@@ -115,8 +307,7 @@ void Renderer::setMaxAccumSamples(int maxAccumSamples)
 void Renderer::setMaxRayBounces(int bounces)
 {
 	_maxRayBounces = bounces;
-	_renderProgram->use();
-	_renderProgram->setInt("maxRayBounces", _maxRayBounces);
+	applyRenderSize();
 
 	resetSamples();
 }
@@ -154,15 +345,133 @@ void Renderer::setMisSampleLight(bool doSample)
 
 	resetSamples();
 }
+void Renderer::setBVHTraversalMode(BVHTraversalMode mode)
+{
+	_bvhTraversalMode = mode;
+
+	// Both modes find the same hits, so accumulated samples stay valid
+	_renderProgram->use();
+	_renderProgram->setInt("bvhTraversalMode", (int)mode);
+}
+void Renderer::setUseTriangleRecords(bool useRecords)
+{
+	_useTriangleRecords = useRecords;
+
+	// Same hits up to rounding, so accumulated samples stay valid
+	_renderProgram->use();
+	_renderProgram->setBool("useTriangleRecords", useRecords);
+}
+void Renderer::setUseOccluderCache(bool useCache)
+{
+	_useOccluderCache = useCache;
+
+	_renderProgram->use();
+	_renderProgram->setBool("useOccluderCache", useCache);
+}
+void Renderer::setUsePrimaryCache(bool useCache)
+{
+	_usePrimaryCache = useCache;
+
+	// Cached samples revisit fixed sub-pixel positions, which changes the estimate
+	_renderProgram->use();
+	_renderProgram->setBool("usePrimaryCache", useCache);
+
+	resetSamples();
+}
+void Renderer::setUseRasterPrimary(bool useRaster)
+{
+	_useRasterPrimary = useRaster;
+
+	// The jitter becomes shared by all pixels of a sample, which changes the estimate
+	_renderProgram->use();
+	_renderProgram->setBool("useRasterPrimary", useRaster);
+
+	resetSamples();
+}
+void Renderer::setUseRestir(bool useRestir)
+{
+	_useRestir = useRestir;
+
+	_renderProgram->use();
+	_renderProgram->setBool("useRestir", useRestir);
+
+	resetSamples();
+}
+void Renderer::setUseRadianceCache(bool useCache)
+{
+	_useRadianceCache = useCache;
+
+	// Cells trained before the cache was disabled may no longer match the scene
+	RadianceCache::clear();
+	_renderProgram->use();
+	_renderProgram->setBool("useRadianceCache", useCache);
+
+	resetSamples();
+}
+void Renderer::setUsePathGuiding(bool useGuiding)
+{
+	_usePathGuiding = useGuiding;
+
+	// Learning starts over, distributions of an earlier session may not match the scene anymore
+	PathGuiding::reset();
+	_renderProgram->use();
+	_renderProgram->setBool("usePathGuiding", useGuiding);
+
+	resetSamples();
+}
+void Renderer::setSamplerType(SamplerType type)
+{
+	_samplerType = type;
+
+	_renderProgram->use();
+	_renderProgram->setInt("samplerType", (int)type);
+
+	resetSamples();
+}
+void Renderer::setUseDenoiser(bool useDenoiser)
+{
+	_useDenoiser = useDenoiser;
+
+	// The history stops updating while disabled
+	Denoiser::resetHistory();
+}
+void Renderer::setDynamicResolution(bool dynamicResolution)
+{
+	_dynamicResolution = dynamicResolution;
+}
+void Renderer::setPreviewBounces(int bounces)
+{
+	_previewBounces = bounces;
+	if (_isPreviewing)
+		applyRenderSize();
+}
+
+void Renderer::setEnvMap(Texture* envMap, const glm::mat4& envMapToWorld)
+{
+	_envMap = envMap;
+
+	_renderProgram->use();
+	_renderProgram->setBool("useEnvMap", envMap != nullptr);
+	if (envMap != nullptr)
+	{
+		envMap->waitUntilLoaded();
+		_renderProgram->setHandle("envMap", envMap->handle());
+		_renderProgram->setMatrix4X4("envMapToWorld", envMapToWorld);
+	}
+
+	BufferController::updateEnvMapDistribution();
+	BufferController::markBufferForUpdate(BufferType::Lights);
+	resetSamples();
+}
 
 void Renderer::resizeView(glm::ivec2 size)
 {
+	_viewSize = size;
 	resizeTextures(size);
+	applyRenderSize();
 
-	_renderProgram->setFloat2("pixelSize", size);
 	if (Camera::instance)
 		Camera::instance->setRatio(size.x / (float)size.y);
-	glViewport(0, 0, size.x, size.y);
 
 	resetSamples();
 }
@@ -170,21 +479,47 @@ void Renderer::resizeTextures(glm::ivec2 size)
 {
 	_viewFBO.reset();
 	_accumMeanTex.reset();
-	_accumSqrTex.reset();
-	_varianceTex.reset();
+	_accumAlbedoTex.reset();
+	_normalDepthTex.reset();
 
 	_viewFBO = make_unique<GLFrameBuffer>(size);
-	glBindFramebuffer(GL_FRAMEBUFFER, _viewFBO->id());
+	PrimaryRaster::resize(size);
+
+	constexpr int noOccluder = -1;
+	_occluderCache->ensureDataCapacity(size.x * size.y);
+	_occluderCache->clear(&noOccluder);
+
+	constexpr int emptyEntry = 0;
+	_primaryCache->ensureDataCapacity(size.x * size.y * PRIMARY_CACHE_POSITIONS);
+	_primaryCache->clear(&emptyEntry);
+
+	// Guiding records are persistently mapped, so the storage is replaced when the reservoirs behind them outgrow it
+	int reservoirSize = 2 * size.x * size.y * RESERVOIR_SIZE;
+	if (_frameRecords == nullptr || _frameRecords->capacity() < PathGuiding::RECORDS_SIZE + reservoirSize)
+	{
+		auto frameRecords = make_unique<SSBO>(FRAME_RECORD_ALIGN, 24);
+		frameRecords->setStorage(PathGuiding::RECORDS_SIZE + reservoirSize, PathGuiding::RECORD_MAP_FLAGS);
+		PathGuiding::mapRecords(frameRecords.get());
+		_frameRecords = std::move(frameRecords);
+	}
+
+	// Both halves start without samples, and the first draw has no previous view to reproject into
+	_frameRecords->clear(&emptyEntry, PathGuiding::RECORDS_SIZE, reservoirSize);
+	_reservoirFlip = false;
+	_renderProgram->use();
+	_renderProgram->setInt("reservoirStride", size.x);
+	_renderProgram->setInt("reservoirReadOffset", 0);
+	_renderProgram->setInt("reservoirWriteOffset", size.x * size.y);
+	_renderProgram->setFloat2("prevPixelSize", glm::vec2(0));
 
 	#ifndef BENCHMARK_BUILD
-	_accumMeanTex = make_unique<GLTexture2D>(size.x, size.y, nullptr, GL_RGB, GL_RGB32F, GL_NEAREST);
-	_accumSqrTex = make_unique<GLTexture2D>(size.x, size.y, nullptr, GL_RGB, GL_RGB32F, GL_NEAREST);
-	_varianceTex = make_unique<GLTexture2D>(size.x, size.y, nullptr, GL_RGB, GL_RGB32F, GL_NEAREST);
-
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, _accumMeanTex->id(), 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, _accumSqrTex->id(), 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, GL_TEXTURE_2D, _varianceTex->id(), 0);
-	glDrawBuffers(4, DRAW_BUFFERS);
+	// Image load/store targets, the framebuffer only keeps the display color
+	_accumMeanTex = make_unique<GLTexture2D>(size.x, size.y, nullptr, GL_RGBA, GL_RGBA32F, GL_NEAREST);
+	_accumAlbedoTex = make_unique<GLTexture2D>(size.x, size.y, nullptr, GL_RGBA, GL_RGBA16F, GL_NEAREST);
+	_normalDepthTex = make_unique<GLTexture2D>(size.x, size.y, nullptr, GL_RGBA, GL_RGBA32F, GL_NEAREST);
+
+	Denoiser::resize(size);
+	_renderProgram->use();
 	#endif
 }
 
@@ -194,3 +529,11 @@ void Renderer::resetSamples()
 	_totalSamples = 0;
 	_renderTime = 0;
 }
+void Renderer::resetScene()
+{
+	// Cells hold radiance of the scene before the edit, camera moves keep them
+	if (_useRadianceCache)
+		RadianceCache::clear();
+
+	resetSamples();
+}
@@ -0,0 +1,157 @@
+#include "Sampler.h"
+
+#include <array>
+#include <random>
+
+#include "GLObject.h"
+
+// Joe-Kuo primitive polynomials and initial direction numbers for Sobol dimensions 2 and up
+struct SobolParams
+{
+	int s;
+	int a;
+	std::array<uint32_t, 3> m;
+};
+static constexpr SobolParams SOBOL_PARAMS[] = {
+	{1, 0, {1}},
+};
+
+void Sampler::init()
+{
+	auto directions = generateSobolDirections();
+	_sobolDirections = make_unique<SSBO>(1, 16);
+	_sobolDirections->setData((const float*)directions.data(), directions.size());
+
+	auto blueNoise = generateBlueNoise();
+	_blueNoiseTexture = make_unique<GLTexture2D>(BLUE_NOISE_SIZE, BLUE_NOISE_SIZE, blueNoise.data(), GL_RED, GL_R32F, GL_NEAREST, GL_FLOAT);
+}
+
+std::vector<uint32_t> Sampler::generateSobolDirections()
+{
+	std::vector<uint32_t> directions(SOBOL_DIMENSIONS * SOBOL_BITS);
+	for (int k = 0; k < SOBOL_BITS; k++)
+		directions[k] = 1u << (31 - k);
+
+	for (int d = 1; d < SOBOL_DIMENSIONS; d++)
+	{
+		auto [s, a, m] = SOBOL_PARAMS[d - 1];
+		auto v = &directions[d * SOBOL_BITS];
+		for (int k = 0; k < SOBOL_BITS; k++)
+		{
+			if (k < s)
+			{
+				v[k] = m[k] << (31 - k);
+				continue;
+			}
+
+			v[k] = v[k - s] ^ v[k - s] >> s;
+			for (int j = 1; j < s; j++)
+			{
+				if (a >> (s - 1 - j) & 1)
+					v[k] ^= v[k - j];
+			}
+		}
+	}
+	return directions;
+}
+
+// Void-and-cluster (Ulichney 1993), each pixel gets its rank in the progressive point order
+std::vector<float> Sampler::generateBlueNoise()
+{
+	constexpr int size = BLUE_NOISE_SIZE;
+	constexpr int n = size * size;
+
+	// Gaussian energy with toroidal distances, so the mask tiles seamlessly
+	std::vector<float> kernel(n);
+	for (int y = 0; y < size; y++)
+	{
+		for (int x = 0; x < size; x++)
+		{
+			int dx = std::min(x, size - x);
+			int dy = std::min(y, size - y);
+			kernel[y * size + x] = exp(-(dx * dx + dy * dy) / (2 * BLUE_NOISE_SIGMA * BLUE_NOISE_SIGMA));
+		}
+	}
+
+	std::vector<bool> pattern(n);
+	std::vector<float> energy(n);
+	auto splat = [&](int p, float sign)
+	{
+		int px = p % size, py = p / size;
+		for (int y = 0; y < size; y++)
+		{
+			for (int x = 0; x < size; x++)
+				energy[y * size + x] += sign * kernel[(y - py + size) % size * size + (x - px + size) % size];
+		}
+	};
+	auto tightestCluster = [&]
+	{
+		int best = -1;
+		for (int i = 0; i < n; i++)
+		{
+			if (pattern[i] && (best == -1 || energy[i] > energy[best])) best = i;
+		}
+		return best;
+	};
+	auto largestVoid = [&]
+	{
+		int best = -1;
+		for (int i = 0; i < n; i++)
+		{
+			if (!pattern[i] && (best == -1 || energy[i] < energy[best])) best = i;
+		}
+		return best;
+	};
+
+	std::mt19937 rng(BLUE_NOISE_SEED);
+	std::uniform_int_distribution<int> dist(0, n - 1);
+	int ones = n * BLUE_NOISE_INITIAL_DENSITY;
+	for (int placed = 0; placed < ones;)
+	{
+		int p = dist(rng);
+		if (pattern[p]) continue;
+
+		pattern[p] = true;
+		splat(p, 1);
+		placed++;
+	}
+
+	// Move points from the tightest cluster to the largest void until the pattern settles
+	while (true)
+	{
+		int cluster = tightestCluster();
+		pattern[cluster] = false;
+		splat(cluster, -1);
+
+		int largest = largestVoid();
+		pattern[largest] = true;
+		splat(largest, 1);
+		if (largest == cluster) break;
+	}
+
+	std::vector<int> ranks(n);
+	auto prototype = pattern;
+	auto prototypeEnergy = energy;
+	for (int rank = ones - 1; rank >= 0; rank--)
+	{
+		int cluster = tightestCluster();
+		pattern[cluster] = false;
+		splat(cluster, -1);
+		ranks[cluster] = rank;
+	}
+
+	pattern = prototype;
+	energy = prototypeEnergy;
+	for (int rank = ones; rank < n; rank++)
+	{
+		int largest = largestVoid();
+		pattern[largest] = true;
+		splat(largest, 1);
+		ranks[largest] = rank;
+	}
+
+	std::vector<float> values(n);
+	for (int i = 0; i < n; i++)
+		values[i] = (ranks[i] + 0.5f) / n;
+	return values;
+}
@@ -0,0 +1,171 @@
+#include "TextureStreamer.h"
+
+#include "BufferController.h"
+#include "Debug.h"
+#include "Material.h"
+
+void TextureStreamer::init()
+{
+	unsigned char white[4] = {255, 255, 255, 255};
+	_placeholderTex = make_unique<GLTexture2D>(1, 1, white, GL_RGBA, GL_SRGB8_ALPHA8, GL_LINEAR, GL_UNSIGNED_BYTE);
+	_pbo = make_unique<PixelUnpackBuffer>();
+
+	int workerCount = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+	for (int i = 0; i < workerCount; i++)
+		_workers.emplace_back(workerLoop);
+}
+void TextureStreamer::quit()
+{
+	for (auto& worker : _workers)
+		worker.request_stop();
+	_decodeCondition.notify_all();
+	_workers.clear();
+}
+
+void TextureStreamer::request(Texture* tex)
+{
+	{
+		std::lock_guard lock(_mutex);
+		tex->_state = TextureState::Pending;
+		_decodeQueue.push_back(tex);
+	}
+	_decodeCondition.notify_one();
+}
+
+void TextureStreamer::workerLoop(const std::stop_token& stopToken)
+{
+	while (true)
+	{
+		Texture* tex;
+		{
+			std::unique_lock lock(_mutex);
+			if (!_decodeCondition.wait(lock, stopToken, [] { return !_decodeQueue.empty(); })) return;
+
+			tex = _decodeQueue.front();
+			_decodeQueue.pop_front();
+			tex->_state = TextureState::Decoding;
+		}
+
+		bool success = tex->load(tex->_path);
+		if (!success) Debug::logError("Error loading texture: ", tex->_path);
+		{
+			std::lock_guard lock(_mutex);
+			tex->_state = success ? TextureState::Decoded : TextureState::Failed;
+			if (success) _uploadQueue.push_back(tex);
+		}
+		_decodedCondition.notify_all();
+	}
+}
+
+void TextureStreamer::update()
+{
+	std::vector<Texture*> batch;
+	{
+		std::lock_guard lock(_mutex);
+
+		size_t batchBytes = 0;
+		while (!_uploadQueue.empty())
+		{
+			auto tex = _uploadQueue.front();
+			size_t bytes = tex->byteSize();
+			if (!batch.empty() && batchBytes + bytes > UPLOAD_BUDGET_BYTES) break;
+
+			batch.push_back(tex);
+			batchBytes += bytes;
+			_uploadQueue.pop_front();
+		}
+	}
+
+	if (!batch.empty())
+		upload(batch);
+}
+
+void TextureStreamer::finish(Texture* tex)
+{
+	std::unique_lock lock(_mutex);
+	if (tex->_state == TextureState::Ready || tex->_state == TextureState::Failed) return;
+
+	if (auto it = std::ranges::find(_decodeQueue, tex); it != _decodeQueue.end())
+	{
+		_decodeQueue.erase(it);
+		tex->_state = TextureState::Decoding;
+		lock.unlock();
+
+		bool success = tex->load(tex->_path);
+		if (!success) Debug::logError("Error loading texture: ", tex->_path);
+
+		lock.lock();
+		tex->_state = success ? TextureState::Decoded : TextureState::Failed;
+	}
+	else
+	{
+		_decodedCondition.wait(lock, [tex] { return tex->_state != TextureState::Decoding; });
+		std::erase(_uploadQueue, tex);
+	}
+
+	if (tex->_state != TextureState::Decoded) return;
+	lock.unlock();
+
+	upload({tex});
+}
+
+void TextureStreamer::cancel(Texture* tex)
+{
+	std::unique_lock lock(_mutex);
+	_decodedCondition.wait(lock, [tex] { return tex->_state != TextureState::Decoding; });
+
+	std::erase(_decodeQueue, tex);
+	std::erase(_uploadQueue, tex);
+}
+
+void TextureStreamer::upload(const std::vector<Texture*>& textures)
+{
+	size_t totalBytes = 0;
+	for (auto tex : textures)
+		totalBytes += tex->byteSize();
+
+	std::vector<std::vector<size_t>> levelOffsets(textures.size());
+	auto ptr = (unsigned char*)_pbo->map(totalBytes);
+	size_t offset = 0;
+	for (int i = 0; i < textures.size(); i++)
+	{
+		for (const auto& level : textures[i]->_mips)
+		{
+			memcpy(ptr + offset, level.data(), level.size());
+			levelOffsets[i].push_back(offset);
+			offset += level.size();
+		}
+	}
+	_pbo->unmap();
+
+	_pbo->bind();
+	for (int i = 0; i < textures.size(); i++)
+	{
+		auto tex = textures[i];
+		GLenum internalFormat = tex->_isHdr ? GL_RGB16F : tex->_isLinear ? GL_RGBA8 : GL_SRGB8_ALPHA8;
+		GLenum type = tex->_isHdr ? GL_FLOAT : GL_UNSIGNED_BYTE;
+
+		auto glTex = make_unique<GLTexture2D>(tex->_width, tex->_height, (int)tex->_mips.size(), internalFormat);
+		for (int level = 0; level < tex->_mips.size(); level++)
+			glTex->setLevelData(level, (const void*)levelOffsets[i][level], GL_RGBA, type);
+		glTex->setWrapMode(tex->_wrapMode);
+
+		// Only the base level is needed on the CPU afterwards
+		tex->_mips.resize(1);
+		tex->_glTex = std::move(glTex);
+		tex->_state = TextureState::Ready;
+	}
+	PixelUnpackBuffer::unbind();
+
+	BufferController::markBufferForUpdate(BufferType::Textures);
+}
+
+uint64_t TextureStreamer::placeholderHandle()
+{
+	return _placeholderTex->getHandle();
+}
+int TextureStreamer::pendingCount()
+{
+	std::lock_guard lock(_mutex);
+	return (int)(_decodeQueue.size() + _uploadQueue.size());
+}
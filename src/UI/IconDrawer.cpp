@@ -11,6 +11,7 @@
 void IconDrawer::init()
 {
 	_lightIconTex = Assets::load<Texture>("assets/textures/core/lightIcon.png");
+	_lightIconTex->waitUntilLoaded();
 }
 
 void IconDrawer::draw()
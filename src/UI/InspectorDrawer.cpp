@@ -158,6 +158,12 @@ void MeshInspectorDrawer::draw(Mesh* target)
 	{
 		if (target->model() != nullptr)
 			ImGui::LabeledInt("Triangle Count", target->model()->baseTriangles().size(), ImGuiInputTextFlags_ReadOnly);
+		if (target->model() != nullptr && target->model()->hasMaterialLibrary())
+		{
+			auto useModelMaterials = target->useModelMaterials();
+			if (ImGui::LabeledCheckbox("Use Model Materials", useModelMaterials))
+				target->setUseModelMaterials(useModelMaterials);
+		}
 		if (ImGui::Button("Set Model"))
 		{
 			auto dir = std::filesystem::current_path().concat("/assets/models/").string();
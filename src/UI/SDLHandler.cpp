@@ -51,9 +51,14 @@ void SDLHandler::initOpenGL()
 
 	Shader::addInclude("shaders/common/common.glsl");
 	Shader::addInclude("shaders/common/utils.glsl");
+	Shader::addInclude("shaders/common/sampler.glsl");
+	Shader::addInclude("shaders/common/denoise.glsl");
+	Shader::addInclude("shaders/common/radiance_cache.glsl");
 	Shader::addInclude("shaders/intersection.glsl");
 	Shader::addInclude("shaders/light.glsl");
 	Shader::addInclude("shaders/shading.glsl");
+	Shader::addInclude("shaders/restir.glsl");
+	Shader::addInclude("shaders/guiding.glsl");
 
 	#ifdef BENCHMARK_BUILD
 	Shader::addDefine("BENCHMARK_BUILD");
@@ -1,16 +1,23 @@
 #include "WindowDrawer.h"
 
+#include "Benchmark.h"
+#include "BufferController.h"
 #include "Camera.h"
+#include "Denoiser.h"
 #include "Graphical.h"
 #include "IconDrawer.h"
+#include "ImageStats.h"
 #include "ImGuiExtensions.h"
 #include "Input.h"
 #include "Light.h"
 #include "ObjectManipulator.h"
+#include "Physics.h"
+#include "RadianceCache.h"
 #include "Renderer.h"
 #include "Scene.h"
 #include "SceneLoader.h"
 #include "SDLHandler.h"
+#include "TextureStreamer.h"
 #include "Utils.h"
 
 void WindowDrawer::init()
@@ -90,6 +97,23 @@ void WindowDrawer::drawMenuBar()
 
 			ImGui::EndMenu();
 		}
+		if (ImGui::BeginMenu("Debug"))
+		{
+			if (ImGui::MenuItem("Check CPU BVH"))
+				Physics::checkCpuBVH();
+			if (ImGui::MenuItem("Check CPU Radiance Cache"))
+				CpuRadianceCache::checkAgainstGpu();
+			#ifndef BENCHMARK_BUILD
+			if (ImGui::MenuItem("Check CPU Denoiser"))
+				CpuDenoiser::checkAgainstGpu();
+			if (ImGui::MenuItem("Compare Samplers", nullptr, false, !Benchmark::isRunning()))
+				Benchmark::compareSamplers();
+			if (ImGui::MenuItem("Compare Features", nullptr, false, !Benchmark::isRunning()))
+				Benchmark::compareFeatures();
+			#endif
+
+			ImGui::EndMenu();
+		}
 		ImGui::EndMainMenuBar();
 	}
 	ImGui::PopItemFlag();
@@ -110,7 +134,8 @@ void WindowDrawer::drawScene()
 			node->WantHiddenTabBarToggle = true;
 
 		ImVec2 availSize = ImGui::GetContentRegionAvail();
-		ImGui::Image(Renderer::sceneViewFBO()->renderTexture()->id(), availSize, ImVec2(0, 1), ImVec2(1, 0));
+		auto uvScale = Renderer::outputUvScale();
+		ImGui::Image(Renderer::outputTexture()->id(), availSize, ImVec2(0, uvScale.y), ImVec2(uvScale.x, 0));
 
 		if (availSize.x != _currRenderSize.x || availSize.y != _currRenderSize.y)
 		{
@@ -132,6 +157,7 @@ void WindowDrawer::displayStats(bool barVisible)
 	static float currFPS = -1;
 	static float currVariance = -1;
 	static float renderTime = -1;
+	static float samplesPerSecond = 0;
 	static float efficiency = -1;
 	static int totalSamples = -1;
 	static Timer updateTimer = Timer(100);
@@ -141,6 +167,7 @@ void WindowDrawer::displayStats(bool barVisible)
 	{
 		currFPS = ImGuiHandler::_io->Framerate;
 		renderTime = Renderer::renderTime();
+		samplesPerSecond = Renderer::samplesPerSecond();
 		totalSamples = Renderer::totalSamples();
 
 		if (ImGui::IsMouseDown(ImGuiMouseButton_Middle))
@@ -158,14 +185,22 @@ void WindowDrawer::displayStats(bool barVisible)
 	            "%d Triangles\n"
 	            "Total samples: %d\n"
 	            "Variance: %.3f (x1000)\n"
+	            "Luminance: %.3f - %.3f\n"
 	            "Render time: %.3fms\n"
-	            "Efficiency: %.3f\n",
+	            "Samples/s: %.1fM\n"
+	            "Efficiency: %.3f\n"
+	            "Streaming textures: %d\n"
+	            "Buffer uploads: %.1f KB\n",
 	            currFPS, 1000.0f / currFPS,
 	            Scene::triangleCount,
 	            totalSamples,
 	            currVariance * 1000,
+	            ImageStats::latest().minLuminance, ImageStats::latest().maxLuminance,
 	            renderTime,
-	            efficiency);
+	            samplesPerSecond / 1e6f,
+	            efficiency,
+	            TextureStreamer::pendingCount(),
+	            BufferController::lastFrameUploadedBytes() / 1024.0f);
 }
 
 void WindowDrawer::drawInspector()
@@ -208,6 +243,11 @@ void WindowDrawer::drawInspector()
 				if (samplesPerPixel != Renderer::samplesPerPixel())
 					Renderer::setSPP(samplesPerPixel);
 
+				auto samplesPerInvocation = Renderer::samplesPerInvocation();
+				ImGui::LabeledSliderInt("Samples Per Invocation", samplesPerInvocation, 1, 16);
+				if (samplesPerInvocation != Renderer::samplesPerInvocation())
+					Renderer::setSamplesPerInvocation(samplesPerInvocation);
+
 				auto bounces = Renderer::maxRayBounces();
 				ImGui::LabeledSliderInt("Ray Bounces", bounces, 0, 10);
 				if (bounces != Renderer::maxRayBounces())
@@ -231,6 +271,66 @@ void WindowDrawer::drawInspector()
 				ImGui::LabeledCheckbox("Mis Sample Light", misSampleLight);
 				if (misSampleLight != Renderer::misSampleLight())
 					Renderer::setMisSampleLight(misSampleLight);
+
+				auto bvhTraversalMode = (int)Renderer::bvhTraversalMode();
+				ImGui::LabeledCombo("BVH Traversal", bvhTraversalMode, "Hit/Miss Links\0Ordered Stack\0Six-Sided Links\0");
+				if (bvhTraversalMode != (int)Renderer::bvhTraversalMode())
+					Renderer::setBVHTraversalMode((BVHTraversalMode)bvhTraversalMode);
+
+				auto useTriangleRecords = Renderer::useTriangleRecords();
+				ImGui::LabeledCheckbox("Triangle Records", useTriangleRecords);
+				if (useTriangleRecords != Renderer::useTriangleRecords())
+					Renderer::setUseTriangleRecords(useTriangleRecords);
+
+				auto samplerType = (int)Renderer::samplerType();
+				ImGui::LabeledCombo("Sampler", samplerType, "Random\0Sobol\0Blue Noise\0");
+				if (samplerType != (int)Renderer::samplerType())
+					Renderer::setSamplerType((SamplerType)samplerType);
+
+				auto useOccluderCache = Renderer::useOccluderCache();
+				ImGui::LabeledCheckbox("Occluder Cache", useOccluderCache);
+				if (useOccluderCache != Renderer::useOccluderCache())
+					Renderer::setUseOccluderCache(useOccluderCache);
+
+				auto usePrimaryCache = Renderer::usePrimaryCache();
+				ImGui::LabeledCheckbox("Primary Hit Cache", usePrimaryCache);
+				if (usePrimaryCache != Renderer::usePrimaryCache())
+					Renderer::setUsePrimaryCache(usePrimaryCache);
+
+				auto useRasterPrimary = Renderer::useRasterPrimary();
+				ImGui::LabeledCheckbox("Raster Primary Visibility", useRasterPrimary);
+				if (useRasterPrimary != Renderer::useRasterPrimary())
+					Renderer::setUseRasterPrimary(useRasterPrimary);
+
+				auto useRestir = Renderer::useRestir();
+				ImGui::LabeledCheckbox("ReSTIR Direct Lighting", useRestir);
+				if (useRestir != Renderer::useRestir())
+					Renderer::setUseRestir(useRestir);
+
+				auto useRadianceCache = Renderer::useRadianceCache();
+				ImGui::LabeledCheckbox("Radiance Cache", useRadianceCache);
+				if (useRadianceCache != Renderer::useRadianceCache())
+					Renderer::setUseRadianceCache(useRadianceCache);
+
+				auto usePathGuiding = Renderer::usePathGuiding();
+				ImGui::LabeledCheckbox("Path Guiding", usePathGuiding);
+				if (usePathGuiding != Renderer::usePathGuiding())
+					Renderer::setUsePathGuiding(usePathGuiding);
+
+				auto useDenoiser = Renderer::useDenoiser();
+				ImGui::LabeledCheckbox("Denoiser", useDenoiser);
+				if (useDenoiser != Renderer::useDenoiser())
+					Renderer::setUseDenoiser(useDenoiser);
+
+				auto dynamicResolution = Renderer::dynamicResolution();
+				ImGui::LabeledCheckbox("Dynamic Resolution", dynamicResolution);
+				if (dynamicResolution != Renderer::dynamicResolution())
+					Renderer::setDynamicResolution(dynamicResolution);
+
+				auto previewBounces = Renderer::previewBounces();
+				ImGui::LabeledSliderInt("Preview Bounces", previewBounces, 0, 10);
+				if (previewBounces != Renderer::previewBounces())
+					Renderer::setPreviewBounces(previewBounces);
 			}
 		}
 	}
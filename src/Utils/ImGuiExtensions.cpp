@@ -109,3 +109,7 @@ bool ImGui::LabeledCheckbox(const char* label, bool& value, int flags)
 {
 	return LabeledInputNoFlags(label, Checkbox, flags, &value);
 }
+bool ImGui::LabeledCombo(const char* label, int& value, const char* items, int flags)
+{
+	return LabeledInputNoFlags(label, [](const char* id, int* current, const char* names) { return Combo(id, current, names); }, flags, &value, items);
+}
@@ -50,6 +50,25 @@ float Math::getLengthSquared(glm::vec3 v)
 {
 	return v.x * v.x + v.y * v.y + v.z * v.z;
 }
+float Math::luminance(const glm::vec3& color)
+{
+	return 0.2126f * color.x + 0.7152f * color.y + 0.0722f * color.z;
+}
+
+// World AABB of a local box, from the transformed center and absolute extents
+void Math::transformBounds(const glm::mat4& transform, const glm::vec3& localMin, const glm::vec3& localMax, glm::vec3& min, glm::vec3& max)
+{
+	glm::vec3 center = transform * glm::vec4((localMin + localMax) * 0.5f, 1);
+	glm::vec3 extent = (localMax - localMin) * 0.5f;
+
+	glm::mat3 absRot = glm::mat3(transform);
+	for (int c = 0; c < 3; c++)
+		absRot[c] = abs(absRot[c]);
+	extent = absRot * extent;
+
+	min = center - extent;
+	max = center + extent;
+}
 
 glm::vec3 Math::randomVectorInCircle(float radius)
 {